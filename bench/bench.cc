@@ -0,0 +1,1327 @@
+#include <iostream>
+#include <ios>     // std::fixed
+#include <iomanip> // std::setprecision
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio> // std::remove
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <rawimage.h>
+#include <imageproc.h>
+
+using namespace imageproc;
+
+// Synthetic test frame: smooth gradients with uniform noise on top, so that
+// the sigma filter has both flat regions and edges to work on.
+static std::vector<unsigned char> make_image(size_t width, size_t height,
+                                             size_t depth) {
+  std::vector<unsigned char> img(width * height * depth);
+  std::mt19937 gen(12345U);
+  std::uniform_int_distribution<int> noise(-24, 24);
+
+  for (size_t row = 0U; row < height; row++) {
+    for (size_t col = 0U; col < width; col++) {
+      for (size_t d = 0U; d < depth; d++) {
+        int base = static_cast<int>(((row + d * 64U) * 255U) / height +
+                                    ((col * 3U) & 0xff)) / 2;
+        int v = base + noise(gen);
+        img[LOC(row, col, width, depth, d)] =
+            static_cast<unsigned char>(std::max(0, std::min(255, v)));
+      }
+    }
+  }
+  return img;
+}
+
+// Hardware cache-miss counter of the calling thread (Linux perf events).
+// Returns -1 where the counter is unavailable, e.g. outside of Linux or when
+// kernel.perf_event_paranoid does not allow it.
+class CacheMisses {
+public:
+  CacheMisses() {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+  ~CacheMisses() {
+#ifdef __linux__
+    if (fd >= 0)
+      close(fd);
+#endif
+  }
+  template <typename Func> long long count(Func func) {
+#ifdef __linux__
+    long long misses = -1;
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    func();
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+        misses = -1;
+    }
+    return misses;
+#else
+    func();
+    return -1;
+#endif
+  }
+
+private:
+  int fd{ -1 };
+};
+
+// Best-of-reps wall time of func() in seconds
+template <typename Func> static double time_best(size_t reps, Func func) {
+  double best = 0.;
+  for (size_t r = 0U; r < reps; r++) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (r == 0U || elapsed.count() < best)
+      best = elapsed.count();
+  }
+  return best;
+}
+
+// Speedup of the row-band parallel sigma filter from 1 to max_threads
+static int bench_sigma_threads(size_t width, size_t height,
+                               size_t max_threads) {
+  const size_t depth = 3U;
+  const unsigned char sigma = 100U;
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> reference(input.size());
+  std::vector<unsigned char> output(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+  double serial = 0.;
+
+  sigma_filter(input.data(), reference.data(), width, height, depth, sigma);
+
+  std::cout << "sigma_filter " << width << 'x' << height << 'x' << depth
+            << " sigma=" << static_cast<int>(sigma) << '\n';
+  std::cout << "threads\tms\tMP/s\tspeedup\n";
+  for (size_t threads = 1U; threads <= max_threads; threads++) {
+    double t = time_best(3U, [&]() {
+      sigma_filter(input.data(), output.data(), width, height, depth, sigma, 1U,
+                   threads);
+    });
+    if (threads == 1U)
+      serial = t;
+    if (memcmp(output.data(), reference.data(), output.size())) {
+      std::cerr << "Output with " << threads
+                << " threads differs from the serial one.\n";
+      return 1;
+    }
+    std::cout << threads << '\t' << std::fixed << std::setprecision(1)
+              << t * 1e3 << '\t' << std::setprecision(2) << mpix / t << '\t'
+              << serial / t << '\n';
+  }
+  return 0;
+}
+
+// Row vs column histogram engines of the sigma filter over kernel sizes
+static int bench_sigma_engines(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const unsigned char sigma = 100U;
+  const size_t kernel_sizes[] = { 1U, 2U, 3U, 5U, 7U, 10U, 15U };
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> out_row(input.size());
+  std::vector<unsigned char> out_col(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+
+  std::cout << "sigma_filter " << width << 'x' << height << 'x' << depth
+            << " sigma=" << static_cast<int>(sigma) << '\n';
+  std::cout << "kernel\trow ms\tMP/s\tcolumn ms\tMP/s\n";
+  for (size_t kernel_size : kernel_sizes) {
+    double t_row = time_best(3U, [&]() {
+      sigma_filter(input.data(), out_row.data(), width, height, depth, sigma,
+                   kernel_size, 1U, SigmaEngine::row_histogram);
+    });
+    double t_col = time_best(3U, [&]() {
+      sigma_filter(input.data(), out_col.data(), width, height, depth, sigma,
+                   kernel_size, 1U, SigmaEngine::column_histogram);
+    });
+    if (out_row != out_col) {
+      std::cerr << "Engines differ for kernel_size " << kernel_size << ".\n";
+      return 1;
+    }
+    std::cout << kernel_size << '\t' << std::fixed << std::setprecision(1)
+              << t_row * 1e3 << '\t' << std::setprecision(2) << mpix / t_row
+              << '\t' << std::setprecision(1) << t_col * 1e3 << "\t\t"
+              << std::setprecision(2) << mpix / t_col << '\n';
+  }
+  return 0;
+}
+
+// All three engines over kernel sizes and sigma, to find where the direct
+// window stops beating the histograms
+static int bench_sigma_crossover(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const unsigned sigmas[] = { 10U, 50U, 150U };
+  const SigmaEngine engines[] = { SigmaEngine::row_histogram,
+                                  SigmaEngine::column_histogram,
+                                  SigmaEngine::direct_window };
+  const char *names[] = { "row", "column", "direct" };
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> reference(input.size()), output(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+
+  std::cout << "sigma_filter " << width << 'x' << height << 'x' << depth
+            << " (MP/s)\n";
+  std::cout << "sigma\tkernel\trow\tcolumn\tdirect\tfastest\n";
+  for (unsigned sigma : sigmas) {
+    for (size_t kernel_size = 1U; kernel_size <= 6U; kernel_size++) {
+      size_t fastest = 0U;
+      double best = 0.;
+
+      std::cout << sigma << '\t' << kernel_size;
+      for (size_t e = 0U; e < 3U; e++) {
+        unsigned char *out = e ? output.data() : reference.data();
+        double t = time_best(3U, [&]() {
+          sigma_filter(input.data(), out, width, height, depth,
+                       static_cast<unsigned char>(sigma), kernel_size, 1U,
+                       engines[e]);
+        });
+        if (e && output != reference) {
+          std::cerr << "\nEngines differ for kernel_size " << kernel_size
+                    << ".\n";
+          return 1;
+        }
+        if (e == 0U || t < best) {
+          best = t;
+          fastest = e;
+        }
+        std::cout << '\t' << std::fixed << std::setprecision(2) << mpix / t;
+      }
+      std::cout << '\t' << names[fastest] << '\n';
+    }
+  }
+  return 0;
+}
+
+// Sigma filter throughput over the sigma range (the cost of the range query
+// over the histogram grows with sigma unless it is answered hierarchically)
+static int bench_sigma_sweep(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const unsigned sigmas[] = { 5U, 10U, 25U, 50U, 100U, 150U, 200U, 255U };
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> output(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+
+  std::cout << "sigma_filter " << width << 'x' << height << 'x' << depth
+            << " kernel_size=1\n";
+  std::cout << "sigma\trow ms\tMP/s\tcolumn ms\tMP/s\n";
+  for (unsigned sigma : sigmas) {
+    double t_row = time_best(3U, [&]() {
+      sigma_filter(input.data(), output.data(), width, height, depth, sigma, 1U,
+                   1U, SigmaEngine::row_histogram);
+    });
+    double t_col = time_best(3U, [&]() {
+      sigma_filter(input.data(), output.data(), width, height, depth, sigma, 1U,
+                   1U, SigmaEngine::column_histogram);
+    });
+    std::cout << sigma << '\t' << std::fixed << std::setprecision(1)
+              << t_row * 1e3 << '\t' << std::setprecision(2) << mpix / t_row
+              << '\t' << std::setprecision(1) << t_col * 1e3 << "\t\t"
+              << std::setprecision(2) << mpix / t_col << '\n';
+  }
+  return 0;
+}
+
+// Row-major vs tiled rotation of a large frame at a few angles
+static int bench_rotate_tiles(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const float angles[] = { 0.3f, 0.785f, 1.5f };
+  const size_t tile_sizes[] = { 0U, 16U, 32U, 64U, 128U, 256U };
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> output(input.size());
+  std::vector<unsigned char> reference(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+  CacheMisses misses;
+
+  std::cout << "rotate " << width << 'x' << height << 'x' << depth << '\n';
+  std::cout << "angle\ttile\tms\tMP/s\tcache misses\n";
+  for (float angle : angles) {
+    rotate(input.data(), reference.data(), width, height, depth, angle);
+    for (size_t tile_size : tile_sizes) {
+      double t = time_best(3U, [&]() {
+        rotate(input.data(), output.data(), width, height, depth, angle,
+               tile_size);
+      });
+      long long m = misses.count([&]() {
+        rotate(input.data(), output.data(), width, height, depth, angle,
+               tile_size);
+      });
+      if (output != reference) {
+        std::cerr << "Tiled output differs for tile size " << tile_size
+                  << ".\n";
+        return 1;
+      }
+      std::cout << std::fixed << std::setprecision(2) << angle << '\t';
+      if (tile_size)
+        std::cout << tile_size;
+      else
+        std::cout << "rows";
+      std::cout << '\t' << std::setprecision(1) << t * 1e3 << '\t'
+                << std::setprecision(2) << mpix / t << '\t';
+      if (m >= 0)
+        std::cout << m << '\n';
+      else
+        std::cout << "n/a\n";
+    }
+  }
+  return 0;
+}
+
+// Lossless reorientation of every EXIF orientation, next to the bilinear path
+// at an angle just off pi/2 (what a quarter turn used to cost)
+static int bench_orientation(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const char *names[] = { "identity",  "flip_horizontal", "rotate_180",
+                          "flip_vertical", "transpose",   "rotate_90",
+                          "transverse",    "rotate_270" };
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> output(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+
+  std::cout << "reorient " << width << 'x' << height << 'x' << depth << '\n';
+  std::cout << "orientation\t\tms\tMP/s\n";
+  for (int o = 1; o <= 8; o++) {
+    double t = time_best(5U, [&]() {
+      reorient(input.data(), output.data(), width, height, depth,
+               static_cast<Orientation>(o));
+    });
+    std::cout << std::left << std::setw(16) << names[o - 1] << std::right
+              << '\t' << std::fixed << std::setprecision(1) << t * 1e3
+              << '\t' << std::setprecision(2) << mpix / t << '\n';
+  }
+
+  float off_quarter = static_cast<float>(M_PI_2) + 1e-3f;
+  double t_flt = time_best(5U, [&]() {
+    rotate(input.data(), output.data(), width, height, depth, off_quarter);
+  });
+  double t_fxp = time_best(5U, [&]() {
+    rotate_fxp(input.data(), output.data(), width, height, depth,
+               off_quarter);
+  });
+  std::cout << "bilinear rotate\t\t" << std::setprecision(1) << t_flt * 1e3
+            << '\t' << std::setprecision(2) << mpix / t_flt << '\n'
+            << "bilinear rotate_fxp\t" << std::setprecision(1) << t_fxp * 1e3
+            << '\t' << std::setprecision(2) << mpix / t_fxp << '\n';
+  return 0;
+}
+
+// Interleaved <-> planar conversions (scalar and vectorized) and the kernels
+// on both layouts
+static int bench_planar(size_t width, size_t height) {
+  const size_t depth = 3U;
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> planar(input.size()), output(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+  auto report = [&](const char *name, double t_interleaved, double t_planar) {
+    std::cout << std::left << std::setw(16) << name << std::right << '\t'
+              << std::fixed << std::setprecision(1) << t_interleaved * 1e3
+              << "\t\t" << t_planar * 1e3 << '\n';
+  };
+
+  std::cout << "planar layout " << width << 'x' << height << 'x' << depth
+            << '\n';
+  std::cout << "conversion\tsimd\tms\tMP/s\n";
+  for (Simd simd : { Simd::none, simd_supported() }) {
+    set_simd(simd);
+    double t_de = time_best(5U, [&]() {
+      deinterleave(input.data(), planar.data(), width, height, depth);
+    });
+    double t_in = time_best(5U, [&]() {
+      interleave(planar.data(), output.data(), width, height, depth);
+    });
+    std::cout << "deinterleave\t" << (simd == Simd::none ? "none" : "yes")
+              << '\t' << std::fixed << std::setprecision(1) << t_de * 1e3
+              << '\t' << std::setprecision(0) << mpix / t_de << '\n'
+              << "interleave\t" << (simd == Simd::none ? "none" : "yes")
+              << '\t' << std::setprecision(1) << t_in * 1e3 << '\t'
+              << std::setprecision(0) << mpix / t_in << '\n';
+    if (simd == simd_supported())
+      break;
+  }
+  set_simd(simd_supported());
+
+  std::cout << "kernel\t\t\tinterleaved ms\tplanar ms\n";
+  for (unsigned char sigma : { 20U, 100U }) {
+    std::string name = "sigma_filter " + std::to_string(sigma);
+    report(name.c_str(), time_best(3U, [&]() {
+      sigma_filter(input.data(), output.data(), width, height, depth, sigma);
+    }), time_best(3U, [&]() {
+      sigma_filter_planar(planar.data(), output.data(), width, height, depth,
+                          sigma);
+    }));
+  }
+  report("rotate", time_best(5U, [&]() {
+    rotate(input.data(), output.data(), width, height, depth, 0.5f);
+  }), time_best(5U, [&]() {
+    rotate_planar(planar.data(), output.data(), width, height, depth, 0.5f);
+  }));
+  report("rotate_fxp", time_best(5U, [&]() {
+    rotate_fxp(input.data(), output.data(), width, height, depth, 0.5f);
+  }), time_best(5U, [&]() {
+    rotate_fxp_planar(planar.data(), output.data(), width, height, depth,
+                      0.5f);
+  }));
+  return 0;
+}
+
+// Cost of getting a zeroed output frame: a new heap-backed image per frame
+// (what every create() used to amount to), one image reused, and new images
+// backed by a pool
+static int bench_rawimage_alloc(size_t width, size_t height) {
+  using RawIm = rawimage::RawImage;
+  const size_t frames = 20U;
+  const RawIm::ByteOrder rgb = RawIm::ByteOrder::rgb;
+  const RawIm::PixFormat chr = RawIm::PixFormat::chr;
+  rawimage::BufferPool pool;
+  RawIm reused{ rgb, chr };
+
+  double t_new = time_best(3U, [&]() {
+    for (size_t f = 0U; f < frames; f++) {
+      RawIm img{ rgb, chr };
+      img.create(width, height);
+    }
+  });
+  double t_reused = time_best(3U, [&]() {
+    for (size_t f = 0U; f < frames; f++) {
+      reused.create(width, height);
+    }
+  });
+  double t_pool = time_best(3U, [&]() {
+    for (size_t f = 0U; f < frames; f++) {
+      RawIm img{ rgb, chr, &pool };
+      img.create(width, height);
+    }
+  });
+
+  std::cout << "create " << frames << " frames " << width << 'x' << height
+            << "x3 (ms per frame)\n";
+  std::cout << "new image\treused image\tpooled image\n";
+  std::cout << std::fixed << std::setprecision(3) << t_new * 1e3 / frames
+            << "\t\t" << t_reused * 1e3 / frames << "\t\t"
+            << t_pool * 1e3 / frames << '\n';
+  return 0;
+}
+
+// Loading a frame written by the previous pipeline stage: decoding a PNG
+// against mapping a raw frame file (both written to the current directory)
+static int bench_raw_frame(size_t width, size_t height) {
+  using RawIm = rawimage::RawImage;
+  const char *png_file = "imageproc_bench_frame.png";
+  const char *raw_file = "imageproc_bench_frame.raw";
+  std::vector<unsigned char> input = make_image(width, height, 3U);
+  RawIm img{ RawIm::ByteOrder::rgb, RawIm::PixFormat::chr };
+  RawIm loaded{ RawIm::ByteOrder::rgb, RawIm::PixFormat::chr };
+  volatile unsigned sum = 0U;
+
+  img.create(width, height, false);
+  memcpy(img.raw.chr, input.data(), input.size());
+  img.save(png_file);
+  img.saveRaw(raw_file);
+
+  double t_png = time_best(3U, [&]() { loaded.read(png_file); });
+  double t_ro = time_best(3U, [&]() {
+    loaded.mapRaw(raw_file, RawIm::MapMode::readOnly);
+  });
+  double t_cow = time_best(3U, [&]() { loaded.mapRaw(raw_file); });
+  // First touch of every page of the mapping (page cache hits)
+  double t_touch = time_best(3U, [&]() {
+    loaded.mapRaw(raw_file, RawIm::MapMode::readOnly);
+    for (size_t u = 0U; u < input.size(); u += 4096U)
+      sum += loaded.raw.chr[u];
+  });
+  loaded.wipe();
+  std::remove(png_file);
+  std::remove(raw_file);
+
+  std::cout << "load " << width << 'x' << height << "x3 frame (ms)\n";
+  std::cout << "png read\traw read-only\traw copy-on-write\traw + touch\n";
+  std::cout << std::fixed << std::setprecision(3) << t_png * 1e3 << "\t\t"
+            << t_ro * 1e3 << "\t\t" << t_cow * 1e3 << "\t\t\t"
+            << t_touch * 1e3 << '\n';
+  return 0;
+}
+
+static const char *simd_name(Simd simd) {
+  switch (simd) {
+  case Simd::none:
+    return "scalar";
+  case Simd::sse41:
+    return "sse4.1";
+  case Simd::avx2:
+    return "avx2";
+  }
+  return "";
+}
+
+static const char *interp_name(Interpolation interp) {
+  switch (interp) {
+  case Interpolation::bilinear:
+    return "bilinear";
+  case Interpolation::bicubic:
+    return "bicubic";
+  case Interpolation::lanczos3:
+    return "lanczos3";
+  }
+  return "";
+}
+
+// Bicubic and Lanczos-3 rotation against bilinear (scalar and at the best
+// SIMD level), float and fixed-point
+static int bench_resample(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const float angle = 0.5f;
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> output(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+  auto report = [&](const std::string &name, double t) {
+    std::cout << std::left << std::setw(24) << name << std::right << '\t'
+              << std::fixed << std::setprecision(1) << t * 1e3 << '\t'
+              << std::setprecision(2) << mpix / t << '\n';
+  };
+
+  std::cout << "rotate " << width << 'x' << height << 'x' << depth
+            << " angle=" << angle << '\n';
+  std::cout << "kernel\t\t\t\tms\tMP/s\n";
+  for (Interpolation interp : { Interpolation::bilinear,
+                                Interpolation::bicubic,
+                                Interpolation::lanczos3 }) {
+    for (Simd simd : { Simd::none, simd_supported() }) {
+      // Only bilinear interpolation is vectorized
+      if (interp != Interpolation::bilinear && simd != Simd::none)
+        continue;
+      set_simd(simd);
+      std::string level = std::string(" (") + simd_name(simd) + ')';
+      report(std::string("rotate ") + interp_name(interp) + level,
+             time_best(3U, [&]() {
+               rotate(input.data(), output.data(), width, height, depth,
+                      angle, 0U, interp);
+             }));
+      report(std::string("rotate_fxp ") + interp_name(interp) + level,
+             time_best(3U, [&]() {
+               rotate_fxp(input.data(), output.data(), width, height, depth,
+                          angle, 0U, interp);
+             }));
+      if (simd_supported() == Simd::none)
+        break;
+    }
+  }
+  set_simd(simd_supported());
+  return 0;
+}
+
+// Deskew + denoise + gray as three full-frame passes vs one FusedChain pass
+static int bench_fused(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const float angle = 0.05f;
+  const unsigned char sigma = 50U;
+  const size_t kernel_size = 2U;
+  size_t threads[] = { 1U, std::max(1U, std::thread::hardware_concurrency()) };
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> rotated(input.size()), filtered(input.size());
+  std::vector<unsigned char> gray(width * height), fused(width * height);
+  double mpix = static_cast<double>(width * height) / 1e6;
+  CacheMisses misses;
+
+  std::cout << "rotate_fxp + sigma_filter + to_gray " << width << 'x'
+            << height << 'x' << depth << " angle=" << angle
+            << " sigma=" << int(sigma) << " k=" << kernel_size << '\n';
+  std::cout << "threads\tpasses\tms\tMP/s\tcache misses\n";
+  for (size_t num_threads : threads) {
+    auto separate = [&]() {
+      rotate_fxp(input.data(), rotated.data(), width, height, depth, angle);
+      sigma_filter(rotated.data(), filtered.data(), width, height, depth,
+                   sigma, kernel_size, num_threads);
+      to_gray(filtered.data(), gray.data(), width, height, depth);
+    };
+    FusedChain chain;
+    chain.rotate_fxp(angle).sigma_filter(sigma, kernel_size).to_gray();
+    auto single = [&]() {
+      chain.run(ConstImageView(input.data(), width, height, depth),
+                ImageView(fused.data(), width, height, 1U), num_threads);
+    };
+
+    for (int pass = 0; pass < 2; pass++) {
+      std::function<void()> func = pass ? std::function<void()>(single)
+                                        : std::function<void()>(separate);
+      double t = time_best(3U, func);
+      long long m = misses.count(func);
+      std::cout << num_threads << '\t' << (pass ? "fused" : "3") << '\t'
+                << std::fixed << std::setprecision(1) << t * 1e3 << '\t'
+                << std::setprecision(2) << mpix / t << '\t';
+      if (m >= 0)
+        std::cout << m << '\n';
+      else
+        std::cout << "n/a\n";
+    }
+    if (fused != gray) {
+      std::cerr << "Fused output differs.\n";
+      return 1;
+    }
+    if (threads[1] == 1U)
+      break;
+  }
+  return 0;
+}
+
+// Executor starting one thread per task, as the kernels did before they ran
+// on a shared pool
+class SpawnExecutor : public Executor {
+public:
+  void run(size_t count, const std::function<void(size_t)> &task) override {
+    std::vector<std::thread> workers;
+    for (size_t i = 1U; i < count; i++)
+      workers.emplace_back(task, i);
+    task(0U);
+    for (auto &w : workers)
+      w.join();
+  }
+  size_t concurrency() const override {
+    return std::max(1U, std::thread::hardware_concurrency());
+  }
+};
+
+// Shared thread pool vs a thread spawned per task, for sigma_filter and
+// rotate on a full frame and on a thumbnail, where starting threads costs
+// about as much as the work
+static int bench_executor(size_t width, size_t height, size_t num_threads) {
+  const size_t depth = 3U;
+  const float angle = 0.6f; // a quarter of the rows is mostly cleared
+  size_t sizes[][2] = { { width, height }, { 256U, 256U } };
+  SpawnExecutor spawn;
+
+  std::cout << "sigma_filter and rotate, " << num_threads << " threads\n";
+  std::cout << "size\top\texecutor\tms\tMP/s\n";
+  for (auto &size : sizes) {
+    size_t w = size[0], h = size[1];
+    std::vector<unsigned char> input = make_image(w, h, depth);
+    std::vector<unsigned char> reference(input.size()), output(input.size());
+    double mpix = static_cast<double>(w * h) / 1e6;
+
+    for (int op = 0; op < 2; op++) {
+      auto func = [&](unsigned char *out, size_t threads) {
+        if (op == 0)
+          sigma_filter(input.data(), out, w, h, depth, 50U, 2U, threads);
+        else
+          rotate(input.data(), out, w, h, depth, angle, 0U,
+                 Interpolation::bilinear, threads);
+      };
+      func(reference.data(), 1U);
+      for (int spawned = 0; spawned < 2; spawned++) {
+        set_executor(spawned ? &spawn : nullptr);
+        double t = time_best(5U, [&]() { func(output.data(), num_threads); });
+        set_executor(nullptr);
+        if (output != reference) {
+          std::cerr << "Output with " << num_threads
+                    << " threads differs from the serial one.\n";
+          return 1;
+        }
+        std::cout << w << 'x' << h << '\t' << (op ? "rotate" : "sigma")
+                  << '\t' << (spawned ? "spawn" : "pool") << '\t'
+                  << std::fixed << std::setprecision(2) << t * 1e3 << '\t'
+                  << mpix / t << '\n';
+      }
+    }
+  }
+  return 0;
+}
+
+// Scalar vs vectorized rotation kernels at a few angles
+static int bench_rotate_simd(const unsigned char *input, size_t width,
+                             size_t height, size_t depth) {
+  const float angles[] = { 0.5, 1., 1.5 };
+  const Simd levels[] = { Simd::none, Simd::sse41, Simd::avx2 };
+  std::vector<unsigned char> output(width * height * depth);
+  double mpix = static_cast<double>(width * height) / 1e6;
+
+  std::cout << "rotate " << width << 'x' << height << 'x' << depth << '\n';
+  std::cout << "angle\tsimd\trotate ms\tMP/s\trotate_fxp ms\tMP/s\n";
+  for (float angle : angles) {
+    for (Simd simd : levels) {
+      if (static_cast<int>(simd) > static_cast<int>(simd_supported()))
+        continue;
+      set_simd(simd);
+      double t_flt = time_best(5U, [&]() {
+        rotate(input, output.data(), width, height, depth, angle);
+      });
+      double t_fxp = time_best(5U, [&]() {
+        rotate_fxp(input, output.data(), width, height, depth, angle);
+      });
+      std::cout << std::fixed << std::setprecision(2) << angle << '\t'
+                << simd_name(simd) << '\t' << std::setprecision(1)
+                << t_flt * 1e3 << "\t\t" << std::setprecision(2)
+                << mpix / t_flt << '\t' << std::setprecision(1) << t_fxp * 1e3
+                << "\t\t" << std::setprecision(2) << mpix / t_fxp << '\n';
+    }
+  }
+  set_simd(simd_supported());
+  return 0;
+}
+
+// Direct-window sigma filter of 8-bit images at every SIMD level against the
+// row histogram, and what SigmaEngine::automatic picks
+static int bench_sigma_window_simd(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const unsigned sigmas[] = { 10U, 50U, 150U };
+  const Simd levels[] = { Simd::none, Simd::sse41, Simd::avx2 };
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> reference(input.size()), output(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+
+  std::cout << "sigma_filter " << width << 'x' << height << 'x' << depth
+            << " (MP/s)\n";
+  std::cout << "sigma\tkernel\trow";
+  for (Simd simd : levels)
+    std::cout << "\tdirect " << simd_name(simd);
+  std::cout << "\tautomatic\n";
+  for (unsigned sigma : sigmas) {
+    for (size_t kernel_size = 1U; kernel_size <= 7U; kernel_size++) {
+      auto run = [&](unsigned char *out, SigmaEngine engine) {
+        return time_best(3U, [&]() {
+          sigma_filter(input.data(), out, width, height, depth,
+                       static_cast<unsigned char>(sigma), kernel_size, 1U,
+                       engine);
+        });
+      };
+      double t_row = run(reference.data(), SigmaEngine::row_histogram);
+      std::cout << sigma << '\t' << kernel_size << '\t' << std::fixed
+                << std::setprecision(2) << mpix / t_row;
+      for (Simd simd : levels) {
+        if (static_cast<int>(simd) > static_cast<int>(simd_supported())) {
+          std::cout << "\t-";
+          continue;
+        }
+        set_simd(simd);
+        double t = run(output.data(), SigmaEngine::direct_window);
+        if (output != reference) {
+          std::cerr << "\nDirect window (" << simd_name(simd)
+                    << ") differs for kernel_size " << kernel_size << ".\n";
+          return 1;
+        }
+        std::cout << '\t' << mpix / t;
+      }
+      set_simd(simd_supported());
+      std::cout << '\t' << mpix / run(output.data(), SigmaEngine::automatic)
+                << '\n';
+    }
+  }
+  return 0;
+}
+
+// Sigma filter of a crop of a larger frame (e.g. a tile with its margin) with
+// the windows clipped to the crop, read from the frame around it
+// (BorderMode::padded) and extended by replication, single-threaded
+static int bench_sigma_borders(size_t width, size_t height) {
+  const size_t depth = 3U, padding = 8U;
+  const unsigned char sigma = 50U;
+  // Small tiles take a few ms in all
+  size_t reps = std::max<size_t>(5U, (1U << 22) / (width * height));
+  const SigmaEngine engines[] = { SigmaEngine::automatic,
+                                  SigmaEngine::direct_window,
+                                  SigmaEngine::row_histogram,
+                                  SigmaEngine::column_histogram };
+  const char *engine_names[] = { "auto", "direct", "row", "column" };
+  size_t frame_width = width + 2U * padding;
+  std::vector<unsigned char> frame =
+      make_image(frame_width, height + 2U * padding, depth);
+  ConstImageView input =
+      ConstImageView(frame.data(), frame_width, height + 2U * padding, depth)
+          .crop(padding, padding, width, height);
+  std::vector<unsigned char> output(width * height * depth);
+  ImageView out(output.data(), width, height, depth);
+
+  std::cout << "sigma_filter " << width << 'x' << height << 'x' << depth
+            << ", 1 thread (ms)\n";
+  std::cout << "engine\tkernel\tclip\tpadded\treplicate\n";
+  for (size_t e = 0U; e < sizeof(engines) / sizeof(engines[0]); e++) {
+    for (size_t kernel_size = 1U; kernel_size <= 5U; kernel_size++) {
+      auto run = [&](BorderMode mode) {
+        return 1e3 * time_best(reps, [&]() {
+                 sigma_filter(input, out, sigma, kernel_size, 1U, engines[e],
+                              AlphaMode::filter, Border(mode, 0U, padding));
+               });
+      };
+      std::cout << engine_names[e] << '\t' << kernel_size << '\t'
+                << std::fixed << std::setprecision(3)
+                << run(BorderMode::clip) << '\t' << run(BorderMode::padded)
+                << '\t' << run(BorderMode::replicate) << '\n';
+    }
+  }
+  return 0;
+}
+
+// Gray conversions: the double-precision scalar loop RawImage::toGray() used
+// to run against to_gray() at every SIMD level, and gray to RGB expansion
+static int bench_gray(size_t width, size_t height) {
+  const size_t depth = 3U;
+  size_t pixels = width * height;
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> gray(pixels), rgb(pixels * depth);
+  std::vector<float> input_flo(input.begin(), input.end());
+  std::vector<float> gray_flo(pixels), rgb_flo(pixels * depth);
+  double mpix = static_cast<double>(pixels) / 1e6;
+  auto report = [&](const std::string &name, double t) {
+    std::cout << std::left << std::setw(24) << name << std::right << '\t'
+              << std::fixed << std::setprecision(2) << t * 1e3 << '\t'
+              << std::setprecision(0) << mpix / t << '\n';
+  };
+
+  std::cout << "gray conversion " << width << 'x' << height << 'x' << depth
+            << '\n';
+  std::cout << "conversion\t\t\tms\tMP/s\n";
+  report("chr double loop", time_best(5U, [&]() {
+    const unsigned char *ptr = input.data();
+    for (size_t u = 0U; u < pixels; u++, ptr += depth)
+      gray[u] = static_cast<unsigned char>((ptr[2] * 0.3) + (ptr[1] * 0.59) +
+                                           (ptr[0] * 0.11));
+  }));
+  report("flo double loop", time_best(5U, [&]() {
+    const float *ptr = input_flo.data();
+    for (size_t u = 0U; u < pixels; u++, ptr += depth)
+      gray_flo[u] = (ptr[2] * 0.3) + (ptr[1] * 0.59) + (ptr[0] * 0.11);
+  }));
+  for (Simd simd : { Simd::none, Simd::sse41, Simd::avx2 }) {
+    if (static_cast<int>(simd) > static_cast<int>(simd_supported()))
+      break;
+    set_simd(simd);
+    std::string level = std::string(" (") + simd_name(simd) + ')';
+    report("to_gray chr" + level, time_best(5U, [&]() {
+      to_gray(input.data(), gray.data(), width, height, depth);
+    }));
+    report("to_gray flo" + level, time_best(5U, [&]() {
+      to_gray(input_flo.data(), gray_flo.data(), width, height, depth);
+    }));
+    report("gray_to_rgb chr" + level, time_best(5U, [&]() {
+      gray_to_rgb(gray.data(), rgb.data(), width, height);
+    }));
+    report("gray_to_rgb flo" + level, time_best(5U, [&]() {
+      gray_to_rgb(gray_flo.data(), rgb_flo.data(), width, height);
+    }));
+  }
+  set_simd(simd_supported());
+  return 0;
+}
+
+// sigma_filter() and rotate() of 8-bit, 16-bit and float pixels at every
+// SIMD level; the 8-bit sigma filter uses the (scalar) histogram engine, the
+// others the direct window
+static int bench_pixel_formats(size_t width, size_t height) {
+  const size_t depth = 3U;
+  const unsigned char sigma = 50U;
+  std::vector<unsigned char> input = make_image(width, height, depth);
+  std::vector<unsigned char> output(input.size());
+  std::vector<std::uint16_t> input_u16(input.size()), output_u16(input.size());
+  std::vector<float> input_flo(input.size()), output_flo(input.size());
+  double mpix = static_cast<double>(width * height) / 1e6;
+  auto report = [&](const std::string &name, double t) {
+    std::cout << std::left << std::setw(24) << name << std::right << '\t'
+              << std::fixed << std::setprecision(1) << t * 1e3 << '\t'
+              << std::setprecision(2) << mpix / t << '\n';
+  };
+
+  // Same pixels scaled to the value ranges of RawImage
+  for (size_t u = 0U; u < input.size(); u++) {
+    input_u16[u] = static_cast<std::uint16_t>(input[u] * 257U);
+    input_flo[u] = input[u] / 255.f;
+  }
+  std::cout << "pixel formats " << width << 'x' << height << 'x' << depth
+            << " sigma=" << static_cast<int>(sigma) << "/255\n";
+  std::cout << "kernel\t\t\t\tms\tMP/s\n";
+  for (Simd simd : { Simd::none, Simd::sse41, Simd::avx2 }) {
+    if (static_cast<int>(simd) > static_cast<int>(simd_supported()))
+      break;
+    set_simd(simd);
+    std::string level = std::string(" (") + simd_name(simd) + ')';
+    for (size_t kernel_size = 1U; kernel_size <= 2U; kernel_size++) {
+      std::string kernel = " k=" + std::to_string(kernel_size);
+      report("sigma chr" + kernel + level, time_best(3U, [&]() {
+        sigma_filter(input.data(), output.data(), width, height, depth, sigma,
+                     kernel_size);
+      }));
+      report("sigma u16" + kernel + level, time_best(3U, [&]() {
+        sigma_filter(input_u16.data(), output_u16.data(), width, height,
+                     depth, static_cast<std::uint16_t>(sigma * 257U),
+                     kernel_size);
+      }));
+      report("sigma flo" + kernel + level, time_best(3U, [&]() {
+        sigma_filter(input_flo.data(), output_flo.data(), width, height,
+                     depth, sigma / 255.f, kernel_size);
+      }));
+    }
+    report("rotate chr" + level, time_best(5U, [&]() {
+      rotate(input.data(), output.data(), width, height, depth, 0.5f);
+    }));
+    report("rotate u16" + level, time_best(5U, [&]() {
+      rotate(input_u16.data(), output_u16.data(), width, height, depth, 0.5f);
+    }));
+    report("rotate flo" + level, time_best(5U, [&]() {
+      rotate(input_flo.data(), output_flo.data(), width, height, depth, 0.5f);
+    }));
+  }
+  set_simd(simd_supported());
+  return 0;
+}
+
+// rotate(), rotate_fxp() and sigma_filter() of 1 to 4 channel images, and
+// RGBA processed directly against the alpha channel split off, the RGB
+// channels processed and the alpha channel merged back
+static int bench_channels(size_t width, size_t height) {
+  const unsigned char sigma = 50U;
+  size_t pixels = width * height;
+  std::vector<unsigned char> input = make_image(width, height, 4U);
+  std::vector<unsigned char> output(input.size()), rgb(pixels * 3U),
+      rgb_out(pixels * 3U);
+  double mpix = static_cast<double>(pixels) / 1e6;
+  auto report = [&](const std::string &name, double t) {
+    std::cout << std::left << std::setw(24) << name << std::right << '\t'
+              << std::fixed << std::setprecision(1) << t * 1e3 << '\t'
+              << std::setprecision(2) << mpix / t << '\n';
+  };
+
+  std::cout << "channels " << width << 'x' << height
+            << " sigma=" << static_cast<int>(sigma) << '\n';
+  std::cout << "kernel\t\t\t\tms\tMP/s\n";
+  for (size_t depth = 1U; depth <= 4U; depth++) {
+    std::string channels = " depth " + std::to_string(depth);
+    report("rotate" + channels, time_best(5U, [&]() {
+      rotate(input.data(), output.data(), width, height, depth, 0.5f);
+    }));
+    report("rotate_fxp" + channels, time_best(5U, [&]() {
+      rotate_fxp(input.data(), output.data(), width, height, depth, 0.5f);
+    }));
+    report("sigma" + channels, time_best(3U, [&]() {
+      sigma_filter(input.data(), output.data(), width, height, depth, sigma);
+    }));
+  }
+  report("sigma rgba pass alpha", time_best(3U, [&]() {
+    sigma_filter(input.data(), output.data(), width, height, 4U, sigma, 1U,
+                 1U, SigmaEngine::row_histogram, AlphaMode::pass_through);
+  }));
+  report("sigma rgba split/merge", time_best(3U, [&]() {
+    for (size_t u = 0U; u < pixels; u++)
+      memcpy(&rgb[u * 3U], &input[u * 4U], 3U);
+    sigma_filter(rgb.data(), rgb_out.data(), width, height, 3U, sigma);
+    for (size_t u = 0U; u < pixels; u++) {
+      memcpy(&output[u * 4U], &rgb_out[u * 3U], 3U);
+      output[u * 4U + 3U] = input[u * 4U + 3U];
+    }
+  }));
+  return 0;
+}
+
+// Benchmark suite: sweeps of sigma_filter(), rotate() and rotate_fxp() over
+// image size, depth and the parameters of each kernel on synthetic images,
+// single-threaded at the best SIMD level. Every case gets a warmup run, then
+// repetitions for about `budget` seconds (3 to 50 of them). Results can be
+// written as JSON, one case per line, and compared against such a file from
+// an earlier run.
+struct SuiteCase {
+  std::string id;     // kernel and parameters, unique within the suite
+  std::string params; // the parameters as JSON members
+  size_t pixels;
+  size_t reps;
+  double best;   // seconds per run
+  double median; // seconds per run
+};
+
+struct SuiteOptions {
+  bool quick{ false }; // one small image size and fewer parameters
+  double budget{ 0.5 };
+  std::string match; // only cases whose id contains this
+  std::string json;
+  std::string baseline;
+  double threshold{ 10. }; // percent slower than the baseline to flag
+};
+
+static double ns_per_pixel(double seconds, size_t pixels) {
+  return seconds * 1e9 / static_cast<double>(pixels);
+}
+
+template <typename Func>
+static void time_case(SuiteCase &c, double budget, Func func) {
+  std::vector<double> times;
+  double warmup = time_best(1U, func);
+
+  c.reps = static_cast<size_t>(budget / std::max(warmup, 1e-6));
+  c.reps = std::max<size_t>(3U, std::min<size_t>(50U, c.reps));
+  for (size_t r = 0U; r < c.reps; r++)
+    times.push_back(time_best(1U, func));
+  std::sort(times.begin(), times.end());
+  c.best = times.front();
+  c.median = times[times.size() / 2U];
+}
+
+static bool write_suite_json(const std::string &file,
+                             const std::vector<SuiteCase> &cases) {
+  std::ofstream out(file);
+
+  out << "{\n  \"simd\": \"" << simd_name(get_simd()) << "\",\n"
+      << "  \"cases\": [\n";
+  for (size_t i = 0U; i < cases.size(); i++) {
+    const SuiteCase &c = cases[i];
+    out << "    { \"id\": \"" << c.id << "\", " << c.params
+        << ", \"reps\": " << c.reps << std::fixed << std::setprecision(3)
+        << ", \"ns_per_pixel\": " << ns_per_pixel(c.best, c.pixels)
+        << ", \"ns_per_pixel_median\": " << ns_per_pixel(c.median, c.pixels)
+        << ", \"mp_per_s\": " << c.pixels / c.best / 1e6 << " }"
+        << (i + 1U < cases.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+  return static_cast<bool>(out);
+}
+
+// ns_per_pixel of every case of a file written by write_suite_json(), which
+// has one case per line (this is not a general JSON parser)
+static bool read_suite_json(const std::string &file,
+                            std::map<std::string, double> &ns) {
+  std::ifstream in(file);
+  std::string line;
+  const std::string id_key("\"id\": \""), ns_key("\"ns_per_pixel\": ");
+
+  if (!in)
+    return false;
+  while (std::getline(in, line)) {
+    size_t id = line.find(id_key), value = line.find(ns_key);
+    if (id == std::string::npos || value == std::string::npos)
+      continue;
+    id += id_key.size();
+    ns[line.substr(id, line.find('"', id) - id)] =
+        strtod(line.c_str() + value + ns_key.size(), nullptr);
+  }
+  return true;
+}
+
+// Returns the number of cases more than threshold percent slower than in the
+// baseline
+static size_t compare_suite(const std::vector<SuiteCase> &cases,
+                            const std::map<std::string, double> &baseline,
+                            double threshold) {
+  size_t regressions = 0U, faster = 0U, missing = 0U;
+
+  std::cout << "\ncompared with the baseline (threshold " << std::fixed
+            << std::setprecision(1) << threshold
+            << "%)\nchange\tns/pixel\tbaseline\tcase\n";
+  for (const SuiteCase &c : cases) {
+    auto base = baseline.find(c.id);
+    if (base == baseline.end()) {
+      missing++;
+      continue;
+    }
+    double ns = ns_per_pixel(c.best, c.pixels);
+    double change = (ns / base->second - 1.) * 100.;
+    const char *flag = "";
+    if (change > threshold) {
+      regressions++;
+      flag = "\tREGRESSION";
+    } else if (change < -threshold) {
+      faster++;
+    }
+    std::cout << std::showpos << std::fixed << std::setprecision(1) << change
+              << '%' << std::noshowpos << '\t' << std::setprecision(3) << ns
+              << "\t\t" << base->second << "\t\t" << c.id << flag << '\n';
+  }
+  std::cout << regressions << " regressions, " << faster << " faster, "
+            << missing << " cases not in the baseline\n";
+  return regressions;
+}
+
+static int bench_suite(const SuiteOptions &options) {
+  const std::vector<std::pair<size_t, size_t> > sizes =
+      options.quick ? std::vector<std::pair<size_t, size_t> >{ { 640U, 480U } }
+                    : std::vector<std::pair<size_t, size_t> >{
+                          { 640U, 480U }, { 1920U, 1080U }, { 3840U, 2160U }
+                      };
+  const std::vector<int> sigmas =
+      options.quick ? std::vector<int>{ 50 } : std::vector<int>{ 20, 100 };
+  const std::vector<size_t> kernel_sizes =
+      options.quick ? std::vector<size_t>{ 1U, 3U }
+                    : std::vector<size_t>{ 1U, 3U, 7U };
+  const std::vector<float> angles =
+      options.quick ? std::vector<float>{ 0.5f }
+                    : std::vector<float>{ 0.5f, 2.f };
+  const size_t depths[] = { 1U, 3U, 4U };
+  const Interpolation interps[] = { Interpolation::bilinear,
+                                     Interpolation::bicubic,
+                                     Interpolation::lanczos3 };
+  std::vector<SuiteCase> cases;
+  std::map<std::string, double> baseline;
+
+  if (!options.baseline.empty() &&
+      !read_suite_json(options.baseline, baseline))
+    std::cout << "No baseline " << options.baseline
+              << ", nothing to compare with.\n";
+
+  std::cout << "suite (" << simd_name(get_simd()) << ")\n"
+            << "ns/pixel\tmedian\t\tMP/s\treps\tcase\n";
+  auto run = [&](const std::string &id, const std::string &params,
+                 size_t pixels, const std::function<void()> &func) {
+    if (id.find(options.match) == std::string::npos)
+      return;
+    SuiteCase c{ id, params, pixels, 0U, 0., 0. };
+    time_case(c, options.budget, func);
+    std::cout << std::fixed << std::setprecision(3)
+              << ns_per_pixel(c.best, pixels) << "\t\t"
+              << ns_per_pixel(c.median, pixels) << "\t\t"
+              << std::setprecision(2) << pixels / c.best / 1e6 << '\t'
+              << c.reps << '\t' << id << std::endl;
+    cases.push_back(c);
+  };
+
+  for (const auto &size : sizes) {
+    size_t width = size.first, height = size.second;
+    for (size_t depth : depths) {
+      std::vector<unsigned char> input = make_image(width, height, depth);
+      std::vector<unsigned char> output(input.size());
+      std::string image = std::to_string(width) + 'x' +
+                          std::to_string(height) + 'x' +
+                          std::to_string(depth);
+      std::string image_params =
+          "\"width\": " + std::to_string(width) + ", \"height\": " +
+          std::to_string(height) + ", \"depth\": " + std::to_string(depth);
+
+      for (int sigma : sigmas) {
+        for (size_t kernel_size : kernel_sizes) {
+          for (SigmaEngine engine :
+               { SigmaEngine::row_histogram, SigmaEngine::column_histogram,
+                 SigmaEngine::direct_window }) {
+            const char *name = engine == SigmaEngine::row_histogram
+                                   ? "row_histogram"
+                                   : engine == SigmaEngine::column_histogram
+                                         ? "column_histogram"
+                                         : "direct_window";
+            run(std::string("sigma_filter/") + name + ' ' + image +
+                    " sigma=" + std::to_string(sigma) +
+                    " k=" + std::to_string(kernel_size),
+                "\"kernel\": \"sigma_filter\", \"engine\": \"" +
+                    std::string(name) + "\", " + image_params +
+                    ", \"sigma\": " + std::to_string(sigma) +
+                    ", \"kernel_size\": " + std::to_string(kernel_size),
+                width * height, [&]() {
+                  sigma_filter(input.data(), output.data(), width, height,
+                               depth, static_cast<unsigned char>(sigma),
+                               kernel_size, 1U, engine);
+                });
+          }
+        }
+      }
+      for (float angle : angles) {
+        std::ostringstream a;
+        a << angle;
+        for (Interpolation interp : interps) {
+          for (bool fxp : { false, true }) {
+            // Bilinear cases keep the ids they had before the other modes
+            std::string name = fxp ? "rotate_fxp" : "rotate";
+            if (interp != Interpolation::bilinear)
+              name += std::string("/") + interp_name(interp);
+            run(name + ' ' + image + " angle=" + a.str(),
+                "\"kernel\": \"" + std::string(fxp ? "rotate_fxp" : "rotate") +
+                    "\", \"interpolation\": \"" + interp_name(interp) +
+                    "\", " + image_params + ", \"angle\": " + a.str(),
+                width * height, [&]() {
+                  if (fxp)
+                    rotate_fxp(input.data(), output.data(), width, height,
+                               depth, angle, 0U, interp);
+                  else
+                    rotate(input.data(), output.data(), width, height, depth,
+                           angle, 0U, interp);
+                });
+          }
+        }
+      }
+    }
+  }
+
+  if (!options.json.empty()) {
+    if (!write_suite_json(options.json, cases)) {
+      std::cerr << "Cannot write " << options.json << ".\n";
+      return 1;
+    }
+    std::cout << "Results written to " << options.json << ".\n";
+  }
+  if (!baseline.empty() &&
+      compare_suite(cases, baseline, options.threshold) > 0U)
+    return 1;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " sigma_threads [width height [max_threads]]\n"
+              << "       " << argv[0] << " sigma_engines [width height]\n"
+              << "       " << argv[0] << " sigma_sweep [width height]\n"
+              << "       " << argv[0] << " sigma_crossover [width height]\n"
+              << "       " << argv[0] << " sigma_window_simd [width height]\n"
+              << "       " << argv[0] << " sigma_borders [width height]\n"
+              << "       " << argv[0]
+              << " rotate_simd [width height | image_file]\n"
+              << "       " << argv[0] << " rotate_tiles [width height]\n"
+              << "       " << argv[0] << " orientation [width height]\n"
+              << "       " << argv[0] << " planar [width height]\n"
+              << "       " << argv[0] << " gray [width height]\n"
+              << "       " << argv[0] << " pixel_formats [width height]\n"
+              << "       " << argv[0] << " channels [width height]\n"
+              << "       " << argv[0] << " resample [width height]\n"
+              << "       " << argv[0] << " fused [width height]\n"
+              << "       " << argv[0]
+              << " executor [width height [threads]]\n"
+              << "       " << argv[0] << " rawimage_alloc [width height]\n"
+              << "       " << argv[0] << " raw_frame [width height]\n"
+              << "       " << argv[0]
+              << " suite [-quick] [-budget seconds] [-match text]\n"
+              << "             [-json results.json] [-baseline base.json]"
+                 " [-threshold percent]\n";
+    return 1;
+  }
+
+  std::string name(argv[1]);
+
+  if (name == "suite") {
+    SuiteOptions options;
+    for (int i = 2; i < argc; i++) {
+      std::string arg(argv[i]);
+      if (arg == "-quick") {
+        options.quick = true;
+        continue;
+      }
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value of " << arg << ".\n";
+        return 1;
+      }
+      const char *value = argv[++i];
+      if (arg == "-budget")
+        options.budget = strtod(value, nullptr);
+      else if (arg == "-match")
+        options.match = value;
+      else if (arg == "-json")
+        options.json = value;
+      else if (arg == "-baseline")
+        options.baseline = value;
+      else if (arg == "-threshold")
+        options.threshold = strtod(value, nullptr);
+      else {
+        std::cerr << "Unknown suite option " << arg << ".\n";
+        return 1;
+      }
+    }
+    return bench_suite(options);
+  }
+
+  size_t width = (argc > 3) ? strtoul(argv[2], nullptr, 10) : 5472U;
+  size_t height = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 3648U;
+
+  if (name == "sigma_threads") {
+    size_t max_threads = (argc > 4) ? strtoul(argv[4], nullptr, 10)
+                                    : std::thread::hardware_concurrency();
+    return bench_sigma_threads(width, height,
+                               std::max<size_t>(1U, max_threads));
+  }
+
+  if (name == "sigma_engines")
+    return bench_sigma_engines(width, height);
+
+  if (name == "sigma_sweep")
+    return bench_sigma_sweep(width, height);
+
+  if (name == "sigma_crossover")
+    return bench_sigma_crossover(width, height);
+
+  if (name == "sigma_window_simd")
+    return bench_sigma_window_simd(width, height);
+
+  if (name == "sigma_borders") {
+    if (argc <= 3) // a tile by default
+      width = height = 256U;
+    return bench_sigma_borders(width, height);
+  }
+
+  if (name == "rotate_simd") {
+    if (argc == 3) { // real image, e.g. test/images/Lenaclor.ppm
+      using RawIm = rawimage::RawImage;
+      RawIm img{ RawIm::ByteOrder::rgb, RawIm::PixFormat::chr };
+      rawimage::init(argc, argv);
+      img.read(argv[2]);
+      return bench_rotate_simd(img.raw.chr, img.getW(), img.getH(),
+                               img.getDepth());
+    }
+    std::vector<unsigned char> input = make_image(width, height, 3U);
+    return bench_rotate_simd(input.data(), width, height, 3U);
+  }
+
+  if (name == "rotate_tiles") {
+    if (argc <= 3) // 8K x 8K by default
+      width = height = 8192U;
+    return bench_rotate_tiles(width, height);
+  }
+
+  if (name == "orientation")
+    return bench_orientation(width, height);
+
+  if (name == "planar")
+    return bench_planar(width, height);
+
+  if (name == "gray")
+    return bench_gray(width, height);
+
+  if (name == "pixel_formats")
+    return bench_pixel_formats(width, height);
+
+  if (name == "channels")
+    return bench_channels(width, height);
+
+  if (name == "resample")
+    return bench_resample(width, height);
+
+  if (name == "fused")
+    return bench_fused(width, height);
+
+  if (name == "executor") {
+    size_t num_threads = (argc > 4) ? strtoul(argv[4], nullptr, 10)
+                                    : std::thread::hardware_concurrency();
+    return bench_executor(width, height, std::max<size_t>(1U, num_threads));
+  }
+
+  if (name == "rawimage_alloc")
+    return bench_rawimage_alloc(width, height);
+
+  if (name == "raw_frame") {
+    rawimage::init(argc, argv);
+    return bench_raw_frame(width, height);
+  }
+
+  std::cerr << "Unknown benchmark " << name << ".\n";
+  return 1;
+}
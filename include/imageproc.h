@@ -5,22 +5,514 @@
 #include <cstddef>  // size_t
 #include <cassert>  // assert
 #include <iostream> // std::cerr
+#include <functional>
+#include <memory> // std::unique_ptr
+#include <vector>
 
 #define LOC(row, col, ld, depth, d) (((row) * (ld) + (col)) * (depth) + (d))
 
 namespace imageproc {
 
+// Non-owning view of an image (or of a region of one) with interleaved
+// channels: channel d of pixel (row, col) is
+// data[row * stride + col * channels + d]. Crops, padded buffers and frames
+// owned by someone else (e.g. a decoder) are processed in place through views.
+template <typename Pixel> struct BasicImageView {
+  Pixel *data;
+  size_t width;
+  size_t height;
+  size_t stride; // bytes between the starts of consecutive rows
+  size_t channels;
+
+  BasicImageView(Pixel *data, size_t width, size_t height, size_t channels,
+                 size_t stride = 0) // 0 == width * channels (contiguous rows)
+      : data(data), width(width), height(height),
+        stride(stride ? stride : width * channels), channels(channels) {}
+
+  // Read-only view of a writable image
+  template <typename Other>
+  BasicImageView(const BasicImageView<Other> &view)
+      : data(view.data), width(view.width), height(view.height),
+        stride(view.stride), channels(view.channels) {}
+
+  // crop_width x crop_height region starting at pixel (row, col), no copy
+  BasicImageView crop(size_t row, size_t col, size_t crop_width,
+                      size_t crop_height) const {
+    assert(row + crop_height <= height && col + crop_width <= width);
+    return BasicImageView(data + row * stride + col * channels, crop_width,
+                          crop_height, channels, stride);
+  }
+};
+
+using ImageView = BasicImageView<unsigned char>;
+using ConstImageView = BasicImageView<const unsigned char>;
+
+// Histogram maintenance strategy of sigma_filter (the output is the same)
+enum class SigmaEngine {
+  automatic,       // direct_window for kernel_size up to 7 when the CPU has
+                   // SSE4.1 or AVX2 (see get_simd()), row_histogram
+                   // otherwise
+  row_histogram,   // window histogram slid along each row, cost grows with
+                   // kernel_size
+  column_histogram, // per-column histograms slid down the image, cost
+                    // independent of kernel_size (better for large kernels)
+  direct_window     // no histogram, every window pixel is compared with the
+                    // center one: (2*kernel_size + 1)^2 comparisons per
+                    // value, cheapest for the smallest kernels, vectorized
+                    // for 8-bit images up to kernel_size 7 (see the
+                    // sigma_crossover and sigma_window_simd benchmarks)
+};
+
+// Alpha channel of 2- (grayscale + alpha) and 4-channel (rgba) images, the
+// last one, in sigma_filter
+enum class AlphaMode {
+  filter,      // filtered like the other channels
+  pass_through // copied from input to output as it is (and not histogrammed)
+};
+
+// Pixels outside of the input image as seen by the sigma filter and the
+// rotations of views (for an input row abcd)
+enum class BorderMode {
+  clip,      // none: sigma_filter shrinks its window at the edges and the
+             // rotations set the destination pixels whose interpolation
+             // support is not entirely inside of the input to Border::value
+  constant,  // all equal to Border::value: vvv|abcd|vvv
+  replicate, // the nearest edge pixel: aaa|abcd|ddd
+  reflect,   // mirrored about the edge pixel: dcb|abcd|cba
+  wrap,      // from the other side of the image: bcd|abcd|abc
+  padded     // read from the input buffer around the view, which the caller
+             // guarantees to hold Border::padding valid pixels on every side
+             // (e.g. a region of interest of a larger image); there are no
+             // border cases left for the kernels
+};
+
+struct Border {
+  BorderMode mode;
+  unsigned char value; // of constant, and of the rotated pixels whose support
+                       // is not inside of the input with clip (0 by default)
+                       // or of the padded input with padded
+  size_t padding;      // padded: at least kernel_size for sigma_filter
+
+  Border(BorderMode mode = BorderMode::clip, unsigned char value = 0,
+         size_t padding = 0)
+      : mode(mode), value(value), padding(padding) {}
+};
+
+// Runs the tasks of the multithreaded kernels (the ones taking num_threads).
+// run() calls task(i) for every i in [0, count) and returns once all of them
+// are done; they may run concurrently, on the calling thread too, and may
+// call run() themselves. Tasks do not throw.
+class Executor {
+public:
+  virtual ~Executor() = default;
+  virtual void run(size_t count, const std::function<void(size_t)> &task) = 0;
+  // Threads the tasks can run on, the calling one included; num_threads == 0
+  // means this many
+  virtual size_t concurrency() const = 0;
+};
+
+// Work-stealing pool: every worker thread owns a deque of tasks, runs its own
+// tasks newest first and, when it has none left, steals the oldest ones of
+// the other workers. Tasks submitted from a worker (nested kernels) go to its
+// own deque, the others are spread over all of them, and the thread calling
+// run() works on queued tasks until its own are done.
+class ThreadPool : public Executor {
+public:
+  // num_threads == 0: one per hardware thread. The calling thread counts as
+  // one, so num_threads - 1 workers are started. With pin_threads worker i
+  // is bound to CPU i + 1 (modulo the CPU count, Linux only).
+  explicit ThreadPool(size_t num_threads = 0, bool pin_threads = false);
+  ~ThreadPool() override;
+
+  void run(size_t count, const std::function<void(size_t)> &task) override;
+  size_t concurrency() const override;
+
+  class Impl;
+
+private:
+  std::unique_ptr<Impl> impl;
+};
+
+// Executor of all the kernels, shared by all the threads calling them so that
+// concurrent calls do not oversubscribe the CPU. By default it is a
+// ThreadPool of one thread per hardware thread, created on first use.
+Executor &get_executor();
+// Makes the kernels use `executor` (nullptr == back to the library's pool),
+// e.g. one shared with the rest of an application; it must outlive its use
+void set_executor(Executor *executor);
+// Replaces the library's pool by a ThreadPool(num_threads, pin_threads), e.g.
+// to cap the share of the machine taken by imageproc. Not while kernels are
+// running on it.
+void configure_thread_pool(size_t num_threads, bool pin_threads = false);
+
+// Depth 1 to 4
 void
 sigma_filter(const unsigned char *input, unsigned char *output, size_t width,
              size_t height, size_t depth, unsigned char sigma,
-             size_t kernel_size = 1 // kernel width == height == 2*kern_size + 1
-             );
+             size_t kernel_size = 1, // kernel width == height == 2*kern_size+1
+             size_t num_threads = 1, // bands run on get_executor(), 0 ==
+                                     // one per executor thread
+             SigmaEngine engine = SigmaEngine::automatic,
+             AlphaMode alpha = AlphaMode::filter);
+
+// Same on views, output must have the size and channels of input and must not
+// overlap it. With a border mode other than clip every window is complete:
+// with padded the engines read the pixels around the view from its buffer
+// and skip all border tests, the other modes extend the input rows by
+// kernel_size pixels on each side and stream them through the engine, whose
+// border cases are then all outside of the output.
+void sigma_filter(ConstImageView input, ImageView output, unsigned char sigma,
+                  size_t kernel_size = 1, size_t num_threads = 1,
+                  SigmaEngine engine = SigmaEngine::automatic,
+                  AlphaMode alpha = AlphaMode::filter,
+                  const Border &border = Border());
+
+// sigma_filter() of 16-bit and float images of any depth (contiguous rows,
+// output must not overlap input). Without a histogram of the value range
+// every window pixel is compared with the center pixel, so the cost grows
+// with kernel_size^2. The mean is rounded to nearest for 16-bit pixels.
+void sigma_filter(const std::uint16_t *input, std::uint16_t *output,
+                  size_t width, size_t height, size_t depth,
+                  std::uint16_t sigma, size_t kernel_size = 1,
+                  size_t num_threads = 1,
+                  AlphaMode alpha = AlphaMode::filter);
+void sigma_filter(const float *input, float *output, size_t width,
+                  size_t height, size_t depth, float sigma,
+                  size_t kernel_size = 1, size_t num_threads = 1,
+                  AlphaMode alpha = AlphaMode::filter);
+
+// sigma_filter over an image fed in strips of rows, e.g. while it is decoded
+// or read from disk: only the last 2*kernel_size + 2 input rows are kept, and
+// each output row is handed to `sink` as soon as the input rows it depends on
+// have been pushed. The output is the same as sigma_filter() on the whole
+// image.
+class SigmaFilterStream {
+public:
+  // Receives output row `row` (width * depth bytes, valid during the call
+  // only); rows come in order
+  using RowSink = std::function<void(size_t row, const unsigned char *data)>;
+
+  SigmaFilterStream(size_t width, size_t height, size_t depth,
+                    unsigned char sigma, RowSink sink, size_t kernel_size = 1,
+                    SigmaEngine engine = SigmaEngine::automatic,
+                    AlphaMode alpha = AlphaMode::filter);
+  ~SigmaFilterStream();
+
+  // Appends the next num_rows input rows, starting `stride` bytes apart (0 ==
+  // width * depth); rows past the image height are ignored
+  void push(const unsigned char *rows, size_t num_rows, size_t stride = 0);
+  // Same with a strip of the width and channels of the image
+  void push(ConstImageView strip);
+
+  size_t rows_in() const;  // Input rows pushed so far
+  size_t rows_out() const; // Output rows sent to the sink so far
 
+  class Impl;
+
+private:
+  size_t depth;
+  std::unique_ptr<Impl> impl;
+};
+
+// Instruction set extensions used by the vectorized kernels
+enum class Simd {
+  none,  // scalar code only
+  sse41, // SSE4.1
+  avx2   // AVX2
+};
+
+// Best extension supported by the CPU
+Simd simd_supported();
+// Limits the extensions the kernels may use (for testing and benchmarking),
+// anything above simd_supported() is clamped to it
+void set_simd(Simd simd);
+// Extension currently used by the kernels, simd_supported() by default
+Simd get_simd();
+
+// Interpolation of the rotations. The higher-order filters are separable,
+// with their weights tabulated for 1/256 pixel steps of the source position,
+// and have scalar kernels only. They cover the same destination pixels as
+// bilinear interpolation: near the input border, source pixels outside of the
+// image are replaced by the nearest edge pixels. Integer results are rounded
+// and clamped (the filters overshoot at edges).
+enum class Interpolation {
+  bilinear, // 2x2 source pixels, vectorized
+  bicubic,  // 4x4 source pixels, Catmull-Rom cubic
+  lanczos3  // 6x6 source pixels, Lanczos with 3 lobes
+};
+
+// Rotation by `angle` (radians) around the image center with bilinear
+// interpolation by default; destination pixels whose source falls outside of
+// the input image are set to 0. Multiples of pi/2 are exact pixel copies (the
+// output keeps the input size, use reorient() to get swapped dimensions).
+// Depth 1 to 4; alpha moves with the pixels, so it is interpolated like the
+// other channels.
 void rotate(const unsigned char *input, unsigned char *output, size_t width,
-            size_t height, size_t depth, float angle);
+            size_t height, size_t depth, float angle,
+            size_t tile_size = 0, // 0 == row by row, otherwise the output is
+                                  // processed in tile_size^2 tiles (cache
+                                  // friendlier for large images)
+            Interpolation interp = Interpolation::bilinear,
+            size_t num_threads = 1); // 0 == all the executor threads; they
+                                     // take chunks of rows (of tiles) in
+                                     // turn, as rows outside of the rotated
+                                     // image cost less
 
+// Same as rotate() with fixed-point arithmetic
 void rotate_fxp(const unsigned char *input, unsigned char *output, size_t width,
-                size_t height, size_t depth, float angle);
+                size_t height, size_t depth, float angle,
+                size_t tile_size = 0,
+                Interpolation interp = Interpolation::bilinear,
+                size_t num_threads = 1);
+
+// Rotation of an in_width x in_height input into an out_width x out_height
+// output, e.g. a canvas large enough for the rotated corners (see
+// rotated_size()); the input center is mapped to the output center. Strides
+// are the distances between the starts of consecutive rows in bytes, 0 ==
+// width * depth (contiguous rows).
+void rotate(const unsigned char *input, size_t in_width, size_t in_height,
+            size_t in_stride, unsigned char *output, size_t out_width,
+            size_t out_height, size_t out_stride, size_t depth, float angle,
+            size_t tile_size = 0,
+            Interpolation interp = Interpolation::bilinear,
+            size_t num_threads = 1);
+
+void rotate_fxp(const unsigned char *input, size_t in_width, size_t in_height,
+                size_t in_stride, unsigned char *output, size_t out_width,
+                size_t out_height, size_t out_stride, size_t depth,
+                float angle, size_t tile_size = 0,
+                Interpolation interp = Interpolation::bilinear,
+                size_t num_threads = 1);
+
+// Same on views (of any sizes, with the same number of channels). Every
+// destination pixel is written whatever the border mode: with constant,
+// replicate, reflect and wrap the pixels whose support crosses the input
+// border (the last source row and column included) are interpolated from the
+// border pixels by a scalar kernel, the others by the usual ones; padded
+// rotates the view enlarged by the padding.
+void rotate(ConstImageView input, ImageView output, float angle,
+            size_t tile_size = 0,
+            Interpolation interp = Interpolation::bilinear,
+            size_t num_threads = 1, const Border &border = Border());
+
+void rotate_fxp(ConstImageView input, ImageView output, float angle,
+                size_t tile_size = 0,
+                Interpolation interp = Interpolation::bilinear,
+                size_t num_threads = 1, const Border &border = Border());
+
+// rotate() of 16-bit (truncated like 8-bit pixels) and float images
+// (interpolated values stored as they are)
+void rotate(const std::uint16_t *input, std::uint16_t *output, size_t width,
+            size_t height, size_t depth, float angle, size_t tile_size = 0,
+            Interpolation interp = Interpolation::bilinear,
+            size_t num_threads = 1);
+void rotate(const float *input, float *output, size_t width, size_t height,
+            size_t depth, float angle, size_t tile_size = 0,
+            Interpolation interp = Interpolation::bilinear,
+            size_t num_threads = 1);
+
+// Smallest output dimensions for which the rotation by `angle` of a width x
+// height input is not clipped (the expanded bounding box). Centers are whole
+// pixels, so for even sizes the box can be 1 pixel larger than the rotated
+// extent.
+void rotated_size(size_t width, size_t height, float angle, size_t &out_width,
+                  size_t &out_height);
+
+// Lossless orientation transforms, numbered after the EXIF Orientation tag:
+// applying Orientation(tag) to an image stored with that tag value gives the
+// upright image
+enum class Orientation {
+  identity = 1,
+  flip_horizontal = 2, // mirror left <-> right
+  rotate_180 = 3,
+  flip_vertical = 4,   // mirror top <-> bottom
+  transpose = 5,       // mirror along the main diagonal
+  rotate_90 = 6,       // clockwise
+  transverse = 7,      // mirror along the anti-diagonal
+  rotate_270 = 8       // clockwise (i.e. 90 counterclockwise)
+};
+
+// Writes the `orientation` transform of the width x height input to output,
+// which is height x width for transpose, rotate_90, transverse and rotate_270
+// and width x height otherwise
+void reorient(const unsigned char *input, unsigned char *output, size_t width,
+              size_t height, size_t depth, Orientation orientation);
+
+// Same on views, output must have the (swapped when transposing) size and the
+// channels of input
+void reorient(ConstImageView input, ImageView output, Orientation orientation);
+
+// Planar layout: the depth channels are stored as consecutive width x height
+// planes, channel d of pixel (row, col) is input[(d * height + row) * width +
+// col]. Kernels then work on each channel as a contiguous single-channel
+// image.
+
+// Interleaved input to planar output. The layout and color conversions run
+// on up to num_threads executor threads (0 == all of them), in chunks of
+// rows.
+void deinterleave(const unsigned char *input, unsigned char *output,
+                  size_t width, size_t height, size_t depth,
+                  size_t num_threads = 1);
+// Planar input to interleaved output
+void interleave(const unsigned char *input, unsigned char *output,
+                size_t width, size_t height, size_t depth,
+                size_t num_threads = 1);
+
+// Same on views, with one single-channel plane per channel of the interleaved
+// image (planes[0 .. channels - 1], of its size)
+void deinterleave(ConstImageView input, const ImageView planes[],
+                  size_t num_threads = 1);
+void interleave(const ConstImageView planes[], ImageView output,
+                size_t num_threads = 1);
+
+// sigma_filter(), rotate() and rotate_fxp() of planar images, one plane at a
+// time; same output as the interleaved versions, for any depth
+void sigma_filter_planar(const unsigned char *input, unsigned char *output,
+                         size_t width, size_t height, size_t depth,
+                         unsigned char sigma, size_t kernel_size = 1,
+                         size_t num_threads = 1,
+                         SigmaEngine engine = SigmaEngine::automatic,
+                         AlphaMode alpha = AlphaMode::filter);
+
+void rotate_planar(const unsigned char *input, unsigned char *output,
+                   size_t width, size_t height, size_t depth, float angle,
+                   size_t tile_size = 0,
+                   Interpolation interp = Interpolation::bilinear,
+                   size_t num_threads = 1);
+
+void rotate_fxp_planar(const unsigned char *input, unsigned char *output,
+                       size_t width, size_t height, size_t depth, float angle,
+                       size_t tile_size = 0,
+                       Interpolation interp = Interpolation::bilinear,
+                       size_t num_threads = 1);
+
+// Gray conversion of an interleaved image of depth >= 3 (further channels are
+// ignored): 0.11 * c0 + 0.59 * c1 + 0.3 * c2 for channels c0, c1 and c2 of
+// every pixel, truncated for 8-bit pixels. output may be input (in place),
+// which runs on the calling thread only: rows converted in parallel would
+// overwrite pixels of the rows before them that are still to be read.
+void to_gray(const unsigned char *input, unsigned char *output, size_t width,
+             size_t height, size_t depth, size_t num_threads = 1);
+void to_gray(const float *input, float *output, size_t width, size_t height,
+             size_t depth, size_t num_threads = 1);
+
+// Same for planar images (the first 3 planes)
+void to_gray_planar(const unsigned char *input, unsigned char *output,
+                    size_t width, size_t height);
+void to_gray_planar(const float *input, float *output, size_t width,
+                    size_t height);
+
+// Gray image to 3 equal channels
+void gray_to_rgb(const unsigned char *input, unsigned char *output,
+                 size_t width, size_t height, size_t num_threads = 1);
+void gray_to_rgb(const float *input, float *output, size_t width,
+                 size_t height, size_t num_threads = 1);
+
+// Sequence of operations on 8-bit interleaved images run in a single pass,
+// e.g. deskew, denoise and gray conversion:
+//   FusedChain().rotate_fxp(angle).sigma_filter(sigma, 2).to_gray()
+//       .run(input, output);
+// Instead of writing every intermediate image in full, the image is processed
+// in horizontal bands: each operation hands its rows to the next one as they
+// are produced, through buffers of a few rows (the window rows of the sigma
+// filters), so the intermediates stay in cache. A rotation reads its whole
+// input, so one that follows other operations gets its input image
+// materialized first. The output is the same as that of the operations run
+// one after the other on whole images.
+class FusedChain {
+public:
+  // rotate() (rotate_fxp()) to an image of the same size
+  FusedChain &rotate(float angle,
+                     Interpolation interp = Interpolation::bilinear);
+  FusedChain &rotate_fxp(float angle,
+                         Interpolation interp = Interpolation::bilinear);
+  FusedChain &sigma_filter(unsigned char sigma, size_t kernel_size = 1,
+                           SigmaEngine engine = SigmaEngine::automatic,
+                           AlphaMode alpha = AlphaMode::filter);
+  // to_gray(), 1 channel out of 3 or more
+  FusedChain &to_gray();
+
+  // Channels of the output for an input of `channels` channels
+  size_t output_channels(size_t channels) const;
+
+  // Runs the operations on input into output, which must have the size of
+  // input and output_channels(input.channels) channels and must not overlap
+  // it. Up to num_threads bands (0 == one per executor thread) are processed
+  // in parallel, each one recomputing the kernel_size rows of its sigma
+  // filters that are past its ends.
+  void run(ConstImageView input, ImageView output,
+           size_t num_threads = 1) const;
+
+  // One operation and its parameters
+  struct Step {
+    enum class Op { rotate, rotate_fxp, sigma_filter, to_gray } op;
+    float angle;
+    Interpolation interp;
+    unsigned char sigma;
+    size_t kernel_size;
+    SigmaEngine engine;
+    AlphaMode alpha;
+  };
+
+private:
+  std::vector<Step> steps;
+};
+
+// Instrumentation. A library configured with -DIMAGEPROC_STATS=ON counts the
+// work done by the kernels and times their phases into process-wide totals,
+// updated once per row (relaxed atomic additions, cheap enough to leave on).
+// Otherwise the kernels contain no instrumentation code at all and the totals
+// stay 0.
+enum class Counter {
+  sigma_pixels,        // pixels filtered by sigma_filter (any pixel format)
+  sigma_hist_updates,  // values added to or removed from histograms
+  sigma_hist_merges,   // column histograms added to or subtracted from the
+                       // window histogram (column_histogram engine)
+  sigma_range_queries, // histogram range queries (one per filtered value)
+  rotate_pixels,       // destination pixels written by rotate and rotate_fxp
+  rotate_in_bounds,    // those of them interpolated from the input, the
+                       // others are cleared (not counted for multiples of
+                       // pi/2, which are copies)
+  count
+};
+
+enum class Timer {
+  sigma_hist_init,    // histograms built from scratch at the start of a row
+                      // (or of a band, for the column histograms)
+  sigma_sweep,        // rest of the rows: sliding updates and range queries
+  sigma_column_slide, // column histograms moved one row down
+  sigma_window,       // direct-window filter (SigmaEngine::direct_window, and
+                      // 16-bit and float images)
+  rotate,             // rotate and rotate_fxp, interpolation and clearing
+  count
+};
+
+struct Stats {
+  std::uint64_t counters[static_cast<size_t>(Counter::count)];
+  std::uint64_t timer_ns[static_cast<size_t>(Timer::count)];    // total time
+  std::uint64_t timer_scopes[static_cast<size_t>(Timer::count)]; // timed scopes
+
+  std::uint64_t operator[](Counter c) const {
+    return counters[static_cast<size_t>(c)];
+  }
+  std::uint64_t ns(Timer t) const { return timer_ns[static_cast<size_t>(t)]; }
+};
+
+// True if the library was built with instrumentation
+bool stats_enabled();
+
+// Snapshot of the totals since the start or reset_stats()
+Stats get_stats();
+void reset_stats();
+
+const char *stat_name(Counter counter);
+const char *stat_name(Timer timer);
+
+// Calls sink(name, value) for every counter and for the total time (name_ns)
+// and number of scopes (name_scopes) of every timer, e.g. to feed a metrics
+// registry
+void export_stats(
+    const std::function<void(const char *name, std::uint64_t value)> &sink);
 
 } /* namespace imageproc */
 
@@ -0,0 +1,122 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility> // std::pair, std::move
+#include <vector>
+
+#include "rawimage.h"
+
+namespace pipeline {
+
+using rawimage::RawImage;
+
+// Blocking FIFO of bounded capacity connecting two pipeline stages: push()
+// waits while the queue is full, pop() while it is empty, so a fast stage
+// cannot run ahead of a slow one by more than `capacity` items.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1U) {}
+
+  // false if the queue was closed (the item is not queued)
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [&]() { return closed || items.size() < capacity; });
+    if (closed)
+      return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // false once the queue is closed and drained
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [&]() { return closed || !items.empty(); });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  // No more pushes; items already queued can still be popped
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+private:
+  size_t capacity;
+  bool closed{ false };
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+};
+
+// One image going through the pipeline
+struct Job {
+  size_t index;       // position in the list given to run()
+  std::string input;  // read by the decode stage
+  std::string output; // written by the encode stage
+  RawImage image;     // decoded input
+  RawImage result;    // written by the operation, encoded unless empty (image
+                      // is encoded then)
+};
+
+// Processing stage: reads job.image and fills job.result (or modifies
+// job.image in place). result comes empty, with the pipeline's buffer pool as
+// allocator and the byte order and pixel format of image.
+using Operation = std::function<void(Job &job)>;
+
+struct Config {
+  size_t decodeWorkers{ 1U };  // threads reading input files
+  size_t processWorkers{ 1U }; // threads running the operation
+  size_t encodeWorkers{ 1U };  // threads writing output files
+  size_t queueCapacity{ 4U };  // decoded (processed) images waiting for a
+                               // process (encode) worker
+  RawImage::ByteOrder byteOrder{ RawImage::ByteOrder::rgb }; // of the
+  RawImage::PixFormat pixFormat{ RawImage::PixFormat::chr }; // decoded images
+};
+
+struct Stats {
+  size_t images{ 0U }; // written successfully
+  size_t failed{ 0U }; // failed to read or write
+  double megapixels{ 0. };
+  double seconds{ 0. };
+
+  double imagesPerSecond() const;
+  double megapixelsPerSecond() const;
+};
+
+// Runs files through three concurrent stages: decode, operation and encode,
+// each with its own workers, connected by bounded queues so that codec work
+// overlaps with processing. Files ending in ".raw" are raw frame files
+// (mapped copy-on-write when read, see RawImage::mapRaw()), anything else goes
+// through Magick++. rawimage::init() must have been called.
+class BatchPipeline {
+public:
+  BatchPipeline(const Config &config, Operation operation);
+
+  // (input, output) file pairs, processed in any order; failures are reported
+  // on std::cerr and counted in Stats::failed
+  Stats run(const std::vector<std::pair<std::string, std::string> > &files);
+
+private:
+  Config config;
+  Operation operation;
+  rawimage::BufferPool pool; // buffers of decoded and processed images
+};
+
+} /* namespace pipeline */
+
+#endif /* __PIPELINE_H */
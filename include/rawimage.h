@@ -4,9 +4,49 @@
 #include <iostream>
 #include <memory>
 #include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace rawimage {
 
+// Alignment (bytes) of all pixel buffers, one cache line / AVX-512 register
+const size_t bufferAlignment = 64U;
+
+// Source of pixel buffers. allocate() returns bufferAlignment-aligned memory
+// and deallocate() gets back the same pointer with the same size.
+class Allocator {
+public:
+  virtual ~Allocator() = default;
+  virtual void *allocate(size_t bytes) = 0;
+  virtual void deallocate(void *ptr, size_t bytes) = 0;
+};
+
+// Allocator that keeps released buffers and hands them out again for requests
+// of the same size class, so a service processing frames of a few sizes stops
+// going to the heap once warmed up. Thread-safe; must outlive the images
+// using it.
+class BufferPool : public Allocator {
+public:
+  // maxCached == 0: keep every released buffer, otherwise buffers that would
+  // make the pool hold more than maxCached bytes are freed
+  explicit BufferPool(size_t maxCached = 0U);
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+  ~BufferPool();
+  void *allocate(size_t bytes) override;
+  void deallocate(void *ptr, size_t bytes) override;
+  // Frees all cached buffers
+  void trim();
+  size_t getCachedBytes() const;
+
+private:
+  size_t maxCached;
+  size_t cachedBytes{ 0U };
+  mutable std::mutex mutex;
+  std::unordered_map<size_t, std::vector<void *> > freeBuffers;
+};
+
 class RawImage {
 public:
   enum class ByteOrder {
@@ -18,23 +58,74 @@ public:
     chr,
     flo
   };
+  // Arrangement of the channels in the buffer
+  enum class Layout {
+    interleaved, // channel d of pixel u at raw[u * getDepth() + d]
+    planar       // channel d of pixel u at raw[d * getW() * getH() + u]
+  };
+  // How mapRaw() maps a raw frame file
+  enum class MapMode {
+    readOnly,   // the pixels must not be written (writes fault); toGray()
+                // converts into a new buffer
+    copyOnWrite // written pages become private copies, the file is never
+                // modified
+  };
   union {
     unsigned char *chr;
     float *flo;
   } raw{ nullptr };
 
   RawImage(const RawImage &) = delete;
-  RawImage(RawImage &&) = delete;
+  RawImage(RawImage &&orig);
   RawImage &operator=(const RawImage &);
-  RawImage &operator=(RawImage &&) = delete;
+  RawImage &operator=(RawImage &&orig);
   RawImage() = default;
-  RawImage(const ByteOrder &byteOrder, const PixFormat &pixFormat);
+  // Buffers come from allocator (nullptr == aligned heap allocation)
+  RawImage(const ByteOrder &byteOrder, const PixFormat &pixFormat,
+           Allocator *allocator = nullptr);
   virtual ~RawImage();
+  // Releases the buffer
   void wipe();
-  void create(size_t w, size_t h);
+  // w x h image, the current buffer is reused when large enough; zeroed
+  // unless zero == false (when every pixel is going to be overwritten)
+  void create(size_t w, size_t h, bool zero = true);
   void read(const char *fname);
   void save(const char *fname) const;
+  // Raw frame files hold the pixels as they are in memory, for passing frames
+  // between processes or pipeline stages without codec work. Layout (integers
+  // little endian, floats in the native format):
+  //   offset 0:  "RAWFRAME"
+  //   offset 8:  uint32 header size, the offset of the pixel data (64, a
+  //              multiple of bufferAlignment)
+  //   offset 12: uint32 byte order (0 gray, 1 rgb, 2 rgba)
+  //   offset 16: uint32 pixel format (0 chr, 1 flo)
+  //   offset 20: uint32 layout (0 interleaved, 1 planar)
+  //   offset 24: uint64 width
+  //   offset 32: uint64 height
+  //   offset 40: uint64 stride, bytes between the starts of consecutive rows
+  //   up to the header size: zero padding
+  // followed by height rows, stride bytes apart (depth planes of height rows
+  // each for planar images). Returns false when the file cannot be written.
+  bool saveRaw(const char *fname) const;
+  // Loads a raw frame file by mapping it in memory and using the mapping as
+  // the pixel buffer: no decoding and no copy (unless the rows in the file are
+  // padded, then they are copied into a buffer of the image). Byte order and
+  // pixel format are taken from the file. On errors (including sizes that do
+  // not fit in memory) the image is left empty with its type unchanged.
+  void mapRaw(const char *fname, MapMode mode = MapMode::copyOnWrite);
+  // Whether the pixel buffer is a file mapping
+  bool isMapped() const;
+  // With more than one thread (see setThreads()) an interleaved image, and
+  // an image mapped read-only, are converted into a new buffer
   void toGray();
+  Layout getLayout() const;
+  // Rearranges the pixels into `layout` (through a new buffer); read() decodes
+  // into the current layout and save() accepts both
+  void setLayout(Layout layout);
+  // Threads of the imageproc executor used by toGray(), setLayout() and the
+  // gray expansion of save() (1 by default, 0 == all of them)
+  void setThreads(size_t threads);
+  size_t getThreads() const;
   size_t getW() const;
   size_t getH() const;
   ByteOrder getByteOrder() const;
@@ -42,15 +133,31 @@ public:
   const char *getByteMap() const;
   size_t getDepth() const;
   size_t getCompSize() const;
+  // Size of the buffer in bytes, at least getW() * getH() * getDepth() *
+  // getCompSize()
+  size_t getCapacity() const;
   static std::unique_ptr<RawImage>
   imgFactory(size_t w, size_t h, const ByteOrder &byteOrder = ByteOrder::rgb,
-             const PixFormat &pixFormat = PixFormat::chr);
+             const PixFormat &pixFormat = PixFormat::chr,
+             Allocator *allocator = nullptr);
 
 private:
   size_t w{ 0U };
   size_t h{ 0U };
+  size_t capacity{ 0U };
   ByteOrder byteOrder{ ByteOrder::rgb };
   PixFormat pixFormat{ PixFormat::chr };
+  Layout layout{ Layout::interleaved };
+  Allocator *allocator{ nullptr };
+  // File mapping holding the pixels (see mapRaw()), nullptr for buffers of
+  // the allocator
+  void *mapping{ nullptr };
+  size_t mappingSize{ 0U };
+  bool readOnly{ false };
+  size_t threads{ 1U };
+
+  // Makes the buffer hold at least `bytes` bytes, contents are not kept
+  void reserve(size_t bytes);
 
   void readImpl(const char *fname);
 };
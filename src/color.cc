@@ -0,0 +1,154 @@
+#include "imageproc.h"
+#include "color_kernels.h"
+#include "parallel.h"
+#include "planar_kernels.h"
+
+namespace imageproc {
+
+// Gray value: 0.11 * c0 + 0.59 * c1 + 0.3 * c2. For 8-bit pixels the weighted
+// sum is computed exactly in integers and truncated; floats are weighted in
+// double precision.
+static inline unsigned char gray_value(int c0, int c1, int c2) {
+  return static_cast<unsigned char>((11 * c0 + 59 * c1 + 30 * c2) / 100);
+}
+
+static inline float gray_value(float c0, float c1, float c2) {
+  return (c2 * 0.3) + (c1 * 0.59) + (c0 * 0.11);
+}
+
+// Pixels deinterleaved on the stack at a time, then converted plane-wise
+static const size_t gray_chunk = 256U;
+
+// Gray values of `pixels` consecutive pixels
+static void gray_pixels(const unsigned char *input, unsigned char *output,
+                        size_t depth, size_t pixels) {
+  size_t done = 0U;
+
+#ifdef IMAGEPROC_X86_SIMD
+  if (depth == 3U && get_simd() != Simd::none) {
+    // Chunks are read before their gray values are written, output may be
+    // input
+    alignas(16) unsigned char planes[3][gray_chunk];
+    for (; done + gray_chunk <= pixels; done += gray_chunk) {
+      deinterleave3_sse41(input + 3U * done, planes[0], planes[1], planes[2],
+                          gray_chunk);
+      gray_from_planes_sse41(planes[0], planes[1], planes[2], output + done,
+                             gray_chunk);
+    }
+  }
+#endif
+  for (size_t u = done; u < pixels; u++) {
+    const unsigned char *pix = input + u * depth;
+    output[u] = gray_value(pix[0], pix[1], pix[2]);
+  }
+}
+
+static void gray_pixels(const float *input, float *output, size_t depth,
+                        size_t pixels) {
+  size_t done = 0U;
+
+#ifdef IMAGEPROC_X86_SIMD
+  if (get_simd() == Simd::avx2)
+    done = to_gray_avx2(input, output, depth, pixels);
+#endif
+  for (size_t u = done; u < pixels; u++) {
+    const float *pix = input + u * depth;
+    output[u] = gray_value(pix[0], pix[1], pix[2]);
+  }
+}
+
+// Rows [row_begin, row_end) at a time, on one thread in place (see
+// imageproc.h)
+template <typename Pixel>
+static void to_gray_rows(const Pixel *input, Pixel *output, size_t width,
+                         size_t height, size_t depth, size_t num_threads) {
+  if (depth < 3U) {
+    std::cerr << "Depth should be at least 3.\n";
+    return;
+  }
+  if (output == input)
+    num_threads = 1U;
+  parallel_rows(height, num_threads, conversion_grain(width),
+                [&](size_t row_begin, size_t row_end) {
+    gray_pixels(input + row_begin * width * depth, output + row_begin * width,
+                depth, (row_end - row_begin) * width);
+  });
+}
+
+void to_gray(const unsigned char *input, unsigned char *output, size_t width,
+             size_t height, size_t depth, size_t num_threads) {
+  to_gray_rows(input, output, width, height, depth, num_threads);
+}
+
+void to_gray(const float *input, float *output, size_t width, size_t height,
+             size_t depth, size_t num_threads) {
+  to_gray_rows(input, output, width, height, depth, num_threads);
+}
+
+void to_gray_planar(const unsigned char *input, unsigned char *output,
+                    size_t width, size_t height) {
+  size_t pixels = width * height, done = 0U;
+  const unsigned char *c0 = input, *c1 = input + pixels,
+                      *c2 = input + 2U * pixels;
+
+#ifdef IMAGEPROC_X86_SIMD
+  if (get_simd() != Simd::none)
+    done = gray_from_planes_sse41(c0, c1, c2, output, pixels);
+#endif
+  for (size_t u = done; u < pixels; u++)
+    output[u] = gray_value(c0[u], c1[u], c2[u]);
+}
+
+void to_gray_planar(const float *input, float *output, size_t width,
+                    size_t height) {
+  size_t pixels = width * height;
+  const float *c0 = input, *c1 = input + pixels, *c2 = input + 2U * pixels;
+
+  for (size_t u = 0U; u < pixels; u++)
+    output[u] = gray_value(c0[u], c1[u], c2[u]);
+}
+
+static void rgb_pixels(const unsigned char *input, unsigned char *output,
+                       size_t pixels) {
+  size_t done = 0U;
+
+#ifdef IMAGEPROC_X86_SIMD
+  if (get_simd() != Simd::none)
+    done = gray_to_rgb_sse41(input, output, pixels);
+#endif
+  for (size_t u = done; u < pixels; u++)
+    output[3U * u] = output[3U * u + 1U] = output[3U * u + 2U] = input[u];
+}
+
+static void rgb_pixels(const float *input, float *output, size_t pixels) {
+  size_t done = 0U;
+
+#ifdef IMAGEPROC_X86_SIMD
+  if (get_simd() != Simd::none)
+    done = gray_to_rgb_sse41(input, output, pixels);
+#endif
+  for (size_t u = done; u < pixels; u++)
+    output[3U * u] = output[3U * u + 1U] = output[3U * u + 2U] = input[u];
+}
+
+template <typename Pixel>
+static void gray_to_rgb_rows(const Pixel *input, Pixel *output, size_t width,
+                             size_t height, size_t num_threads) {
+  parallel_rows(height, num_threads, conversion_grain(width),
+                [&](size_t row_begin, size_t row_end) {
+    rgb_pixels(input + row_begin * width, output + 3U * row_begin * width,
+               (row_end - row_begin) * width);
+  });
+}
+
+void gray_to_rgb(const unsigned char *input, unsigned char *output,
+                 size_t width, size_t height, size_t num_threads) {
+  gray_to_rgb_rows(input, output, width, height, num_threads);
+}
+
+void gray_to_rgb(const float *input, float *output, size_t width,
+                 size_t height, size_t num_threads) {
+  gray_to_rgb_rows(input, output, width, height, num_threads);
+}
+
+} /* namespace imageproc */
@@ -0,0 +1,45 @@
+// AVX2 color conversions, this file is compiled with -mavx2 (and without FMA,
+// so that the products and sums are rounded as in the scalar code)
+#include <immintrin.h>
+#include "color_kernels.h"
+
+namespace imageproc {
+
+// The channels of 8 pixels are gathered and weighted in double precision,
+// exactly like the scalar code, 4 pixels at a time
+size_t to_gray_avx2(const float *input, float *output, size_t depth,
+                    size_t n) {
+  const __m256i index = _mm256_mullo_epi32(
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+      _mm256_set1_epi32(static_cast<int>(depth)));
+  const __m256d w0 = _mm256_set1_pd(0.11), w1 = _mm256_set1_pd(0.59),
+                w2 = _mm256_set1_pd(0.3);
+  size_t done = 0U;
+
+  for (; done + 8U <= n; done += 8U) {
+    const float *pix = input + done * depth;
+    __m256 c0 = _mm256_i32gather_ps(pix, index, 4);
+    __m256 c1 = _mm256_i32gather_ps(pix + 1, index, 4);
+    __m256 c2 = _mm256_i32gather_ps(pix + 2, index, 4);
+    __m128 gray[2];
+    for (int half = 0; half < 2; half++) {
+      __m256d d0 = _mm256_cvtps_pd(half ? _mm256_extractf128_ps(c0, 1)
+                                        : _mm256_castps256_ps128(c0));
+      __m256d d1 = _mm256_cvtps_pd(half ? _mm256_extractf128_ps(c1, 1)
+                                        : _mm256_castps256_ps128(c1));
+      __m256d d2 = _mm256_cvtps_pd(half ? _mm256_extractf128_ps(c2, 1)
+                                        : _mm256_castps256_ps128(c2));
+      // (c2 * 0.3) + (c1 * 0.59) + (c0 * 0.11), in this order
+      __m256d sum = _mm256_add_pd(
+          _mm256_add_pd(_mm256_mul_pd(d2, w2), _mm256_mul_pd(d1, w1)),
+          _mm256_mul_pd(d0, w0));
+      gray[half] = _mm256_cvtpd_ps(sum);
+    }
+    _mm256_storeu_ps(output + done,
+                     _mm256_insertf128_ps(_mm256_castps128_ps256(gray[0]),
+                                          gray[1], 1));
+  }
+  return done;
+}
+
+} /* namespace imageproc */
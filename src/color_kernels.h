@@ -0,0 +1,26 @@
+#ifndef __COLOR_KERNELS_H
+#define __COLOR_KERNELS_H
+
+#include <cstddef>
+
+namespace imageproc {
+
+// Vectorized color conversions of the first n pixels of a row, return the
+// number of pixels converted (a multiple of the vector width), the remaining
+// ones are left to the scalar code. Gray values are computed as in color.cc.
+
+// Gray from the channel planes c0, c1 and c2
+size_t gray_from_planes_sse41(const unsigned char *c0, const unsigned char *c1,
+                              const unsigned char *c2, unsigned char *output,
+                              size_t n);
+// Gray to 3 equal channels
+size_t gray_to_rgb_sse41(const unsigned char *input, unsigned char *output,
+                         size_t n);
+size_t gray_to_rgb_sse41(const float *input, float *output, size_t n);
+// Gray of interleaved pixels of `depth` channels (output may be input)
+size_t to_gray_avx2(const float *input, float *output, size_t depth,
+                    size_t n);
+
+} /* namespace imageproc */
+
+#endif /* __COLOR_KERNELS_H */
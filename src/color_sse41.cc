@@ -0,0 +1,73 @@
+// SSE4.1 color conversions, this file is compiled with -msse4.1
+#include <smmintrin.h>
+#include "color_kernels.h"
+
+namespace imageproc {
+
+size_t gray_from_planes_sse41(const unsigned char *c0, const unsigned char *c1,
+                              const unsigned char *c2, unsigned char *output,
+                              size_t n) {
+  const __m128i w0 = _mm_set1_epi16(11), w1 = _mm_set1_epi16(59),
+                w2 = _mm_set1_epi16(30);
+  // floor(s / 100) == (s * 5243) >> 19 for s < 43690, the weighted sums
+  // are at most 25500
+  const __m128i div = _mm_set1_epi16(5243);
+  size_t done = 0U;
+
+  for (; done + 16U <= n; done += 16U) {
+    __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(c0 + done));
+    __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(c1 + done));
+    __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(c2 + done));
+    __m128i gray[2];
+    for (int half = 0; half < 2; half++) {
+      __m128i s = _mm_add_epi16(
+          _mm_add_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(v0), w0),
+                        _mm_mullo_epi16(_mm_cvtepu8_epi16(v1), w1)),
+          _mm_mullo_epi16(_mm_cvtepu8_epi16(v2), w2));
+      gray[half] = _mm_srli_epi16(_mm_mulhi_epu16(s, div), 3);
+      v0 = _mm_srli_si128(v0, 8);
+      v1 = _mm_srli_si128(v1, 8);
+      v2 = _mm_srli_si128(v2, 8);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + done),
+                     _mm_packus_epi16(gray[0], gray[1]));
+  }
+  return done;
+}
+
+size_t gray_to_rgb_sse41(const unsigned char *input, unsigned char *output,
+                         size_t n) {
+  // Byte i of output vector k is the gray value of pixel (16k + i) / 3
+  const __m128i expand[3] = {
+    _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5),
+    _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10),
+    _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15,
+                  15)
+  };
+  size_t done = 0U;
+
+  for (; done + 16U <= n; done += 16U) {
+    __m128i gray =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + done));
+    for (int k = 0; k < 3; k++)
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i *>(output + 3U * done + 16U * k),
+          _mm_shuffle_epi8(gray, expand[k]));
+  }
+  return done;
+}
+
+size_t gray_to_rgb_sse41(const float *input, float *output, size_t n) {
+  size_t done = 0U;
+
+  for (; done + 4U <= n; done += 4U) {
+    __m128 gray = _mm_loadu_ps(input + done);
+    float *out = output + 3U * done;
+    _mm_storeu_ps(out, _mm_shuffle_ps(gray, gray, _MM_SHUFFLE(1, 0, 0, 0)));
+    _mm_storeu_ps(out + 4, _mm_shuffle_ps(gray, gray, _MM_SHUFFLE(2, 2, 1, 1)));
+    _mm_storeu_ps(out + 8, _mm_shuffle_ps(gray, gray, _MM_SHUFFLE(3, 3, 3, 2)));
+  }
+  return done;
+}
+
+} /* namespace imageproc */
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "imageproc.h"
+
+namespace imageproc {
+
+// Tasks of one ThreadPool::run() call, on the stack of its caller
+struct Batch {
+  const std::function<void(size_t)> *task;
+  std::atomic<size_t> remaining;
+};
+
+struct Task {
+  Batch *batch;
+  size_t index;
+};
+
+class ThreadPool::Impl {
+public:
+  Impl(size_t num_threads, bool pin_threads);
+  ~Impl();
+
+  void run(size_t count, const std::function<void(size_t)> &task);
+  size_t concurrency() const { return workers.size() + 1U; }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool pop(size_t self, Task &task);
+  bool steal(size_t self, Task &task);
+  void execute(const Task &task);
+  void work(size_t self, bool pin);
+
+  std::vector<std::unique_ptr<Queue> > queues; // queues[i]: of workers[i]
+  std::vector<std::thread> workers;
+  // Tasks pushed and not taken yet (counted before they are pushed, so never
+  // less than the queued ones)
+  std::atomic<size_t> pending{ 0U };
+  std::atomic<size_t> next_queue{ 0U };
+  std::mutex wake_mutex; // guards the waits on `wake` and `stop`
+  std::condition_variable wake;
+  bool stop = false;
+};
+
+// Pool and index of the worker running on this thread, if any
+static thread_local ThreadPool::Impl *worker_pool = nullptr;
+static thread_local size_t worker_index = 0U;
+
+ThreadPool::Impl::Impl(size_t num_threads, bool pin_threads) {
+  if (num_threads == 0)
+    num_threads = std::max(1U, std::thread::hardware_concurrency());
+  for (size_t i = 1U; i < num_threads; i++)
+    queues.emplace_back(new Queue);
+  for (size_t i = 0U; i < queues.size(); i++)
+    workers.emplace_back(&Impl::work, this, i, pin_threads);
+}
+
+ThreadPool::Impl::~Impl() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (auto &w : workers)
+    w.join();
+}
+
+// Newest task of queues[self]
+bool ThreadPool::Impl::pop(size_t self, Task &task) {
+  Queue &queue = *queues[self];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty())
+    return false;
+  task = queue.tasks.back();
+  queue.tasks.pop_back();
+  pending--;
+  return true;
+}
+
+// Oldest task of the first other queue that has one, self ==
+// queues.size() (not a worker) looks at all of them
+bool ThreadPool::Impl::steal(size_t self, Task &task) {
+  size_t count = queues.size();
+  for (size_t i = 1U; i <= count; i++) {
+    size_t victim = (self + i) % (count + 1U);
+    if (victim == count)
+      continue;
+    Queue &queue = *queues[victim];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      continue;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    pending--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::Impl::execute(const Task &task) {
+  (*task.batch->task)(task.index);
+  // The batch may be gone as soon as the count reaches 0
+  if (--task.batch->remaining == 0U) {
+    std::lock_guard<std::mutex> lock(wake_mutex);
+    wake.notify_all();
+  }
+}
+
+void ThreadPool::Impl::work(size_t self, bool pin) {
+#ifdef __linux__
+  if (pin) {
+    cpu_set_t cpus;
+    unsigned num_cpus = std::max(1U, std::thread::hardware_concurrency());
+    CPU_ZERO(&cpus);
+    CPU_SET((self + 1U) % num_cpus, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#else
+  (void)pin;
+#endif
+  worker_pool = this;
+  worker_index = self;
+
+  for (;;) {
+    Task task;
+    if (pop(self, task) || steal(self, task)) {
+      execute(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    wake.wait(lock, [this]() { return stop || pending > 0U; });
+    if (stop && pending == 0U)
+      return;
+  }
+}
+
+void ThreadPool::Impl::run(size_t count,
+                           const std::function<void(size_t)> &task) {
+  if (count <= 1U || workers.empty()) {
+    for (size_t i = 0U; i < count; i++)
+      task(i);
+    return;
+  }
+
+  Batch batch;
+  batch.task = &task;
+  batch.remaining = count;
+  // From a worker of this pool (a nested call) the tasks go to its own queue
+  // for the others to steal, otherwise they are dealt out to all the queues
+  bool nested = worker_pool == this;
+  size_t self = nested ? worker_index : queues.size();
+
+  pending += count - 1U;
+  for (size_t i = 1U; i < count; i++) {
+    Queue &queue = *queues[nested ? self : next_queue++ % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(Task{ &batch, i });
+  }
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex);
+  }
+  wake.notify_all();
+
+  // Task 0 here, then whatever is queued until the batch is done
+  execute(Task{ &batch, 0U });
+  while (batch.remaining > 0U) {
+    Task other;
+    if ((nested && pop(self, other)) || steal(self, other)) {
+      execute(other);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    wake.wait(lock, [&]() { return batch.remaining == 0U || pending > 0U; });
+  }
+}
+
+ThreadPool::ThreadPool(size_t num_threads, bool pin_threads)
+    : impl(new Impl(num_threads, pin_threads)) {}
+
+ThreadPool::~ThreadPool() {}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)> &task) {
+  impl->run(count, task);
+}
+
+size_t ThreadPool::concurrency() const { return impl->concurrency(); }
+
+// Executor set with set_executor(), the library's pool when null
+static std::atomic<Executor *> selected_executor{ nullptr };
+static std::mutex pool_mutex;
+static std::unique_ptr<ThreadPool> library_pool;
+
+Executor &get_executor() {
+  Executor *executor = selected_executor;
+  if (executor)
+    return *executor;
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  if (!library_pool)
+    library_pool.reset(new ThreadPool());
+  return *library_pool;
+}
+
+void set_executor(Executor *executor) { selected_executor = executor; }
+
+void configure_thread_pool(size_t num_threads, bool pin_threads) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  library_pool.reset(new ThreadPool(num_threads, pin_threads));
+}
+
+} /* namespace imageproc */
@@ -0,0 +1,91 @@
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include <cstddef>     // ptrdiff_t
+#include <type_traits> // std::conditional
+#include "imageproc.h"
+
+// LOC() with the row stride given in bytes
+#define LOC_STRIDE(row, col, stride, depth, d)                                 \
+  ((row) * (stride) + (col) * (depth) + (d))
+
+namespace imageproc {
+
+// Image as seen by the kernels, row r starts at data + r * stride (in bytes).
+// Same as BasicImageView with int geometry and the channel count left to the
+// Depth template parameters.
+template <typename Pixel> struct Frame {
+  Pixel *data;
+  int width;
+  int height;
+  int stride;
+};
+
+template <typename Pixel>
+inline Frame<Pixel> make_frame(const BasicImageView<Pixel> &view) {
+  return Frame<Pixel>{ view.data, static_cast<int>(view.width),
+                       static_cast<int>(view.height),
+                       static_cast<int>(view.stride) };
+}
+
+// unsigned char with the constness of Pixel
+template <typename Pixel>
+using ByteOf = typename std::conditional<std::is_const<Pixel>::value,
+                                         const unsigned char,
+                                         unsigned char>::type;
+
+// p advanced by `bytes` bytes, for strides over pixels wider than a byte
+template <typename Pixel>
+inline Pixel *byte_offset(Pixel *p, std::ptrdiff_t bytes) {
+  return reinterpret_cast<Pixel *>(reinterpret_cast<ByteOf<Pixel> *>(p) +
+                                   bytes);
+}
+
+// Same pixels seen as chunks of sizeof(Pixel) bytes per channel
+template <typename Pixel>
+inline Frame<ByteOf<Pixel> > byte_frame(const Frame<Pixel> &f) {
+  return Frame<ByteOf<Pixel> >{ reinterpret_cast<ByteOf<Pixel> *>(f.data),
+                                f.width, f.height, f.stride };
+}
+
+// f enlarged by `padding` pixels of `depth` channels on every side, which the
+// caller guarantees to be part of the same buffer (BorderMode::padded). The
+// centers (width >> 1, height >> 1) of both frames are the same pixel.
+template <typename Pixel>
+inline Frame<Pixel> padded_frame(const Frame<Pixel> &f, size_t depth,
+                                 size_t padding) {
+  int pad = static_cast<int>(padding);
+  Pixel *data = byte_offset(f.data, -static_cast<std::ptrdiff_t>(padding) *
+                                        (f.stride + depth * sizeof(Pixel)));
+  return Frame<Pixel>{ data, f.width + 2 * pad, f.height + 2 * pad, f.stride };
+}
+
+// Row or column of the input that stands for index i of a dimension of n
+// pixels under `mode`, i itself inside of the input and -1 outside of it for
+// BorderMode::constant (and clip)
+inline int border_index(BorderMode mode, int i, int n) {
+  if (i >= 0 && i < n)
+    return i;
+  switch (mode) {
+  case BorderMode::replicate:
+    return i < 0 ? 0 : n - 1;
+  case BorderMode::reflect: {
+    // Period 2n - 2, the edge pixels are not repeated
+    int period = 2 * n - 2;
+    if (period == 0)
+      return 0;
+    i %= period;
+    i = i < 0 ? i + period : i;
+    return i < n ? i : period - i;
+  }
+  case BorderMode::wrap:
+    i %= n;
+    return i < 0 ? i + n : i;
+  default:
+    return -1;
+  }
+}
+
+} /* namespace imageproc */
+
+#endif /* __FRAME_H */
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cstring> // memcpy
+#include <memory>
+#include <vector>
+#include "imageproc.h"
+#include "frame.h"
+#include "parallel.h"
+#include "rotation_kernels.h"
+#include "sigma_stream.h"
+
+namespace imageproc {
+
+using Step = FusedChain::Step;
+
+// Receiver of the output rows of an operation, in order: the producer either
+// writes row r to row_buffer(r) and then calls commit(r), or hands a row it
+// already has to put()
+class RowStage {
+public:
+  virtual ~RowStage() {}
+  virtual unsigned char *row_buffer(int row) = 0;
+  virtual void commit(int row) = 0;
+  // Row `row` (as many bytes as a row_buffer()) from data
+  virtual void put(int row, const unsigned char *data, size_t bytes) {
+    memcpy(row_buffer(row), data, bytes);
+    commit(row);
+  }
+};
+
+// Rows of the output image of the chain (or of an intermediate image),
+// written in place
+class ImageStage : public RowStage {
+public:
+  explicit ImageStage(const Frame<unsigned char> &out) : out(out) {}
+  unsigned char *row_buffer(int row) override {
+    return out.data + row * out.stride;
+  }
+  void commit(int) override {}
+
+private:
+  Frame<unsigned char> out;
+};
+
+// to_gray() of every row into the next stage
+class GrayStage : public RowStage {
+public:
+  GrayStage(size_t width, size_t depth, RowStage *next)
+      : width(width), depth(depth), row(width * depth), next(next) {}
+  unsigned char *row_buffer(int) override { return row.data(); }
+  void commit(int r) override { put(r, row.data(), row.size()); }
+  void put(int r, const unsigned char *data, size_t) override {
+    imageproc::to_gray(data, next->row_buffer(r), width, 1U, depth);
+    next->commit(r);
+  }
+
+private:
+  size_t width, depth;
+  std::vector<unsigned char> row;
+  RowStage *next;
+};
+
+// Sigma filter stream of output rows [row_begin, row_end), filtering straight
+// into the buffers of the next stage
+class SigmaStage : public RowStage {
+public:
+  SigmaStage(size_t width, size_t height, size_t depth, const Step &step,
+             size_t row_begin, size_t row_end, RowStage *next)
+      : stream(make_sigma_stream(
+            width, height, depth, step.sigma,
+            [next](size_t row, const unsigned char *) {
+              next->commit(static_cast<int>(row));
+            },
+            step.kernel_size, step.engine, step.alpha, row_begin, row_end)) {
+    stream->target = [next](size_t row) {
+      return next->row_buffer(static_cast<int>(row));
+    };
+  }
+  unsigned char *row_buffer(int) override { return stream->next_row(); }
+  void commit(int) override { stream->commit_row(); }
+
+private:
+  std::unique_ptr<SigmaFilterStream::Impl> stream;
+};
+
+static bool is_rotation(const Step &step) {
+  return step.op == Step::Op::rotate || step.op == Step::Op::rotate_fxp;
+}
+
+// Output rows [row_begin, row_end) of steps [first, last) on `in`, of `depth`
+// channels. Only steps[first] may be a rotation: it is the source of the
+// rows, reading `in` as a whole, and the other steps only need the rows
+// around theirs. Going back from the last step, each sigma filter widens the
+// range of rows needed from the step before it by its kernel_size.
+static void run_band(const std::vector<Step> &steps, size_t first,
+                     size_t last, const Frame<const unsigned char> &in,
+                     size_t depth, const Frame<unsigned char> &out,
+                     size_t row_begin, size_t row_end) {
+  size_t width = in.width, height = in.height;
+  std::vector<size_t> depths(1U, depth); // depths[i - first]: input of step i
+  std::vector<std::unique_ptr<RowStage> > stages;
+  const Step *source = is_rotation(steps[first]) ? &steps[first] : nullptr;
+
+  for (size_t i = first; i < last; i++)
+    depths.push_back(steps[i].op == Step::Op::to_gray ? 1U : depths.back());
+
+  stages.emplace_back(new ImageStage(out));
+  for (size_t i = last; i-- > first + (source ? 1U : 0U);) {
+    RowStage *next = stages.back().get();
+    size_t step_depth = depths[i - first];
+
+    if (steps[i].op == Step::Op::sigma_filter) {
+      size_t kernel_size = steps[i].kernel_size;
+      stages.emplace_back(new SigmaStage(width, height, step_depth, steps[i],
+                                         row_begin, row_end, next));
+      row_begin -= std::min(row_begin, kernel_size);
+      row_end = std::min(height, row_end + kernel_size);
+    } else {
+      stages.emplace_back(new GrayStage(width, step_depth, next));
+    }
+  }
+
+  RowStage *stage = stages.back().get();
+  for (size_t r = row_begin; r < row_end; r++) {
+    int row = static_cast<int>(r);
+    if (!source) {
+      stage->put(row, in.data + row * in.stride, width * depth);
+      continue;
+    }
+    // One destination row, written into the buffer of the first stage
+    Frame<unsigned char> row_out{ stage->row_buffer(row), in.width,
+                                  in.height, 0 };
+    if (source->op == Step::Op::rotate)
+      rotate_row_range(in, row_out, depth, source->angle, source->interp, row,
+                       row + 1);
+    else
+      rotate_fxp_row_range(in, row_out, depth, source->angle, source->interp,
+                           row, row + 1);
+    stage->commit(row);
+  }
+}
+
+FusedChain &FusedChain::rotate(float angle, Interpolation interp) {
+  steps.push_back(Step{ Step::Op::rotate, angle, interp, 0U, 0U,
+                        SigmaEngine::automatic, AlphaMode::filter });
+  return *this;
+}
+
+FusedChain &FusedChain::rotate_fxp(float angle, Interpolation interp) {
+  steps.push_back(Step{ Step::Op::rotate_fxp, angle, interp, 0U, 0U,
+                        SigmaEngine::automatic, AlphaMode::filter });
+  return *this;
+}
+
+FusedChain &FusedChain::sigma_filter(unsigned char sigma, size_t kernel_size,
+                                     SigmaEngine engine, AlphaMode alpha) {
+  steps.push_back(Step{ Step::Op::sigma_filter, 0.f, Interpolation::bilinear,
+                        sigma, kernel_size, engine, alpha });
+  return *this;
+}
+
+FusedChain &FusedChain::to_gray() {
+  steps.push_back(Step{ Step::Op::to_gray, 0.f, Interpolation::bilinear, 0U,
+                        0U, SigmaEngine::automatic, AlphaMode::filter });
+  return *this;
+}
+
+size_t FusedChain::output_channels(size_t channels) const {
+  for (const Step &step : steps) {
+    if (step.op == Step::Op::to_gray)
+      channels = 1U;
+  }
+  return channels;
+}
+
+void FusedChain::run(ConstImageView input, ImageView output,
+                     size_t num_threads) const {
+  size_t width = input.width, height = input.height;
+  size_t channels = input.channels;
+
+  if (input.width != output.width || input.height != output.height) {
+    std::cerr << "Input and output should have the same size.\n";
+    return;
+  }
+  if (channels < 1U || channels > 4U) {
+    std::cerr << "Depth should be 1 (grayscale), 2 (grayscale + alpha), 3 "
+                 "(rgb) or 4 (rgba).\n";
+    return;
+  }
+  for (const Step &step : steps) {
+    if (step.op != Step::Op::to_gray)
+      continue;
+    if (channels < 3U) {
+      std::cerr << "Depth should be at least 3.\n";
+      return;
+    }
+    channels = 1U;
+  }
+  if (output.channels != channels) {
+    std::cerr << "Output should have " << channels << " channels.\n";
+    return;
+  }
+
+  // The chain runs in parts of one pass each, a rotation that is not the
+  // first step starts a new part; the images between two parts are the only
+  // full intermediates
+  std::vector<unsigned char> images[2];
+  Frame<const unsigned char> in = make_frame(input);
+  size_t depth = input.channels;
+  size_t first = 0U;
+  int part = 0;
+
+  do {
+    size_t last = std::min(first + 1U, steps.size());
+    size_t out_depth = depth;
+    Frame<unsigned char> out = make_frame(output);
+
+    while (last < steps.size() && !is_rotation(steps[last]))
+      last++;
+    for (size_t i = first; i < last; i++) {
+      if (steps[i].op == Step::Op::to_gray)
+        out_depth = 1U;
+    }
+    if (last < steps.size()) {
+      std::vector<unsigned char> &image = images[part++ % 2];
+      image.resize(width * height * out_depth);
+      out = Frame<unsigned char>{ image.data(), static_cast<int>(width),
+                                  static_cast<int>(height),
+                                  static_cast<int>(width * out_depth) };
+    }
+
+    parallel_bands(height, num_threads, [&](size_t begin, size_t end) {
+      if (first < last)
+        run_band(steps, first, last, in, depth, out, begin, end);
+      else // No steps, a copy
+        for (size_t row = begin; row < end; row++)
+          memcpy(out.data + row * out.stride, in.data + row * in.stride,
+                 width * depth);
+    });
+
+    in = Frame<const unsigned char>{ out.data, out.width, out.height,
+                                     out.stride };
+    depth = out_depth;
+    first = last;
+  } while (first < steps.size());
+}
+
+} /* namespace imageproc */
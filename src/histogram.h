@@ -0,0 +1,105 @@
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <cstdint>
+#include <cstddef> // size_t
+
+namespace imageproc {
+
+// Two-level histogram of 8-bit values: 256 fine bins plus 16 coarse bins, each
+// holding the count and the sum of the values of 16 consecutive fine bins.
+// The sliding window keeps both levels up to date, so a range query touches at
+// most 15 + 16 + 15 bins instead of up to 256 fine ones. With Coarse == false
+// only the fine level is maintained and ranges are scanned bin by bin, which
+// is cheaper for narrow ranges.
+template <typename Count, bool Coarse = true> struct Histogram {
+  static const unsigned fine_bits = 4U;  // log2(fine bins per coarse bin)
+  static const unsigned fine_mask = (1U << fine_bits) - 1U;
+  static const size_t coarse_bins = 256U >> fine_bits;
+
+  Count fine[256];
+  Count coarse[coarse_bins];
+  std::uint32_t coarse_sum[coarse_bins];
+
+  void clear() {
+    for (size_t i = 0U; i < 256U; i++)
+      fine[i] = 0;
+    for (size_t i = 0U; i < coarse_bins; i++) {
+      coarse[i] = 0;
+      coarse_sum[i] = 0U;
+    }
+  }
+
+  void add(unsigned char val) {
+    fine[val]++;
+    if (Coarse) {
+      coarse[val >> fine_bits]++;
+      coarse_sum[val >> fine_bits] += val;
+    }
+  }
+
+  void remove(unsigned char val) {
+    fine[val]--;
+    if (Coarse) {
+      coarse[val >> fine_bits]--;
+      coarse_sum[val >> fine_bits] -= val;
+    }
+  }
+
+  // Bin-wise addition/subtraction of another histogram
+  void add(const Histogram &h) {
+    for (size_t i = 0U; i < 256U; i++)
+      fine[i] += h.fine[i];
+    if (!Coarse)
+      return;
+    for (size_t i = 0U; i < coarse_bins; i++) {
+      coarse[i] += h.coarse[i];
+      coarse_sum[i] += h.coarse_sum[i];
+    }
+  }
+
+  void subtract(const Histogram &h) {
+    for (size_t i = 0U; i < 256U; i++)
+      fine[i] -= h.fine[i];
+    if (!Coarse)
+      return;
+    for (size_t i = 0U; i < coarse_bins; i++) {
+      coarse[i] -= h.coarse[i];
+      coarse_sum[i] -= h.coarse_sum[i];
+    }
+  }
+
+  // Number of entries with value in [lo, hi] (n) and the sum of those values
+  void range(unsigned lo, unsigned hi, std::uint32_t &n,
+             std::uint32_t &sum) const {
+    unsigned lo_bin = lo >> fine_bits;
+    unsigned hi_bin = hi >> fine_bits;
+
+    n = 0U;
+    sum = 0U;
+    if (!Coarse || lo_bin == hi_bin) {
+      fine_range(lo, hi, n, sum);
+      return;
+    }
+    // Partial coarse bins at both ends of the range are read from fine bins
+    fine_range(lo, (lo_bin << fine_bits) | fine_mask, n, sum);
+    for (unsigned b = lo_bin + 1U; b < hi_bin; b++) {
+      n += coarse[b];
+      sum += coarse_sum[b];
+    }
+    fine_range(hi_bin << fine_bits, hi, n, sum);
+  }
+
+private:
+  void fine_range(unsigned lo, unsigned hi, std::uint32_t &n,
+                  std::uint32_t &sum) const {
+    for (unsigned p_val = lo; p_val <= hi; p_val++) {
+      sum += p_val * fine[p_val];
+      n += fine[p_val];
+    }
+  }
+};
+
+} /* namespace imageproc */
+
+#endif /* __HISTOGRAM_H */
@@ -0,0 +1,69 @@
+#ifndef __PARALLEL_H
+#define __PARALLEL_H
+
+#include <algorithm> // std::min
+#include <atomic>
+#include <cstddef> // size_t
+#include "imageproc.h"
+
+namespace imageproc {
+
+// Splits rows [0, height) into num_threads contiguous horizontal bands and
+// calls func(row_begin, row_end) for each band as a task of get_executor(),
+// the calling thread included. num_threads == 0 means one band per thread of
+// the executor.
+template <typename Func>
+void parallel_bands(size_t height, size_t num_threads, Func func) {
+  if (num_threads == 0)
+    num_threads = get_executor().concurrency();
+  if (num_threads > height)
+    num_threads = height;
+  if (num_threads <= 1) {
+    func(static_cast<size_t>(0U), height);
+    return;
+  }
+
+  size_t band = height / num_threads;
+  size_t extra = height % num_threads; // first `extra` bands get one more row
+  get_executor().run(num_threads, [&](size_t t) {
+    size_t begin = t * band + std::min(t, extra);
+    func(begin, begin + band + (t < extra ? 1U : 0U));
+  });
+}
+
+// Calls func(row_begin, row_end) for rows [0, height) in chunks of `grain`
+// rows, for work whose cost varies from row to row: num_threads tasks of
+// get_executor() take the chunks in turn until there are none left, so the
+// threads that get cheap rows take more of them. num_threads == 0 means one
+// task per thread of the executor.
+template <typename Func>
+void parallel_rows(size_t height, size_t num_threads, size_t grain,
+                   Func func) {
+  grain = std::max(grain, static_cast<size_t>(1U));
+  size_t chunks = (height + grain - 1) / grain;
+  if (num_threads == 0)
+    num_threads = get_executor().concurrency();
+  if (num_threads > chunks)
+    num_threads = chunks;
+  if (num_threads <= 1) {
+    func(static_cast<size_t>(0U), height);
+    return;
+  }
+
+  std::atomic<size_t> next(0U);
+  get_executor().run(num_threads, [&](size_t) {
+    for (size_t c = next++; c < chunks; c = next++)
+      func(c * grain, std::min(height, (c + 1) * grain));
+  });
+}
+
+// Rows per parallel_rows() chunk for the per-pixel conversions: about 64K
+// pixels, enough work to be worth a chunk
+inline size_t conversion_grain(size_t width) {
+  size_t one = 1U;
+  return std::max(one, (one << 16) / std::max(width, one));
+}
+
+} /* namespace imageproc */
+
+#endif /* __PARALLEL_H */
@@ -0,0 +1,130 @@
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "pipeline.h"
+
+namespace pipeline {
+
+using JobQueue = BoundedQueue<std::unique_ptr<Job> >;
+
+static bool isRawFrame(const std::string &fname) {
+  static const std::string ext(".raw");
+  return fname.size() >= ext.size() &&
+         !fname.compare(fname.size() - ext.size(), ext.size(), ext);
+}
+
+double Stats::imagesPerSecond() const {
+  return seconds > 0. ? images / seconds : 0.;
+}
+
+double Stats::megapixelsPerSecond() const {
+  return seconds > 0. ? megapixels / seconds : 0.;
+}
+
+BatchPipeline::BatchPipeline(const Config &_config, Operation _operation)
+    : config(_config), operation(_operation) {}
+
+// Runs `workers` threads of func(); the last one to finish calls done()
+template <typename Func, typename Done>
+static void startStage(std::vector<std::thread> &threads, size_t workers,
+                       Func func, Done done) {
+  if (!workers)
+    workers = 1U;
+  auto remaining = std::make_shared<std::atomic<size_t> >(workers);
+  for (size_t w = 0U; w < workers; w++) {
+    threads.emplace_back([=]() {
+      func();
+      if (1U == remaining->fetch_sub(1U))
+        done();
+    });
+  }
+}
+
+Stats BatchPipeline::run(
+    const std::vector<std::pair<std::string, std::string> > &files) {
+  JobQueue decoded(config.queueCapacity);
+  JobQueue processed(config.queueCapacity);
+  std::atomic<size_t> next{ 0U };
+  std::atomic<size_t> images{ 0U }, failed{ 0U }, pixels{ 0U };
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+
+  startStage(threads, config.decodeWorkers, [&]() {
+    for (size_t i = next++; i < files.size(); i = next++) {
+      std::unique_ptr<Job> job(new Job{
+          i, files[i].first, files[i].second,
+          RawImage(config.byteOrder, config.pixFormat, &pool),
+          RawImage(config.byteOrder, config.pixFormat, &pool) });
+      try {
+        if (isRawFrame(job->input))
+          job->image.mapRaw(job->input.c_str());
+        else
+          job->image.read(job->input.c_str());
+      } catch (const std::exception &e) {
+        std::cerr << "Cannot read " << job->input << ": " << e.what() << '\n';
+      }
+      if (!job->image.getW() || !job->image.getH()) {
+        failed++;
+        continue;
+      }
+      // Raw frame files bring their own byte order and pixel format
+      job->result = RawImage(job->image.getByteOrder(),
+                             job->image.getPixFormat(), &pool);
+      decoded.push(std::move(job));
+    }
+  }, [&]() { decoded.close(); });
+
+  startStage(threads, config.processWorkers, [&]() {
+    std::unique_ptr<Job> job;
+    while (decoded.pop(job)) {
+      try {
+        operation(*job);
+      } catch (const std::exception &e) {
+        std::cerr << "Cannot process " << job->input << ": " << e.what()
+                  << '\n';
+        failed++;
+        continue;
+      }
+      processed.push(std::move(job));
+    }
+  }, [&]() { processed.close(); });
+
+  startStage(threads, config.encodeWorkers, [&]() {
+    std::unique_ptr<Job> job;
+    while (processed.pop(job)) {
+      const RawImage &out = job->result.getW() ? job->result : job->image;
+      try {
+        if (!isRawFrame(job->output)) {
+          out.save(job->output.c_str());
+        } else if (!out.saveRaw(job->output.c_str())) {
+          failed++; // reported by saveRaw()
+          continue;
+        }
+      } catch (const std::exception &e) {
+        std::cerr << "Cannot write " << job->output << ": " << e.what()
+                  << '\n';
+        failed++;
+        continue;
+      }
+      images++;
+      pixels += out.getW() * out.getH();
+    }
+  }, []() {});
+
+  for (auto &t : threads)
+    t.join();
+
+  Stats stats;
+  stats.images = images;
+  stats.failed = failed;
+  stats.megapixels = pixels * 1e-6;
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+} /* namespace pipeline */
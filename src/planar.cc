@@ -0,0 +1,159 @@
+#include <cstring>
+#include <vector>
+#include "imageproc.h"
+#include "parallel.h"
+#include "planar_kernels.h"
+
+namespace imageproc {
+
+// Channel d of the n pixels of an interleaved row to planes[d]
+static void deinterleave_row(const unsigned char *input,
+                             unsigned char *const planes[], size_t depth,
+                             size_t n, Simd simd) {
+  size_t done = 0U;
+
+  if (depth == 1) {
+    memcpy(planes[0], input, n);
+    return;
+  }
+#ifdef IMAGEPROC_X86_SIMD
+  if (depth == 3 && simd != Simd::none)
+    done = deinterleave3_sse41(input, planes[0], planes[1], planes[2], n);
+#endif
+  for (size_t p = done; p < n; p++)
+    for (size_t d = 0U; d < depth; d++)
+      planes[d][p] = input[p * depth + d];
+}
+
+static void interleave_row(const unsigned char *const planes[],
+                           unsigned char *output, size_t depth, size_t n,
+                           Simd simd) {
+  size_t done = 0U;
+
+  if (depth == 1) {
+    memcpy(output, planes[0], n);
+    return;
+  }
+#ifdef IMAGEPROC_X86_SIMD
+  if (depth == 3 && simd != Simd::none)
+    done = interleave3_sse41(planes[0], planes[1], planes[2], output, n);
+#endif
+  for (size_t p = done; p < n; p++)
+    for (size_t d = 0U; d < depth; d++)
+      output[p * depth + d] = planes[d][p];
+}
+
+// Whether every plane is a single-channel image of the size of `image`
+static bool planes_match(ConstImageView image, const ConstImageView planes[]) {
+  for (size_t d = 0U; d < image.channels; d++) {
+    if (planes[d].width != image.width || planes[d].height != image.height ||
+        planes[d].channels != 1U)
+      return false;
+  }
+  return true;
+}
+
+void deinterleave(ConstImageView input, const ImageView planes[],
+                  size_t num_threads) {
+  std::vector<ConstImageView> const_planes(planes, planes + input.channels);
+  Simd simd = get_simd();
+
+  if (!planes_match(input, const_planes.data())) {
+    std::cerr << "Planes should be single-channel and of the input size.\n";
+    return;
+  }
+  parallel_rows(input.height, num_threads, conversion_grain(input.width),
+                [&](size_t row_begin, size_t row_end) {
+    std::vector<unsigned char *> rows(input.channels);
+    for (size_t row = row_begin; row < row_end; row++) {
+      for (size_t d = 0U; d < input.channels; d++)
+        rows[d] = planes[d].data + row * planes[d].stride;
+      deinterleave_row(input.data + row * input.stride, rows.data(),
+                       input.channels, input.width, simd);
+    }
+  });
+}
+
+void interleave(const ConstImageView planes[], ImageView output,
+                size_t num_threads) {
+  Simd simd = get_simd();
+
+  if (!planes_match(output, planes)) {
+    std::cerr << "Planes should be single-channel and of the output size.\n";
+    return;
+  }
+  parallel_rows(output.height, num_threads, conversion_grain(output.width),
+                [&](size_t row_begin, size_t row_end) {
+    std::vector<const unsigned char *> rows(output.channels);
+    for (size_t row = row_begin; row < row_end; row++) {
+      for (size_t d = 0U; d < output.channels; d++)
+        rows[d] = planes[d].data + row * planes[d].stride;
+      interleave_row(rows.data(), output.data + row * output.stride,
+                     output.channels, output.width, simd);
+    }
+  });
+}
+
+void deinterleave(const unsigned char *input, unsigned char *output,
+                  size_t width, size_t height, size_t depth,
+                  size_t num_threads) {
+  std::vector<ImageView> planes;
+
+  for (size_t d = 0U; d < depth; d++)
+    planes.emplace_back(output + d * width * height, width, height, 1U);
+  deinterleave(ConstImageView(input, width, height, depth), planes.data(),
+               num_threads);
+}
+
+void interleave(const unsigned char *input, unsigned char *output,
+                size_t width, size_t height, size_t depth,
+                size_t num_threads) {
+  std::vector<ConstImageView> planes;
+
+  for (size_t d = 0U; d < depth; d++)
+    planes.emplace_back(input + d * width * height, width, height, 1U);
+  interleave(planes.data(), ImageView(output, width, height, depth),
+             num_threads);
+}
+
+void sigma_filter_planar(const unsigned char *input, unsigned char *output,
+                         size_t width, size_t height, size_t depth,
+                         unsigned char sigma, size_t kernel_size,
+                         size_t num_threads, SigmaEngine engine,
+                         AlphaMode alpha) {
+  size_t plane = width * height;
+  // The last plane of 2- and 4-channel images is alpha
+  size_t filtered = depth;
+  if ((depth == 2 || depth == 4) && alpha == AlphaMode::pass_through)
+    filtered--;
+
+  for (size_t d = 0U; d < filtered; d++)
+    sigma_filter(input + d * plane, output + d * plane, width, height, 1U,
+                 sigma, kernel_size, num_threads, engine);
+  if (filtered < depth)
+    memcpy(output + filtered * plane, input + filtered * plane, plane);
+}
+
+void rotate_planar(const unsigned char *input, unsigned char *output,
+                   size_t width, size_t height, size_t depth, float angle,
+                   size_t tile_size, Interpolation interp,
+                   size_t num_threads) {
+  size_t plane = width * height;
+
+  for (size_t d = 0U; d < depth; d++)
+    rotate(input + d * plane, output + d * plane, width, height, 1U, angle,
+           tile_size, interp, num_threads);
+}
+
+void rotate_fxp_planar(const unsigned char *input, unsigned char *output,
+                       size_t width, size_t height, size_t depth, float angle,
+                       size_t tile_size, Interpolation interp,
+                       size_t num_threads) {
+  size_t plane = width * height;
+
+  for (size_t d = 0U; d < depth; d++)
+    rotate_fxp(input + d * plane, output + d * plane, width, height, 1U,
+               angle, tile_size, interp, num_threads);
+}
+
+} /* namespace imageproc */
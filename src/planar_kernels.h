@@ -0,0 +1,21 @@
+#ifndef __PLANAR_KERNELS_H
+#define __PLANAR_KERNELS_H
+
+#include <cstddef>
+
+namespace imageproc {
+
+// Vectorized conversions of the first n pixels of a 3-channel row, return the
+// number of pixels converted (a multiple of the vector width), the remaining
+// ones are left to the scalar code
+size_t deinterleave3_sse41(const unsigned char *input, unsigned char *plane0,
+                           unsigned char *plane1, unsigned char *plane2,
+                           size_t n);
+size_t interleave3_sse41(const unsigned char *plane0,
+                         const unsigned char *plane1,
+                         const unsigned char *plane2, unsigned char *output,
+                         size_t n);
+
+} /* namespace imageproc */
+
+#endif /* __PLANAR_KERNELS_H */
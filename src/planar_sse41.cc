@@ -0,0 +1,89 @@
+// SSE4.1 interleaved <-> planar conversions, this file is compiled with
+// -msse4.1 (the byte shuffles are SSSE3)
+#include <smmintrin.h>
+#include "planar_kernels.h"
+
+namespace imageproc {
+
+// 16 pixels, i.e. 3 vectors of interleaved bytes, per iteration: byte g of
+// the 48 is channel g % 3 of pixel g / 3 and sits in vector g / 16. A shuffle
+// moves the bytes of one channel found in one vector to their place, bytes
+// with a negative mask are cleared so the 3 partial results can be or-ed.
+struct ShuffleMasks {
+  __m128i deinterleave[3][3]; // [channel][interleaved vector]
+  __m128i interleave[3][3];   // [interleaved vector][channel]
+
+  ShuffleMasks() {
+    alignas(16) signed char de[3][3][16], in[3][3][16];
+
+    for (int a = 0; a < 3; a++)
+      for (int b = 0; b < 3; b++)
+        for (int i = 0; i < 16; i++)
+          de[a][b][i] = in[a][b][i] = -128;
+    for (int g = 0; g < 48; g++) {
+      de[g % 3][g / 16][g / 3] = static_cast<signed char>(g % 16);
+      in[g / 16][g % 3][g % 16] = static_cast<signed char>(g / 3);
+    }
+    for (int a = 0; a < 3; a++) {
+      for (int b = 0; b < 3; b++) {
+        deinterleave[a][b] =
+            _mm_load_si128(reinterpret_cast<const __m128i *>(de[a][b]));
+        interleave[a][b] =
+            _mm_load_si128(reinterpret_cast<const __m128i *>(in[a][b]));
+      }
+    }
+  }
+};
+
+static const ShuffleMasks &shuffle_masks() {
+  static const ShuffleMasks masks;
+  return masks;
+}
+
+// Or of the shuffles of v[0..2] by mask[0..2]
+static inline __m128i gather3(const __m128i v[3], const __m128i mask[3]) {
+  return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], mask[0]),
+                                   _mm_shuffle_epi8(v[1], mask[1])),
+                      _mm_shuffle_epi8(v[2], mask[2]));
+}
+
+size_t deinterleave3_sse41(const unsigned char *input, unsigned char *plane0,
+                           unsigned char *plane1, unsigned char *plane2,
+                           size_t n) {
+  const ShuffleMasks &masks = shuffle_masks();
+  unsigned char *planes[3] = { plane0, plane1, plane2 };
+  size_t done = 0U;
+
+  for (; done + 16U <= n; done += 16U) {
+    __m128i v[3];
+    for (int k = 0; k < 3; k++)
+      v[k] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(input + 3U * done + 16U * k));
+    for (int c = 0; c < 3; c++)
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[c] + done),
+                       gather3(v, masks.deinterleave[c]));
+  }
+  return done;
+}
+
+size_t interleave3_sse41(const unsigned char *plane0,
+                         const unsigned char *plane1,
+                         const unsigned char *plane2, unsigned char *output,
+                         size_t n) {
+  const ShuffleMasks &masks = shuffle_masks();
+  size_t done = 0U;
+
+  for (; done + 16U <= n; done += 16U) {
+    __m128i v[3];
+    v[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(plane0 + done));
+    v[1] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(plane1 + done));
+    v[2] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(plane2 + done));
+    for (int k = 0; k < 3; k++)
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i *>(output + 3U * done + 16U * k),
+          gather3(v, masks.interleave[k]));
+  }
+  return done;
+}
+
+} /* namespace imageproc */
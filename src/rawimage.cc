@@ -1,41 +1,143 @@
 #include <iostream>
 #include <memory>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <cstdio>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <Magick++.h>
 
 #include "rawimage.h"
+#include "imageproc.h"
+#include "parallel.h"
 
 namespace rawimage {
 
+// Heap buffer aligned to bufferAlignment, the pointer returned by malloc is
+// kept right before the aligned block
+static void *alignedAlloc(size_t bytes) {
+  void *base = std::malloc(bytes + bufferAlignment + sizeof(void *));
+  if (!base)
+    throw std::bad_alloc();
+  std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(base) + sizeof(void *);
+  addr = (addr + bufferAlignment - 1U) &
+         ~static_cast<std::uintptr_t>(bufferAlignment - 1U);
+  reinterpret_cast<void **>(addr)[-1] = base;
+  return reinterpret_cast<void *>(addr);
+}
+
+static void alignedFree(void *ptr) {
+  if (ptr)
+    std::free(static_cast<void **>(ptr)[-1]);
+}
+
+// Pool requests are rounded up to a multiple of this, so that frames of equal
+// (or nearly equal) size share buffers
+static const size_t poolGranularity = 4096U;
+
+static size_t poolSizeClass(size_t bytes) {
+  return (bytes + poolGranularity - 1U) / poolGranularity * poolGranularity;
+}
+
+BufferPool::BufferPool(size_t _maxCached) : maxCached(_maxCached) {}
+
+BufferPool::~BufferPool() { trim(); }
+
+void *BufferPool::allocate(size_t bytes) {
+  size_t size = poolSizeClass(bytes);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto bucket = freeBuffers.find(size);
+    if (bucket != freeBuffers.end() && !bucket->second.empty()) {
+      void *ptr = bucket->second.back();
+      bucket->second.pop_back();
+      cachedBytes -= size;
+      return ptr;
+    }
+  }
+  return alignedAlloc(size);
+}
+
+void BufferPool::deallocate(void *ptr, size_t bytes) {
+  size_t size = poolSizeClass(bytes);
+
+  if (!ptr)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (0U == maxCached || cachedBytes + size <= maxCached) {
+      freeBuffers[size].push_back(ptr);
+      cachedBytes += size;
+      return;
+    }
+  }
+  alignedFree(ptr);
+}
+
+void BufferPool::trim() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (auto &bucket : freeBuffers)
+    for (void *ptr : bucket.second)
+      alignedFree(ptr);
+  freeBuffers.clear();
+  cachedBytes = 0U;
+}
+
+size_t BufferPool::getCachedBytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return cachedBytes;
+}
+
 RawImage::RawImage(const RawImage::ByteOrder &_byteOrder,
-                   const RawImage::PixFormat &_pixFormat)
-    : byteOrder(_byteOrder), pixFormat(_pixFormat) {}
+                   const RawImage::PixFormat &_pixFormat,
+                   Allocator *_allocator)
+    : byteOrder(_byteOrder), pixFormat(_pixFormat), allocator(_allocator) {}
+
+RawImage::RawImage(RawImage &&orig)
+    : raw(orig.raw), w(orig.w), h(orig.h), capacity(orig.capacity),
+      byteOrder(orig.byteOrder), pixFormat(orig.pixFormat),
+      layout(orig.layout), allocator(orig.allocator), mapping(orig.mapping),
+      mappingSize(orig.mappingSize), readOnly(orig.readOnly),
+      threads(orig.threads) {
+  // the buffer now belongs to this image
+  orig.raw.chr = nullptr;
+  orig.w = 0U;
+  orig.h = 0U;
+  orig.capacity = 0U;
+  orig.mapping = nullptr;
+  orig.mappingSize = 0U;
+  orig.readOnly = false;
+}
 
 RawImage &RawImage::operator=(const RawImage &orig) {
 
   if (this == &orig)
     return *this;
 
-  // before copying anything, make sure there was nothing created before (delete
-  // if it was)
-  wipe();
+  // a buffer of a different pixel format is not reused
+  if (getPixFormat() != orig.getPixFormat())
+    wipe();
   // now we can copy things
   byteOrder = orig.getByteOrder();
   pixFormat = orig.getPixFormat();
+  layout = orig.getLayout();
   // copy raw data only if it has meaningful size
-  if (orig.getW() * orig.getH() * getDepth() * getCompSize()) {
-    w = orig.getW();
-    h = orig.getH();
+  create(orig.getW(), orig.getH(), false);
+  if (getW() && getH()) {
     switch (getPixFormat()) {
     case RawImage::PixFormat::chr:
-      raw.chr = new unsigned char[getW() * getH() * getDepth()];
       memcpy(raw.chr, orig.raw.chr,
              getW() * getH() * getDepth() * sizeof(unsigned char));
       break;
     case RawImage::PixFormat::flo:
-      raw.flo = new float[getW() * getH() * getDepth()];
       memcpy(raw.flo, orig.raw.flo,
              getW() * getH() * getDepth() * sizeof(float));
       break;
@@ -44,41 +146,105 @@ RawImage &RawImage::operator=(const RawImage &orig) {
   return *this;
 }
 
+RawImage &RawImage::operator=(RawImage &&orig) {
+
+  if (this == &orig)
+    return *this;
+
+  wipe();
+  // take over the buffer together with the allocator it came from
+  raw = orig.raw;
+  w = orig.w;
+  h = orig.h;
+  capacity = orig.capacity;
+  byteOrder = orig.byteOrder;
+  pixFormat = orig.pixFormat;
+  layout = orig.layout;
+  allocator = orig.allocator;
+  mapping = orig.mapping;
+  mappingSize = orig.mappingSize;
+  readOnly = orig.readOnly;
+  threads = orig.threads;
+  orig.raw.chr = nullptr;
+  orig.w = 0U;
+  orig.h = 0U;
+  orig.capacity = 0U;
+  orig.mapping = nullptr;
+  orig.mappingSize = 0U;
+  orig.readOnly = false;
+  return *this;
+}
+
 RawImage::~RawImage() { wipe(); }
 
 void RawImage::wipe() {
+  void *buffer = nullptr;
+
   switch (getPixFormat()) {
   case RawImage::PixFormat::chr:
-    if (raw.chr)
-      delete[] raw.chr;
+    buffer = raw.chr;
     raw.chr = nullptr;
     break;
   case RawImage::PixFormat::flo:
-    if (raw.flo)
-      delete[] raw.flo;
+    buffer = raw.flo;
     raw.flo = nullptr;
     break;
   }
+  if (mapping) {
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0U;
+    readOnly = false;
+  } else if (buffer) {
+    if (allocator)
+      allocator->deallocate(buffer, capacity);
+    else
+      alignedFree(buffer);
+  }
   w = 0U;
   h = 0U;
+  capacity = 0U;
 }
 
-void RawImage::create(size_t _w, size_t _h) {
-  // before creating anything, make sure there was nothing created before
-  // (delete if it was)
+void RawImage::reserve(size_t bytes) {
+  void *buffer;
+
+  // a read-only mapping is never written, it is replaced by a new buffer
+  if (bytes <= capacity && !readOnly)
+    return;
   wipe();
+  buffer = allocator ? allocator->allocate(bytes) : alignedAlloc(bytes);
+  switch (getPixFormat()) {
+  case RawImage::PixFormat::chr:
+    raw.chr = static_cast<unsigned char *>(buffer);
+    break;
+  case RawImage::PixFormat::flo:
+    raw.flo = static_cast<float *>(buffer);
+    break;
+  }
+  capacity = bytes;
+}
+
+void RawImage::create(size_t _w, size_t _h, bool zero) {
+  size_t bytes = _w * _h * getDepth() * getCompSize();
+
   // create anything only if it has meaningful size
-  if (_w * _h * getDepth() * getCompSize()) {
-    w = _w;
-    h = _h;
+  if (!bytes) {
+    wipe();
+    return;
+  }
+  // the current buffer is kept when large enough, the heap (or the
+  // allocator) is only hit when the image grows
+  reserve(bytes);
+  w = _w;
+  h = _h;
+  if (zero) {
     switch (getPixFormat()) {
     case RawImage::PixFormat::chr:
-      raw.chr = new unsigned char[getW() * getH() * getDepth()];
-      memset(raw.chr, 0, getW() * getH() * getDepth() * sizeof(unsigned char));
+      memset(raw.chr, 0, bytes);
       break;
     case RawImage::PixFormat::flo:
-      raw.flo = new float[getW() * getH() * getDepth()];
-      memset(raw.flo, 0, getW() * getH() * getDepth() * sizeof(float));
+      memset(raw.flo, 0, bytes);
       break;
     }
   }
@@ -87,7 +253,7 @@ void RawImage::create(size_t _w, size_t _h) {
 void RawImage::readImpl(const char *fname) {
   Magick::Image mimg(fname);
 
-  create(mimg.columns(), mimg.rows());
+  create(mimg.columns(), mimg.rows(), false); // fully written below
   switch (getPixFormat()) {
   case RawImage::PixFormat::chr:
     if (raw.chr)
@@ -103,6 +269,10 @@ void RawImage::readImpl(const char *fname) {
 }
 
 void RawImage::read(const char *fname) {
+  Layout target = getLayout();
+
+  // decoders write interleaved pixels
+  layout = Layout::interleaved;
   if (RawImage::ByteOrder::gray == getByteOrder()) {
     byteOrder = RawImage::ByteOrder::rgb;
     readImpl(fname);
@@ -110,27 +280,36 @@ void RawImage::read(const char *fname) {
   } else {
     readImpl(fname);
   }
+  setLayout(target);
 }
 
+// RGB copies of gray images handed to the encoder, kept per thread and
+// reused by the next saves (they grow to the largest gray image saved)
+static thread_local std::vector<unsigned char> grayExpansionChr;
+static thread_local std::vector<float> grayExpansionFlo;
+
 void RawImage::save(const char *fname) const {
   size_t imgSize = getW() * getH();
 
+  if (Layout::planar == getLayout() && getDepth() > 1U) {
+    RawImage interleaved;
+    interleaved = *this;
+    interleaved.setLayout(Layout::interleaved);
+    interleaved.save(fname);
+    return;
+  }
+
   switch (getPixFormat()) {
   case RawImage::PixFormat::chr:
     if (raw.chr) {
       if (RawImage::ByteOrder::gray == getByteOrder()) {
-        unsigned char *chr = new unsigned char[getW() * getH() * 3U];
-        unsigned char *ptr = chr;
-
-        for (size_t u = 0U; u < imgSize; u++) {
-          ptr[0] = raw.chr[u];
-          ptr[1] = raw.chr[u];
-          ptr[2] = raw.chr[u];
-          ptr += 3U;
-        }
-        Magick::Image img(getW(), getH(), "RGB", Magick::CharPixel, chr);
+        if (grayExpansionChr.size() < imgSize * 3U)
+          grayExpansionChr.resize(imgSize * 3U);
+        imageproc::gray_to_rgb(raw.chr, grayExpansionChr.data(), getW(),
+                               getH(), getThreads());
+        Magick::Image img(getW(), getH(), "RGB", Magick::CharPixel,
+                          grayExpansionChr.data());
         img.write(fname);
-        delete[] chr;
       } else {
         Magick::Image img(getW(), getH(), getByteMap(), Magick::CharPixel,
                           raw.chr);
@@ -141,18 +320,13 @@ void RawImage::save(const char *fname) const {
   case RawImage::PixFormat::flo:
     if (raw.flo) {
       if (RawImage::ByteOrder::gray == getByteOrder()) {
-        float *flo = new float[getW() * getH() * 3U];
-        float *ptr = flo;
-
-        for (size_t u = 0U; u < imgSize; u++) {
-          ptr[0] = raw.flo[u];
-          ptr[1] = raw.flo[u];
-          ptr[2] = raw.flo[u];
-          ptr += 3U;
-        }
-        Magick::Image img(getW(), getH(), "RGB", Magick::FloatPixel, flo);
+        if (grayExpansionFlo.size() < imgSize * 3U)
+          grayExpansionFlo.resize(imgSize * 3U);
+        imageproc::gray_to_rgb(raw.flo, grayExpansionFlo.data(), getW(),
+                               getH(), getThreads());
+        Magick::Image img(getW(), getH(), "RGB", Magick::FloatPixel,
+                          grayExpansionFlo.data());
         img.write(fname);
-        delete[] flo;
       } else {
         Magick::Image img(getW(), getH(), getByteMap(), Magick::FloatPixel,
                           raw.flo);
@@ -163,37 +337,253 @@ void RawImage::save(const char *fname) const {
   }
 }
 
-void RawImage::toGray() {
-  size_t imgSize = getW() * getH();
+// Raw frame file header, see rawimage.h
+static const char rawMagic[8] = { 'R', 'A', 'W', 'F', 'R', 'A', 'M', 'E' };
+static const size_t rawHeaderSize = 64U;
+
+static void putLE(unsigned char *ptr, std::uint64_t value, size_t bytes) {
+  for (size_t u = 0U; u < bytes; u++)
+    ptr[u] = static_cast<unsigned char>(value >> (8U * u));
+}
+
+static std::uint64_t getLE(const unsigned char *ptr, size_t bytes) {
+  std::uint64_t value = 0U;
+
+  for (size_t u = 0U; u < bytes; u++)
+    value |= static_cast<std::uint64_t>(ptr[u]) << (8U * u);
+  return value;
+}
+
+bool RawImage::saveRaw(const char *fname) const {
+  unsigned char header[rawHeaderSize] = {};
+  size_t dataBytes = getW() * getH() * getDepth() * getCompSize();
+  size_t rowBytes = (Layout::planar == getLayout())
+                        ? getW() * getCompSize()
+                        : getW() * getDepth() * getCompSize();
+
+  memcpy(header, rawMagic, sizeof(rawMagic));
+  putLE(header + 8, rawHeaderSize, 4U);
+  putLE(header + 12, static_cast<std::uint64_t>(getByteOrder()), 4U);
+  putLE(header + 16, static_cast<std::uint64_t>(getPixFormat()), 4U);
+  putLE(header + 20, static_cast<std::uint64_t>(getLayout()), 4U);
+  putLE(header + 24, getW(), 8U);
+  putLE(header + 32, getH(), 8U);
+  putLE(header + 40, rowBytes, 8U);
+
+  FILE *file = fopen(fname, "wb");
+  if (!file) {
+    std::cerr << "Cannot open " << fname << " for writing.\n";
+    return false;
+  }
+  bool written = fwrite(header, 1U, rawHeaderSize, file) == rawHeaderSize &&
+                 (!dataBytes || fwrite(raw.chr, 1U, dataBytes, file) ==
+                                    dataBytes);
+  if (fclose(file) || !written) {
+    std::cerr << "Cannot write " << fname << ".\n";
+    return false;
+  }
+  return true;
+}
+
+void RawImage::mapRaw(const char *fname, MapMode mode) {
+  struct stat st;
+  void *base = MAP_FAILED;
+  size_t fileSize = 0U;
+  int fd = open(fname, O_RDONLY);
+
+  wipe();
+  if (fd < 0) {
+    std::cerr << "Cannot open " << fname << ".\n";
+    return;
+  }
+  if (!fstat(fd, &st) && static_cast<size_t>(st.st_size) >= rawHeaderSize) {
+    fileSize = st.st_size;
+    // copy-on-write: private mapping, written pages never reach the file
+    if (MapMode::readOnly == mode)
+      base = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    else
+      base = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                  0);
+  }
+  close(fd); // the mapping keeps the file alive
+  if (MAP_FAILED == base) {
+    if (fileSize)
+      std::cerr << "Cannot map " << fname << ".\n";
+    else
+      std::cerr << fname << " is not a raw frame file.\n";
+    return;
+  }
+
+  const unsigned char *header = static_cast<unsigned char *>(base);
+  size_t headerSize = getLE(header + 8, 4U);
+  std::uint64_t fileByteOrder = getLE(header + 12, 4U);
+  std::uint64_t filePixFormat = getLE(header + 16, 4U);
+  std::uint64_t fileLayout = getLE(header + 20, 4U);
+  size_t fileW = getLE(header + 24, 8U);
+  size_t fileH = getLE(header + 32, 8U);
+  size_t stride = getLE(header + 40, 8U);
+  // pixels start on a buffer boundary as in every other image
+  bool valid = !memcmp(header, rawMagic, sizeof(rawMagic)) &&
+               headerSize >= rawHeaderSize && headerSize <= fileSize &&
+               !(headerSize % bufferAlignment) && fileByteOrder <= 2U &&
+               filePixFormat <= 1U && fileLayout <= 1U;
+
+  if (valid) {
+    // the image keeps its type until the whole header is known to be valid
+    RawImage type(static_cast<ByteOrder>(fileByteOrder),
+                  static_cast<PixFormat>(filePixFormat));
+    size_t depth = type.getDepth(), compSize = type.getCompSize();
+    // the rows of all planes one after the other for planar images
+    bool planar = static_cast<Layout>(fileLayout) == Layout::planar;
+    // sizes must not wrap around
+    valid = fileW <= SIZE_MAX / (depth * compSize) &&
+            fileH <= SIZE_MAX / depth;
+    size_t rowBytes =
+        valid ? fileW * (planar ? 1U : depth) * compSize : 0U;
+    size_t fileRows = valid ? fileH * (planar ? depth : 1U) : 0U;
+    bool empty = !rowBytes || !fileRows;
+    // rows must fit in the file
+    valid = valid && stride >= rowBytes &&
+            (empty || (fileRows <= SIZE_MAX / stride &&
+                       fileSize - headerSize >= rowBytes &&
+                       (fileSize - headerSize - rowBytes) / stride >=
+                           fileRows - 1U));
+    if (valid) {
+      byteOrder = type.byteOrder;
+      pixFormat = type.pixFormat;
+      layout = static_cast<Layout>(fileLayout);
+    }
+    if (valid && !empty && stride == rowBytes) {
+      // the mapping is the pixel buffer
+      mapping = base;
+      mappingSize = fileSize;
+      readOnly = MapMode::readOnly == mode;
+      raw.chr = static_cast<unsigned char *>(base) + headerSize;
+      w = fileW;
+      h = fileH;
+      capacity = rowBytes * fileRows;
+      return;
+    }
+    if (valid && !empty) {
+      // padded rows, copied into a packed buffer
+      create(fileW, fileH, false);
+      for (size_t row = 0U; row < fileRows; row++)
+        memcpy(raw.chr + row * rowBytes, header + headerSize + row * stride,
+               rowBytes);
+    }
+  }
+  munmap(base, fileSize);
+  if (!valid)
+    std::cerr << fname << " is not a raw frame file.\n";
+}
+
+bool RawImage::isMapped() const { return mapping != nullptr; }
 
+void RawImage::toGray() {
   if (3U > getDepth())
     return;
+  bool planar = Layout::planar == getLayout();
+  // The conversion only runs on several threads out of place, and a
+  // read-only mapping must not be written
+  if ((readOnly || (!planar && getThreads() != 1U)) && getW() && getH()) {
+    RawImage converted(RawImage::ByteOrder::gray, getPixFormat(), allocator);
+
+    converted.create(getW(), getH(), false);
+    converted.setThreads(getThreads());
+    converted.layout = getLayout();
+    if (RawImage::PixFormat::chr == getPixFormat()) {
+      if (planar)
+        imageproc::to_gray_planar(raw.chr, converted.raw.chr, getW(), getH());
+      else
+        imageproc::to_gray(raw.chr, converted.raw.chr, getW(), getH(),
+                           getDepth(), getThreads());
+    } else {
+      if (planar)
+        imageproc::to_gray_planar(raw.flo, converted.raw.flo, getW(), getH());
+      else
+        imageproc::to_gray(raw.flo, converted.raw.flo, getW(), getH(),
+                           getDepth(), getThreads());
+    }
+    *this = std::move(converted);
+    return;
+  }
   // NOTE that no new array is allocated for the gray image, current one is
   // reused, some of it will be just left unused
   switch (getPixFormat()) {
   case RawImage::PixFormat::chr:
     if (raw.chr) {
-      unsigned char *ptr = raw.chr;
-      for (size_t u = 0U; u < imgSize; u++) {
-        raw.chr[u] = static_cast<unsigned char>(
-            (ptr[2] * 0.3) + (ptr[1] * 0.59) + (ptr[0] * 0.11));
-        ptr += getDepth();
-      }
+      if (planar)
+        imageproc::to_gray_planar(raw.chr, raw.chr, getW(), getH());
+      else
+        imageproc::to_gray(raw.chr, raw.chr, getW(), getH(), getDepth());
     }
     break;
   case RawImage::PixFormat::flo:
     if (raw.flo) {
-      float *ptr = raw.flo;
-      for (size_t u = 0U; u < imgSize; u++) {
-        raw.flo[u] = (ptr[2] * 0.3) + (ptr[1] * 0.59) + (ptr[0] * 0.11);
-        ptr += getDepth();
-      }
+      if (planar)
+        imageproc::to_gray_planar(raw.flo, raw.flo, getW(), getH());
+      else
+        imageproc::to_gray(raw.flo, raw.flo, getW(), getH(), getDepth());
     }
     break;
   }
   byteOrder = RawImage::ByteOrder::gray;
 }
 
+RawImage::Layout RawImage::getLayout() const { return layout; }
+
+// Scalar layout conversion of pixels [first, last) of float images
+template <typename T>
+static void convertLayout(const T *src, T *dst, size_t pixels, size_t depth,
+                          bool toPlanar, size_t first, size_t last) {
+  for (size_t u = first; u < last; u++) {
+    for (size_t d = 0U; d < depth; d++) {
+      if (toPlanar)
+        dst[d * pixels + u] = src[u * depth + d];
+      else
+        dst[u * depth + d] = src[d * pixels + u];
+    }
+  }
+}
+
+void RawImage::setLayout(Layout _layout) {
+  if (_layout == getLayout())
+    return;
+  // a single channel is stored the same way in both layouts
+  if (getW() && getH() && getDepth() > 1U) {
+    RawImage converted(getByteOrder(), getPixFormat(), allocator);
+    bool toPlanar = Layout::planar == _layout;
+
+    converted.create(getW(), getH(), false);
+    converted.setThreads(getThreads());
+    switch (getPixFormat()) {
+    case RawImage::PixFormat::chr:
+      if (toPlanar)
+        imageproc::deinterleave(raw.chr, converted.raw.chr, getW(), getH(),
+                                getDepth(), getThreads());
+      else
+        imageproc::interleave(raw.chr, converted.raw.chr, getW(), getH(),
+                              getDepth(), getThreads());
+      break;
+    case RawImage::PixFormat::flo:
+      imageproc::parallel_rows(
+          getH(), getThreads(), imageproc::conversion_grain(getW()),
+          [&](size_t rowBegin, size_t rowEnd) {
+            convertLayout(raw.flo, converted.raw.flo, getW() * getH(),
+                          getDepth(), toPlanar, rowBegin * getW(),
+                          rowEnd * getW());
+          });
+      break;
+    }
+    *this = std::move(converted);
+  }
+  layout = _layout;
+}
+
+void RawImage::setThreads(size_t _threads) { threads = _threads; }
+
+size_t RawImage::getThreads() const { return threads; }
+
 size_t RawImage::getW() const { return w; }
 
 size_t RawImage::getH() const { return h; }
@@ -236,31 +626,37 @@ size_t RawImage::getCompSize() const {
   return 0U;
 }
 
+size_t RawImage::getCapacity() const { return capacity; }
+
 std::unique_ptr<RawImage>
 RawImage::imgFactory(size_t w, size_t h, const RawImage::ByteOrder &byteOrder,
-                     const RawImage::PixFormat &pixFormat) {
-  std::unique_ptr<RawImage> img(new RawImage(byteOrder, pixFormat));
+                     const RawImage::PixFormat &pixFormat,
+                     Allocator *allocator) {
+  std::unique_ptr<RawImage> img(new RawImage(byteOrder, pixFormat, allocator));
 
   img->create(w, h);
   return img;
 }
 
 std::ostream &operator<<(std::ostream &os, const RawImage &img) {
+  bool planar = RawImage::Layout::planar == img.getLayout();
+  size_t pixels = img.getW() * img.getH();
+
   for (size_t row = 0U; row < img.getH(); row++) {
     for (size_t col = 0U; col < img.getW(); col++) {
       os << col << '\t' << row << '\t';
       for (size_t component = 0U; component < img.getDepth(); component++) {
+        size_t pix = row * img.getW() + col;
+        size_t idx = planar ? component * pixels + pix
+                            : pix * img.getDepth() + component;
         switch (img.getPixFormat()) {
         case RawImage::PixFormat::chr:
           if (img.raw.chr)
-            os << static_cast<unsigned>(
-                      img.raw.chr[(row * (img.getW() * img.getDepth())) +
-                                  (col * img.getDepth()) + component]) << '\t';
+            os << static_cast<unsigned>(img.raw.chr[idx]) << '\t';
           break;
         case RawImage::PixFormat::flo:
           if (img.raw.flo)
-            os << img.raw.flo[(row * (img.getW() * img.getDepth())) +
-                              (col * img.getDepth()) + component] << '\t';
+            os << img.raw.flo[idx] << '\t';
           break;
         }
       }
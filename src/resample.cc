@@ -0,0 +1,67 @@
+#include <cmath>
+#include "imageproc.h"
+#include "resample_kernels.h"
+
+namespace imageproc {
+
+// Keys cubic convolution with a = -0.5 (Catmull-Rom), interpolating and exact
+// for quadratics
+static double cubic(double x) {
+  const double a = -0.5;
+  x = std::fabs(x);
+  if (x < 1.)
+    return ((a + 2.) * x - (a + 3.)) * x * x + 1.;
+  if (x < 2.)
+    return ((a * x - 5. * a) * x + 8. * a) * x - 4. * a;
+  return 0.;
+}
+
+// sinc(x) * sinc(x / 3) within 3 pixels
+static double lanczos3(double x) {
+  const double pi = 3.14159265358979323846;
+  if (x == 0.)
+    return 1.;
+  if (std::fabs(x) >= 3.)
+    return 0.;
+  double px = pi * x;
+  return 3. * std::sin(px) * std::sin(px / 3.) / (px * px);
+}
+
+static ResampleTable make_table(int taps, double (*filter)(double)) {
+  const int one = 1 << resample_weight_bits;
+  int before = taps / 2 - 1;
+  ResampleTable table;
+
+  table.taps = taps;
+  for (int p = 0; p <= resample_phases; p++) {
+    double fract = static_cast<double>(p) / resample_phases;
+    double w[6] = {}, total = 0.;
+    int fixed_total = 0, largest = 0;
+
+    for (int k = 0; k < taps; k++) {
+      // Tap k is pixel floor(position) - before + k
+      w[k] = filter(k - before - fract);
+      total += w[k];
+    }
+    for (int k = 0; k < 6; k++) {
+      table.weight[p][k] = static_cast<float>(w[k] / total);
+      table.fixed[p][k] =
+          static_cast<std::int32_t>(std::lround(w[k] / total * one));
+      fixed_total += table.fixed[p][k];
+      if (table.fixed[p][k] > table.fixed[p][largest])
+        largest = k;
+    }
+    // Rounding leftover on the largest weight, so that flat areas stay flat
+    table.fixed[p][largest] += one - fixed_total;
+  }
+  return table;
+}
+
+const ResampleTable &resample_table(Interpolation interp) {
+  static const ResampleTable bicubic = make_table(4, cubic);
+  static const ResampleTable lanczos = make_table(6, lanczos3);
+
+  return interp == Interpolation::lanczos3 ? lanczos : bicubic;
+}
+
+} /* namespace imageproc */
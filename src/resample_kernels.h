@@ -0,0 +1,300 @@
+#ifndef __RESAMPLE_KERNELS_H
+#define __RESAMPLE_KERNELS_H
+
+#include <cstdint>
+#include <limits>
+#include "rotation_kernels.h"
+
+namespace imageproc {
+
+// Bicubic and Lanczos-3 rotation. Both filters are separable: a destination
+// pixel is
+//   sum_r w(fr)[r] * sum_c w(fc)[c] * src[r][c]
+// over the Taps x Taps source pixels around its source position, where fr and
+// fc are the fractional parts of the position. The fractions are quantized to
+// 1/resample_phases pixel (exactly the FR_BITS fraction of the fixed-point
+// coordinates) and the weights of every phase are tabulated once, so no
+// filter is evaluated per pixel.
+
+static const int resample_phases = ONE_FIXP;
+// Fixed-point weights of each phase sum to exactly 1 << resample_weight_bits
+static const int resample_weight_bits = 12;
+
+struct ResampleTable {
+  int taps; // 4 (bicubic) or 6 (lanczos3), starting taps / 2 - 1 pixels
+            // before the integer part of the position
+  // Weights of phase p (fraction p / resample_phases), normalized to sum 1.
+  // The float kernels round the fraction to the nearest phase, hence the
+  // extra phase for 1.
+  float weight[resample_phases + 1][6];
+  std::int32_t fixed[resample_phases + 1][6];
+};
+
+// Built on first use
+const ResampleTable &resample_table(Interpolation interp);
+
+// Filtered value as a pixel: rounded to nearest and clamped to the pixel
+// range for integer pixels, as it is for floats
+template <typename Pixel> inline Pixel resampled(float value) {
+  const float max = static_cast<float>(std::numeric_limits<Pixel>::max());
+  return static_cast<Pixel>(std::min(max, std::max(0.f, value)) + .5f);
+}
+
+template <> inline float resampled<float>(float value) { return value; }
+
+// Destination columns [col_begin, col_end) of `row`, interpolated with the
+// Taps x Taps filter of `table`. The source position of every column is
+// computed as in rotate_span(). Without Edge the whole support must lie
+// inside of the input (the span of rotate_row_span() with margin Taps / 2 -
+// 1); with Edge source pixels outside of it are the ones standing for them
+// under edge.mode (see border_index()), or edge.value for constant.
+template <size_t Depth, size_t Taps, bool Edge, typename Pixel>
+inline void rotate_resample_span(const Frame<const Pixel> &in,
+                                 const Frame<Pixel> &out, int row,
+                                 const RowSpan<float> &span,
+                                 const ResampleTable &table,
+                                 const Border &edge, int col_begin,
+                                 int col_end) {
+  const int before = Taps / 2 - 1;
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+  Pixel *out_row = byte_offset(out.data, row * out.stride);
+
+  for (int col = col_begin; col < col_end; col++) {
+    float idx_fract[2], idx_fract_round[2];
+    int phase[2];
+
+    for (int k = 0; k < 2; k++) {
+      idx_fract[k] = span.start[k] + static_cast<float>(col) * span.step[k];
+      idx_fract_round[k] = floorf(idx_fract[k]);
+      phase[k] = static_cast<int>((idx_fract[k] - idx_fract_round[k]) *
+                                      resample_phases +
+                                  .5f);
+    }
+    // Top left pixel of the support
+    int src_row = static_cast<int>(idx_fract_round[0]) + half_height - before;
+    int src_col = static_cast<int>(idx_fract_round[1]) + half_width - before;
+    const float *w_row = table.weight[phase[0]];
+    const float *w_col = table.weight[phase[1]];
+
+    // Offsets of the support columns within a row, -1 for edge.value
+    int cols[Taps];
+    for (int c = 0; c < static_cast<int>(Taps); c++) {
+      int src = src_col + c;
+      if (Edge)
+        src = border_index(edge.mode, src, in.width);
+      cols[c] = (Edge && src < 0) ? -1 : src * static_cast<int>(Depth);
+    }
+
+    float sum[Depth] = {};
+    for (int r = 0; r < static_cast<int>(Taps); r++) {
+      int src = src_row + r;
+      if (Edge)
+        src = border_index(edge.mode, src, in.height);
+      const Pixel *src_pix =
+          (Edge && src < 0) ? nullptr : byte_offset(in.data, src * in.stride);
+
+      float h_sum[Depth] = {};
+      for (int c = 0; c < static_cast<int>(Taps); c++) {
+        // Will be unrolled by the compiler:
+        for (int d = 0; d < Depth; d++)
+          h_sum[d] += w_col[c] * (!Edge || (src_pix && cols[c] >= 0)
+                                      ? static_cast<float>(src_pix[cols[c] + d])
+                                      : static_cast<float>(edge.value));
+      }
+      for (int d = 0; d < Depth; d++)
+        sum[d] += w_row[r] * h_sum[d];
+    }
+
+    for (int d = 0; d < Depth; d++)
+      out_row[col * Depth + d] = resampled<Pixel>(sum[d]);
+  }
+}
+
+// Fixed-point counterpart of rotate_resample_span(), the source coordinates
+// are stepped as in rotate_fxp_span() and their fraction is the phase. The
+// rows are summed with resample_weight_bits weights into 64 bits, which
+// Lanczos-3 can exceed 32 bits in.
+template <size_t Depth, size_t Taps, bool Edge>
+inline void rotate_fxp_resample_span(const Frame<const unsigned char> &in,
+                                     const Frame<unsigned char> &out, int row,
+                                     const RowSpan<int> &span,
+                                     const ResampleTable &table,
+                                     const Border &edge, int col_begin,
+                                     int col_end) {
+  const int before = Taps / 2 - 1;
+  const int shift = 2 * resample_weight_bits;
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+  unsigned char *out_row = out.data + row * out.stride;
+  int idx_fract[2];
+
+  idx_fract[0] = span.start[0] + col_begin * span.step[0];
+  idx_fract[1] = span.start[1] + col_begin * span.step[1];
+
+  for (int col = col_begin; col < col_end; col++) {
+    int src_row = (idx_fract[0] >> FR_BITS) + half_height - before;
+    int src_col = (idx_fract[1] >> FR_BITS) + half_width - before;
+    const std::int32_t *w_row = table.fixed[idx_fract[0] & (ONE_FIXP - 1)];
+    const std::int32_t *w_col = table.fixed[idx_fract[1] & (ONE_FIXP - 1)];
+
+    int cols[Taps];
+    for (int c = 0; c < static_cast<int>(Taps); c++) {
+      int src = src_col + c;
+      if (Edge)
+        src = border_index(edge.mode, src, in.width);
+      cols[c] = (Edge && src < 0) ? -1 : src * static_cast<int>(Depth);
+    }
+
+    std::int64_t sum[Depth] = {};
+    for (int r = 0; r < static_cast<int>(Taps); r++) {
+      int src = src_row + r;
+      if (Edge)
+        src = border_index(edge.mode, src, in.height);
+      const unsigned char *src_pix =
+          (Edge && src < 0) ? nullptr : in.data + src * in.stride;
+
+      std::int32_t h_sum[Depth] = {};
+      for (int c = 0; c < static_cast<int>(Taps); c++) {
+        for (int d = 0; d < Depth; d++)
+          h_sum[d] += w_col[c] * (!Edge || (src_pix && cols[c] >= 0)
+                                      ? src_pix[cols[c] + d]
+                                      : edge.value);
+      }
+      for (int d = 0; d < Depth; d++)
+        sum[d] += static_cast<std::int64_t>(w_row[r]) * h_sum[d];
+    }
+
+    for (int d = 0; d < Depth; d++) {
+      std::int64_t value = (sum[d] + (std::int64_t(1) << (shift - 1))) >> shift;
+      out_row[col * Depth + d] = static_cast<unsigned char>(
+          std::min<std::int64_t>(255, std::max<std::int64_t>(0, value)));
+    }
+
+    idx_fract[0] += span.step[0];
+    idx_fract[1] += span.step[1];
+  }
+}
+
+// Splits [span.col_begin, span.col_end) into the columns of `inner` (the span
+// whose whole support is inside of the input), filtered without bounds
+// checks, and the ones on either side, filtered with edge pixels.
+// Span(first, last) filters columns [first, last) with or without them.
+template <typename T, typename ClampedSpan, typename InnerSpan>
+inline void resample_span_parts(const RowSpan<T> &span,
+                                const RowSpan<T> &inner, ClampedSpan clamped,
+                                InnerSpan unclamped) {
+  int begin = std::min(std::max(inner.col_begin, span.col_begin),
+                       span.col_end);
+  int end = std::min(std::max(inner.col_end, begin), span.col_end);
+
+  if (span.col_begin < begin)
+    clamped(span.col_begin, begin);
+  if (begin < end)
+    unclamped(begin, end);
+  if (end < span.col_end)
+    clamped(end, span.col_end);
+}
+
+// Source pixels of the support outside of the input: the nearest edge pixels
+// within the span of the bilinear rotation with BorderMode::clip, given by
+// the border mode otherwise
+inline Border resample_edge(const Border &border) {
+  if (border.mode == BorderMode::clip)
+    return Border(BorderMode::replicate, border.value);
+  return border;
+}
+
+// rotate() of destination rows [row_begin, row_end) with the filter of
+// `table`. With BorderMode::clip the destination pixels are the ones of the
+// bilinear rotation, the other modes interpolate all of the pixels whose
+// support touches the input (see rotate_outside()).
+template <size_t Depth, size_t Taps, typename Pixel>
+inline void rotate_resample(const Frame<const Pixel> &in,
+                            const Frame<Pixel> &out, float sin_th,
+                            float cos_th, size_t tile_size,
+                            const ResampleTable &table, const Border &border,
+                            int row_begin, int row_end) {
+  const int margin = Taps / 2 - 1;
+  Border edge = resample_edge(border);
+
+  rotate_rows<float>(
+      out, tile_size, row_begin, row_end,
+      [&](int row) { return rotate_row_span(in, out, row, sin_th, cos_th); },
+      [&](int row, const RowSpan<float> &span) {
+        RowSpan<float> inner =
+            rotate_row_span(in, out, row, sin_th, cos_th, margin);
+        resample_span_parts(
+            span, inner,
+            [&](int first, int last) {
+              rotate_resample_span<Depth, Taps, true>(in, out, row, span,
+                                                      table, edge, first,
+                                                      last);
+            },
+            [&](int first, int last) {
+              rotate_resample_span<Depth, Taps, false>(in, out, row, span,
+                                                       table, edge, first,
+                                                       last);
+            });
+      },
+      [&](int row, const RowSpan<float> &span) {
+        rotate_outside<float, Depth>(
+            out, row, span, border,
+            [&](int r) {
+              return rotate_row_span(in, out, r, sin_th, cos_th,
+                                     -static_cast<int>(Taps / 2));
+            },
+            [&](int first, int last) {
+              rotate_resample_span<Depth, Taps, true>(in, out, row, span,
+                                                      table, edge, first,
+                                                      last);
+            });
+      });
+}
+
+template <size_t Depth, size_t Taps>
+inline void rotate_fxp_resample(const Frame<const unsigned char> &in,
+                                const Frame<unsigned char> &out, int sin_th,
+                                int cos_th, size_t tile_size,
+                                const ResampleTable &table,
+                                const Border &border, int row_begin,
+                                int row_end) {
+  const int margin = Taps / 2 - 1;
+  Border edge = resample_edge(border);
+
+  rotate_rows<int>(
+      out, tile_size, row_begin, row_end,
+      [&](int row) {
+        return rotate_fxp_row_span(in, out, row, sin_th, cos_th);
+      },
+      [&](int row, const RowSpan<int> &span) {
+        RowSpan<int> inner =
+            rotate_fxp_row_span(in, out, row, sin_th, cos_th, margin);
+        resample_span_parts(
+            span, inner,
+            [&](int first, int last) {
+              rotate_fxp_resample_span<Depth, Taps, true>(
+                  in, out, row, span, table, edge, first, last);
+            },
+            [&](int first, int last) {
+              rotate_fxp_resample_span<Depth, Taps, false>(
+                  in, out, row, span, table, edge, first, last);
+            });
+      },
+      [&](int row, const RowSpan<int> &span) {
+        rotate_outside<int, Depth>(
+            out, row, span, border,
+            [&](int r) {
+              return rotate_fxp_row_span(in, out, r, sin_th, cos_th,
+                                         -static_cast<int>(Taps / 2));
+            },
+            [&](int first, int last) {
+              rotate_fxp_resample_span<Depth, Taps, true>(
+                  in, out, row, span, table, edge, first, last);
+            });
+      });
+}
+
+} /* namespace imageproc */
+
+#endif /* __RESAMPLE_KERNELS_H */
@@ -1,90 +1,285 @@
 #include <cmath>
+#include <algorithm>
 #include "imageproc.h"
+#include "parallel.h"
+#include "resample_kernels.h"
 
 namespace imageproc {
 
-// Forward declaration
-template <size_t Depth>
-static void rotate(const unsigned char *input, unsigned char *output,
-                   size_t width, size_t height, float angle);
+// Forward declarations, rotate() rotates destination rows [row_begin,
+// row_end)
+template <size_t Depth, typename Pixel>
+static void rotate(const Frame<const Pixel> &in, const Frame<Pixel> &out,
+                   float angle, size_t tile_size, Interpolation interp,
+                   const Border &border, int row_begin, int row_end);
+
+template <size_t Depth, typename Pixel>
+static void rotate_parallel(const Frame<const Pixel> &in,
+                            const Frame<Pixel> &out, float angle,
+                            size_t tile_size, Interpolation interp,
+                            const Border &border, size_t num_threads);
+
+template <typename Pixel>
+static void rotate_wide(const Pixel *input, Pixel *output, size_t width,
+                        size_t height, size_t depth, float angle,
+                        size_t tile_size, Interpolation interp,
+                        size_t num_threads);
 
 void rotate(const unsigned char *input, unsigned char *output, size_t width,
-            size_t height, size_t depth, float angle) {
-  if (depth == 1) {
-    rotate<1U>(input, output, width, height, angle);
-  } else if (depth == 3) {
-    rotate<3U>(input, output, width, height, angle);
+            size_t height, size_t depth, float angle, size_t tile_size,
+            Interpolation interp, size_t num_threads) {
+  rotate(input, width, height, 0U, output, width, height, 0U, depth, angle,
+         tile_size, interp, num_threads);
+}
+
+void rotate(const unsigned char *input, size_t in_width, size_t in_height,
+            size_t in_stride, unsigned char *output, size_t out_width,
+            size_t out_height, size_t out_stride, size_t depth,
+            float angle, size_t tile_size, Interpolation interp,
+            size_t num_threads) {
+  rotate(ConstImageView(input, in_width, in_height, depth, in_stride),
+         ImageView(output, out_width, out_height, depth, out_stride), angle,
+         tile_size, interp, num_threads);
+}
+
+void rotate(ConstImageView input, ImageView output, float angle,
+            size_t tile_size, Interpolation interp, size_t num_threads,
+            const Border &border) {
+  Frame<const unsigned char> in = make_frame(input);
+  Frame<unsigned char> out = make_frame(output);
+  Border frame_border = border;
+
+  // The padded input is rotated as a whole, its center is the same
+  if (border.mode == BorderMode::padded) {
+    in = padded_frame(in, input.channels, border.padding);
+    frame_border.mode = BorderMode::clip;
+  }
+
+  if (input.channels != output.channels) {
+    std::cerr << "Input and output should have the same number of channels.\n";
+  } else if (input.channels == 1) {
+    rotate_parallel<1U>(in, out, angle, tile_size, interp, frame_border,
+                        num_threads);
+  } else if (input.channels == 2) {
+    rotate_parallel<2U>(in, out, angle, tile_size, interp, frame_border,
+                        num_threads);
+  } else if (input.channels == 3) {
+    rotate_parallel<3U>(in, out, angle, tile_size, interp, frame_border,
+                        num_threads);
+  } else if (input.channels == 4) {
+    rotate_parallel<4U>(in, out, angle, tile_size, interp, frame_border,
+                        num_threads);
   } else {
-    std::cerr << "Depth should be either 1 (grayscale) or 3 (rgb).\n";
+    std::cerr << "Depth should be 1 (grayscale), 2 (grayscale + alpha), 3 "
+                 "(rgb) or 4 (rgba).\n";
+  }
+}
+
+void rotate(const std::uint16_t *input, std::uint16_t *output, size_t width,
+            size_t height, size_t depth, float angle, size_t tile_size,
+            Interpolation interp, size_t num_threads) {
+  rotate_wide(input, output, width, height, depth, angle, tile_size, interp,
+              num_threads);
+}
+
+void rotate(const float *input, float *output, size_t width, size_t height,
+            size_t depth, float angle, size_t tile_size,
+            Interpolation interp, size_t num_threads) {
+  rotate_wide(input, output, width, height, depth, angle, tile_size, interp,
+              num_threads);
+}
+
+void rotate_row_range(const Frame<const unsigned char> &in,
+                      const Frame<unsigned char> &out, size_t depth,
+                      float angle, Interpolation interp, int row_begin,
+                      int row_end) {
+  if (depth == 1)
+    rotate<1U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+  else if (depth == 2)
+    rotate<2U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+  else if (depth == 3)
+    rotate<3U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+  else if (depth == 4)
+    rotate<4U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+}
+
+template <typename Pixel>
+static void rotate_wide(const Pixel *input, Pixel *output, size_t width,
+                        size_t height, size_t depth, float angle,
+                        size_t tile_size, Interpolation interp,
+                        size_t num_threads) {
+  int stride = static_cast<int>(width * depth * sizeof(Pixel));
+  Frame<const Pixel> in{ input, static_cast<int>(width),
+                         static_cast<int>(height), stride };
+  Frame<Pixel> out{ output, static_cast<int>(width), static_cast<int>(height),
+                    stride };
+
+  if (depth == 1)
+    rotate_parallel<1U>(in, out, angle, tile_size, interp, Border(),
+                        num_threads);
+  else if (depth == 2)
+    rotate_parallel<2U>(in, out, angle, tile_size, interp, Border(),
+                        num_threads);
+  else if (depth == 3)
+    rotate_parallel<3U>(in, out, angle, tile_size, interp, Border(),
+                        num_threads);
+  else if (depth == 4)
+    rotate_parallel<4U>(in, out, angle, tile_size, interp, Border(),
+                        num_threads);
+  else
+    std::cerr << "Depth should be 1 (grayscale), 2 (grayscale + alpha), 3 "
+                 "(rgb) or 4 (rgba).\n";
+}
+
+void rotated_size(size_t width, size_t height, float angle, size_t &out_width,
+                  size_t &out_height) {
+  // Rounding slack for corners that should land exactly on a pixel
+  const double eps = 1e-6;
+  int turns;
+  double sin_th = std::sin(static_cast<double>(angle));
+  double cos_th = std::cos(static_cast<double>(angle));
+
+  if (quarter_turns(angle, turns)) {
+    const int sin_q[4] = { 0, 1, 0, -1 };
+    const int cos_q[4] = { 1, 0, -1, 0 };
+    sin_th = sin_q[turns];
+    cos_th = cos_q[turns];
   }
+
+  out_width = out_height = 0U;
+  if (width == 0U || height == 0U)
+    return;
+
+  // Corners of the input relative to its center, (row, col)
+  double half_width = static_cast<double>(width >> 1);
+  double half_height = static_cast<double>(height >> 1);
+  const double rows[2] = { -half_height, height - 1 - half_height };
+  const double cols[2] = { -half_width, width - 1 - half_width };
+  // Their range in the output relative to its center, (row, col)
+  double lo[2] = { 0., 0. }, hi[2] = { 0., 0. };
+
+  for (double r : rows) {
+    for (double c : cols) {
+      // Inverse of source = R * destination
+      double dst[2] = { cos_th * r + sin_th * c, -sin_th * r + cos_th * c };
+      for (int k = 0; k < 2; k++) {
+        lo[k] = std::min(lo[k], dst[k]);
+        hi[k] = std::max(hi[k], dst[k]);
+      }
+    }
+  }
+
+  // Size n has n >> 1 pixels before its center and (n - 1) >> 1 after it
+  size_t size[2];
+  for (int k = 0; k < 2; k++) {
+    long before = -static_cast<long>(std::ceil(lo[k] - eps));
+    long after = static_cast<long>(std::floor(hi[k] + eps));
+    size[k] = static_cast<size_t>(std::max(2 * before, 2 * after + 1));
+  }
+  out_height = size[0];
+  out_width = size[1];
 }
 
+#ifdef IMAGEPROC_X86_SIMD
+// Vectorized part of a span, returns the first column left to rotate_span()
 template <size_t Depth>
-static void rotate(const unsigned char *input, unsigned char *output,
-                   size_t width, size_t height, float angle) {
-  size_t ld = width;
+static int rotate_span_simd(Simd simd, const Frame<const unsigned char> &in,
+                            const Frame<unsigned char> &out, int row,
+                            const RowSpan<float> &span) {
+  if (simd == Simd::avx2)
+    return rotate_span_avx2<Depth>(in, out, row, span);
+  if (simd == Simd::sse41)
+    return rotate_span_sse41<Depth>(in, out, row, span);
+  return span.col_begin;
+}
 
-  // Indices (row, col) in the input image from where we get pixels
-  float idx_fract[2];
-  float idx_fract_round[2];
-  int idx_int[2];
+template <size_t Depth>
+static int rotate_span_simd(Simd simd, const Frame<const std::uint16_t> &in,
+                            const Frame<std::uint16_t> &out, int row,
+                            const RowSpan<float> &span) {
+  if (simd == Simd::avx2)
+    return rotate_span_avx2<Depth>(in, out, row, span);
+  return span.col_begin;
+}
 
-  float pix00[Depth], pix01[Depth], pix10[Depth], pix11[Depth];
-  // Parameters for bilinear interpolation
-  float bilin[2];
-  float weight[4];
+template <size_t Depth>
+static int rotate_span_simd(Simd simd, const Frame<const float> &in,
+                            const Frame<float> &out, int row,
+                            const RowSpan<float> &span) {
+  if (simd == Simd::avx2)
+    return rotate_span_avx2<Depth>(in, out, row, span);
+  return span.col_begin;
+}
+#endif
+
+template <size_t Depth, typename Pixel>
+static void rotate(const Frame<const Pixel> &in, const Frame<Pixel> &out,
+                   float angle, size_t tile_size, Interpolation interp,
+                   const Border &border, int row_begin, int row_end) {
+  int turns;
+
+  // Multiples of pi/2 (e.g. EXIF orientations) are exact pixel copies
+  if (quarter_turns(angle, turns)) {
+    rotate_quarter_turns<Depth * sizeof(Pixel)>(
+        byte_frame(in), byte_frame(out), turns, border, row_begin, row_end);
+    return;
+  }
 
   float sin_th = sinf(angle);
   float cos_th = cosf(angle);
 
-  int half_width = width >> 1;
-  int half_height = height >> 1;
-
-  for (int row = 0; row < height; row++) {
-    for (int col = 0; col < width; col++) {
-
-      idx_fract[0] = cos_th * (static_cast<float>(row - half_height)) -
-                     sin_th * (static_cast<float>(col - half_width));
-      idx_fract[1] = sin_th * (static_cast<float>(row - half_height)) +
-                     cos_th * (static_cast<float>(col - half_width));
-
-      idx_fract_round[0] = floorf(idx_fract[0]); // or use modff
-      idx_fract_round[1] = floorf(idx_fract[1]);
-
-      idx_int[0] = static_cast<int>(idx_fract_round[0]) + half_height;
-      idx_int[1] = static_cast<int>(idx_fract_round[1]) + half_width;
-
-      if ((idx_int[0] >= 0) && (idx_int[0] < (height - 1)) &&
-          (idx_int[1] >= 0) && (idx_int[1] < (width - 1))) {
-
-        bilin[0] = idx_fract[0] - idx_fract_round[0];
-        bilin[1] = idx_fract[1] - idx_fract_round[1];
-
-        weight[0] = (1. - bilin[0]) * (1. - bilin[1]);
-        weight[1] = (1. - bilin[0]) * (bilin[1]);
-        weight[2] = (bilin[0]) * (1. - bilin[1]);
-        weight[3] = (bilin[0]) * (bilin[1]);
-
-        // Will be unrolled by the compiler:
-        for (int d = 0; d < Depth; d++)
-          pix00[d] = input[LOC(idx_int[0], idx_int[1], ld, Depth, d)];
-        for (int d = 0; d < Depth; d++)
-          pix01[d] = input[LOC(idx_int[0], idx_int[1] + 1, ld, Depth, d)];
-        for (int d = 0; d < Depth; d++)
-          pix10[d] = input[LOC(idx_int[0] + 1, idx_int[1], ld, Depth, d)];
-        for (int d = 0; d < Depth; d++)
-          pix11[d] = input[LOC(idx_int[0] + 1, idx_int[1] + 1, ld, Depth, d)];
-
-        for (int d = 0; d < Depth; d++) {
-          output[LOC(row, col, ld, Depth, d)] = static_cast<unsigned char>(
-              static_cast<float>(pix00[d]) * weight[0] +
-              static_cast<float>(pix01[d]) * weight[1] +
-              static_cast<float>(pix10[d]) * weight[2] +
-              static_cast<float>(pix11[d]) * weight[3]);
-        }
-      }
-    }
+  if (interp == Interpolation::bicubic) {
+    rotate_resample<Depth, 4U>(in, out, sin_th, cos_th, tile_size,
+                               resample_table(interp), border, row_begin,
+                               row_end);
+    return;
   }
+  if (interp == Interpolation::lanczos3) {
+    rotate_resample<Depth, 6U>(in, out, sin_th, cos_th, tile_size,
+                               resample_table(interp), border, row_begin,
+                               row_end);
+    return;
+  }
+
+#ifdef IMAGEPROC_X86_SIMD
+  Simd simd = get_simd();
+#endif
+
+  rotate_rows<float>(
+      out, tile_size, row_begin, row_end,
+      [&](int row) { return rotate_row_span(in, out, row, sin_th, cos_th); },
+      [&](int row, const RowSpan<float> &span) {
+        int col = span.col_begin;
+#ifdef IMAGEPROC_X86_SIMD
+        col = rotate_span_simd<Depth>(simd, in, out, row, span);
+#endif
+        rotate_span<Depth>(in, out, row, span, col, span.col_end);
+      },
+      [&](int row, const RowSpan<float> &span) {
+        rotate_outside<float, Depth>(
+            out, row, span, border,
+            [&](int r) {
+              return rotate_row_span(in, out, r, sin_th, cos_th, -1);
+            },
+            [&](int first, int last) {
+              rotate_border_span<Depth>(in, out, row, span, border, first,
+                                        last);
+            });
+      });
+}
+
+// Rows outside of the rotated image are only cleared, the threads take
+// chunks of rows (whole rows of tiles) in turn to even out the work
+template <size_t Depth, typename Pixel>
+static void rotate_parallel(const Frame<const Pixel> &in,
+                            const Frame<Pixel> &out, float angle,
+                            size_t tile_size, Interpolation interp,
+                            const Border &border, size_t num_threads) {
+  size_t grain = tile_size ? tile_size : rotation_grain;
+  parallel_rows(out.height, num_threads, grain, [&](size_t begin, size_t end) {
+    rotate<Depth>(in, out, angle, tile_size, interp, border,
+                  static_cast<int>(begin), static_cast<int>(end));
+  });
 }
 
 } /* namespace imageproc */
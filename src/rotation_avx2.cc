@@ -0,0 +1,382 @@
+// AVX2 rotation kernels, this file is compiled with -mavx2
+#include <immintrin.h>
+#include <cstring>
+#include "rotation_kernels.h"
+
+namespace imageproc {
+
+// Gathers the 4 bytes starting at every lane's byte offset
+static inline __m256i gather_bytes(const unsigned char *base, __m256i offset) {
+  return _mm256_i32gather_epi32(reinterpret_cast<const int *>(base), offset,
+                                1);
+}
+
+// Byte `d` of every 32-bit lane
+static inline __m256i channel(__m256i v, int d) {
+  return _mm256_and_si256(_mm256_srli_epi32(v, 8 * d), _mm256_set1_epi32(0xff));
+}
+
+// Byte offsets of the top-left source pixels, false if a 4-byte load from any
+// of them (or their neighbours) would run past the end of the input buffer;
+// such blocks (at most a few pixels near the last source row) go to the
+// scalar path
+template <size_t Depth>
+static inline bool source_offset(__m256i idx_row, __m256i idx_col,
+                                 const Frame<const unsigned char> &in,
+                                 __m256i &offset) {
+  offset = _mm256_add_epi32(
+      _mm256_mullo_epi32(idx_row, _mm256_set1_epi32(in.stride)),
+      _mm256_mullo_epi32(idx_col, _mm256_set1_epi32(Depth)));
+  // Last byte read for the lane is offset + stride + Depth + 3
+  int limit = (in.height - 2) * in.stride + (in.width - 1) * Depth - 3;
+  __m256i safe = _mm256_cmpgt_epi32(_mm256_set1_epi32(limit), offset);
+  return _mm256_movemask_ps(_mm256_castsi256_ps(safe)) == 0xff;
+}
+
+// Gathers the 2x2 neighbourhoods, g01 and g11 are the right neighbours
+template <size_t Depth>
+static inline void gather_neighbourhood(const unsigned char *input, int stride,
+                                        __m256i offset, __m256i &g00,
+                                        __m256i &g01, __m256i &g10,
+                                        __m256i &g11) {
+  g00 = gather_bytes(input, offset);
+  g10 = gather_bytes(input + stride, offset);
+  if (Depth <= 2) { // right neighbours are the next bytes of the same load
+    g01 = _mm256_srli_epi32(g00, 8 * Depth);
+    g11 = _mm256_srli_epi32(g10, 8 * Depth);
+  } else {
+    g01 = gather_bytes(input + Depth, offset);
+    g11 = gather_bytes(input + stride + Depth, offset);
+  }
+}
+
+// Packs the low Depth bytes of the 8 lanes into out
+template <size_t Depth>
+static inline void store_pixels(unsigned char *out, __m256i pix) {
+  if (Depth == 1) {
+    const __m256i pack = _mm256_setr_epi8(
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8,
+        12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i packed = _mm256_shuffle_epi8(pix, pack);
+    int lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(packed));
+    int hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(packed, 1));
+    memcpy(out, &lo, 4);
+    memcpy(out + 4, &hi, 4);
+  } else if (Depth == 2) {
+    const __m256i pack = _mm256_setr_epi8(
+        0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 4, 5,
+        8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i packed = _mm256_shuffle_epi8(pix, pack);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out),
+                     _mm256_castsi256_si128(packed));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 8),
+                     _mm256_extracti128_si256(packed, 1));
+  } else if (Depth == 3) {
+    const __m256i pack = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5,
+        6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    alignas(32) unsigned char packed[32];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(packed),
+                       _mm256_shuffle_epi8(pix, pack));
+    memcpy(out, packed, 12);
+    memcpy(out + 12, packed + 16, 12);
+  } else if (Depth == 4) { // the lanes are the pixels
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), pix);
+  }
+}
+
+template <size_t Depth>
+int rotate_fxp_span_avx2(const Frame<const unsigned char> &in,
+                         const Frame<unsigned char> &out, int row,
+                         const RowSpan<int> &span) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i fract_mask = _mm256_set1_epi32(ONE_FIXP - 1);
+  const __m256i one = _mm256_set1_epi32(ONE_FIXP);
+  const __m256i step0 = _mm256_set1_epi32(8 * span.step[0]);
+  const __m256i step1 = _mm256_set1_epi32(8 * span.step[1]);
+
+  unsigned char *out_row = out.data + row * out.stride;
+  int col = span.col_begin;
+
+  // Source coordinates of the 8 lanes, stepped by 8 columns at a time
+  __m256i idx_fract0 = _mm256_add_epi32(
+      _mm256_set1_epi32(span.start[0] + col * span.step[0]),
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.step[0])));
+  __m256i idx_fract1 = _mm256_add_epi32(
+      _mm256_set1_epi32(span.start[1] + col * span.step[1]),
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.step[1])));
+
+  for (; col + 8 <= span.col_end; col += 8) {
+    __m256i idx_int0 = _mm256_add_epi32(_mm256_srai_epi32(idx_fract0, FR_BITS),
+                                        _mm256_set1_epi32(half_height));
+    __m256i idx_int1 = _mm256_add_epi32(_mm256_srai_epi32(idx_fract1, FR_BITS),
+                                        _mm256_set1_epi32(half_width));
+    __m256i offset;
+
+    if (!source_offset<Depth>(idx_int0, idx_int1, in, offset)) {
+      rotate_fxp_span<Depth>(in, out, row, span, col, col + 8);
+    } else {
+      __m256i bilin0 = _mm256_and_si256(idx_fract0, fract_mask);
+      __m256i bilin1 = _mm256_and_si256(idx_fract1, fract_mask);
+      // (ONE - bilin1, bilin1) pairs for the horizontal 16-bit multiply-add
+      __m256i weight_h = _mm256_or_si256(_mm256_sub_epi32(one, bilin1),
+                                         _mm256_slli_epi32(bilin1, 16));
+      __m256i weight_top = _mm256_sub_epi32(one, bilin0);
+      __m256i g00, g01, g10, g11;
+      gather_neighbourhood<Depth>(in.data, in.stride, offset, g00, g01, g10,
+                                  g11);
+
+      __m256i result = _mm256_setzero_si256();
+      for (int d = 0; d < Depth; d++) {
+        // (p00 * (ONE - b1) + p01 * b1) * (ONE - b0) +
+        // (p10 * (ONE - b1) + p11 * b1) * b0 is exactly the sum of the four
+        // products of the scalar kernel
+        __m256i top = _mm256_madd_epi16(
+            _mm256_or_si256(channel(g00, d),
+                            _mm256_slli_epi32(channel(g01, d), 16)),
+            weight_h);
+        __m256i bottom = _mm256_madd_epi16(
+            _mm256_or_si256(channel(g10, d),
+                            _mm256_slli_epi32(channel(g11, d), 16)),
+            weight_h);
+        __m256i pix = _mm256_srli_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(top, weight_top),
+                             _mm256_mullo_epi32(bottom, bilin0)),
+            2 * FR_BITS);
+        result = _mm256_or_si256(result, _mm256_slli_epi32(pix, 8 * d));
+      }
+      store_pixels<Depth>(out_row + col * Depth, result);
+    }
+
+    idx_fract0 = _mm256_add_epi32(idx_fract0, step0);
+    idx_fract1 = _mm256_add_epi32(idx_fract1, step1);
+  }
+  return col;
+}
+
+template <size_t Depth>
+int rotate_span_avx2(const Frame<const unsigned char> &in,
+                     const Frame<unsigned char> &out, int row,
+                     const RowSpan<float> &span) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 one = _mm256_set1_ps(1.f);
+  const __m256 start0 = _mm256_set1_ps(span.start[0]);
+  const __m256 start1 = _mm256_set1_ps(span.start[1]);
+  const __m256 step0 = _mm256_set1_ps(span.step[0]);
+  const __m256 step1 = _mm256_set1_ps(span.step[1]);
+
+  unsigned char *out_row = out.data + row * out.stride;
+  int col = span.col_begin;
+
+  for (; col + 8 <= span.col_end; col += 8) {
+    __m256 c = _mm256_cvtepi32_ps(
+        _mm256_add_epi32(_mm256_set1_epi32(col), lane));
+    __m256 idx_fract0 = _mm256_add_ps(start0, _mm256_mul_ps(c, step0));
+    __m256 idx_fract1 = _mm256_add_ps(start1, _mm256_mul_ps(c, step1));
+    __m256 idx_round0 = _mm256_floor_ps(idx_fract0);
+    __m256 idx_round1 = _mm256_floor_ps(idx_fract1);
+    __m256i idx_int0 = _mm256_add_epi32(_mm256_cvttps_epi32(idx_round0),
+                                        _mm256_set1_epi32(half_height));
+    __m256i idx_int1 = _mm256_add_epi32(_mm256_cvttps_epi32(idx_round1),
+                                        _mm256_set1_epi32(half_width));
+    __m256i offset;
+
+    if (!source_offset<Depth>(idx_int0, idx_int1, in, offset)) {
+      rotate_span<Depth>(in, out, row, span, col, col + 8);
+      continue;
+    }
+
+    __m256 bilin0 = _mm256_sub_ps(idx_fract0, idx_round0);
+    __m256 bilin1 = _mm256_sub_ps(idx_fract1, idx_round1);
+    __m256 weight0 =
+        _mm256_mul_ps(_mm256_sub_ps(one, bilin0), _mm256_sub_ps(one, bilin1));
+    __m256 weight1 = _mm256_mul_ps(_mm256_sub_ps(one, bilin0), bilin1);
+    __m256 weight2 = _mm256_mul_ps(bilin0, _mm256_sub_ps(one, bilin1));
+    __m256 weight3 = _mm256_mul_ps(bilin0, bilin1);
+    __m256i g00, g01, g10, g11;
+    gather_neighbourhood<Depth>(in.data, in.stride, offset, g00, g01, g10,
+                                  g11);
+
+    __m256i result = _mm256_setzero_si256();
+    for (int d = 0; d < Depth; d++) {
+      // Same evaluation order as the scalar kernel
+      __m256 pix = _mm256_add_ps(
+          _mm256_add_ps(
+              _mm256_add_ps(
+                  _mm256_mul_ps(_mm256_cvtepi32_ps(channel(g00, d)), weight0),
+                  _mm256_mul_ps(_mm256_cvtepi32_ps(channel(g01, d)), weight1)),
+              _mm256_mul_ps(_mm256_cvtepi32_ps(channel(g10, d)), weight2)),
+          _mm256_mul_ps(_mm256_cvtepi32_ps(channel(g11, d)), weight3));
+      result = _mm256_or_si256(
+          result, _mm256_slli_epi32(_mm256_cvttps_epi32(pix), 8 * d));
+    }
+    store_pixels<Depth>(out_row + col * Depth, result);
+  }
+  return col;
+}
+
+// Channel values at the byte offsets of the lanes, as floats
+static inline __m256 gather_values(const float *base, __m256i offset) {
+  return _mm256_i32gather_ps(base, offset, 1);
+}
+
+static inline __m256 gather_values(const std::uint16_t *base, __m256i offset) {
+  __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(base),
+                                     offset, 1);
+  return _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xffff)));
+}
+
+// source_offset() for pixels of Depth channels of sizeof(Pixel) bytes
+template <size_t Depth, typename Pixel>
+static inline bool wide_source_offset(__m256i idx_row, __m256i idx_col,
+                                      const Frame<const Pixel> &in,
+                                      __m256i &offset) {
+  const int size = sizeof(Pixel);
+  offset = _mm256_add_epi32(
+      _mm256_mullo_epi32(idx_row, _mm256_set1_epi32(in.stride)),
+      _mm256_mullo_epi32(idx_col, _mm256_set1_epi32(Depth * size)));
+  // Last byte read for the lane is offset + stride + (2 * Depth - 1) * size
+  // + 3
+  int limit = (in.height - 2) * in.stride +
+              (in.width * static_cast<int>(Depth) - 2 * Depth + 1) * size - 3;
+  __m256i safe = _mm256_cmpgt_epi32(_mm256_set1_epi32(limit), offset);
+  return _mm256_movemask_ps(_mm256_castsi256_ps(safe)) == 0xff;
+}
+
+template <size_t Depth, typename Pixel>
+static int rotate_wide_span_avx2(const Frame<const Pixel> &in,
+                                 const Frame<Pixel> &out, int row,
+                                 const RowSpan<float> &span) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 one = _mm256_set1_ps(1.f);
+  const __m256 start0 = _mm256_set1_ps(span.start[0]);
+  const __m256 start1 = _mm256_set1_ps(span.start[1]);
+  const __m256 step0 = _mm256_set1_ps(span.step[0]);
+  const __m256 step1 = _mm256_set1_ps(span.step[1]);
+
+  Pixel *out_row = byte_offset(out.data, row * out.stride);
+  const Pixel *below = byte_offset(in.data, in.stride);
+  alignas(32) float pix[Depth][8];
+  int col = span.col_begin;
+
+  for (; col + 8 <= span.col_end; col += 8) {
+    __m256 c = _mm256_cvtepi32_ps(
+        _mm256_add_epi32(_mm256_set1_epi32(col), lane));
+    __m256 idx_fract0 = _mm256_add_ps(start0, _mm256_mul_ps(c, step0));
+    __m256 idx_fract1 = _mm256_add_ps(start1, _mm256_mul_ps(c, step1));
+    __m256 idx_round0 = _mm256_floor_ps(idx_fract0);
+    __m256 idx_round1 = _mm256_floor_ps(idx_fract1);
+    __m256i idx_int0 = _mm256_add_epi32(_mm256_cvttps_epi32(idx_round0),
+                                        _mm256_set1_epi32(half_height));
+    __m256i idx_int1 = _mm256_add_epi32(_mm256_cvttps_epi32(idx_round1),
+                                        _mm256_set1_epi32(half_width));
+    __m256i offset;
+
+    if (!wide_source_offset<Depth>(idx_int0, idx_int1, in, offset)) {
+      rotate_span<Depth>(in, out, row, span, col, col + 8);
+      continue;
+    }
+
+    __m256 bilin0 = _mm256_sub_ps(idx_fract0, idx_round0);
+    __m256 bilin1 = _mm256_sub_ps(idx_fract1, idx_round1);
+    __m256 weight0 =
+        _mm256_mul_ps(_mm256_sub_ps(one, bilin0), _mm256_sub_ps(one, bilin1));
+    __m256 weight1 = _mm256_mul_ps(_mm256_sub_ps(one, bilin0), bilin1);
+    __m256 weight2 = _mm256_mul_ps(bilin0, _mm256_sub_ps(one, bilin1));
+    __m256 weight3 = _mm256_mul_ps(bilin0, bilin1);
+
+    for (int d = 0; d < Depth; d++) {
+      // Same evaluation order as the scalar kernel
+      _mm256_store_ps(
+          pix[d],
+          _mm256_add_ps(
+              _mm256_add_ps(
+                  _mm256_add_ps(
+                      _mm256_mul_ps(gather_values(in.data + d, offset),
+                                    weight0),
+                      _mm256_mul_ps(gather_values(in.data + Depth + d, offset),
+                                    weight1)),
+                  _mm256_mul_ps(gather_values(below + d, offset), weight2)),
+              _mm256_mul_ps(gather_values(below + Depth + d, offset),
+                            weight3)));
+    }
+    // Truncated to integer pixels by the same conversion as in rotate_span()
+    for (int l = 0; l < 8; l++)
+      for (int d = 0; d < Depth; d++)
+        out_row[(col + l) * Depth + d] = static_cast<Pixel>(pix[d][l]);
+  }
+  return col;
+}
+
+template <size_t Depth>
+int rotate_span_avx2(const Frame<const std::uint16_t> &in,
+                     const Frame<std::uint16_t> &out, int row,
+                     const RowSpan<float> &span) {
+  return rotate_wide_span_avx2<Depth>(in, out, row, span);
+}
+
+template <size_t Depth>
+int rotate_span_avx2(const Frame<const float> &in, const Frame<float> &out,
+                     int row, const RowSpan<float> &span) {
+  return rotate_wide_span_avx2<Depth>(in, out, row, span);
+}
+
+template int rotate_span_avx2<1U>(const Frame<const unsigned char> &,
+                                  const Frame<unsigned char> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<2U>(const Frame<const unsigned char> &,
+                                  const Frame<unsigned char> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<3U>(const Frame<const unsigned char> &,
+                                  const Frame<unsigned char> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<4U>(const Frame<const unsigned char> &,
+                                  const Frame<unsigned char> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<1U>(const Frame<const std::uint16_t> &,
+                                  const Frame<std::uint16_t> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<2U>(const Frame<const std::uint16_t> &,
+                                  const Frame<std::uint16_t> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<3U>(const Frame<const std::uint16_t> &,
+                                  const Frame<std::uint16_t> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<4U>(const Frame<const std::uint16_t> &,
+                                  const Frame<std::uint16_t> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<1U>(const Frame<const float> &,
+                                  const Frame<float> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<2U>(const Frame<const float> &,
+                                  const Frame<float> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<3U>(const Frame<const float> &,
+                                  const Frame<float> &, int,
+                                  const RowSpan<float> &);
+template int rotate_span_avx2<4U>(const Frame<const float> &,
+                                  const Frame<float> &, int,
+                                  const RowSpan<float> &);
+template int rotate_fxp_span_avx2<1U>(const Frame<const unsigned char> &,
+                                      const Frame<unsigned char> &, int,
+                                      const RowSpan<int> &);
+template int rotate_fxp_span_avx2<2U>(const Frame<const unsigned char> &,
+                                      const Frame<unsigned char> &, int,
+                                      const RowSpan<int> &);
+template int rotate_fxp_span_avx2<3U>(const Frame<const unsigned char> &,
+                                      const Frame<unsigned char> &, int,
+                                      const RowSpan<int> &);
+template int rotate_fxp_span_avx2<4U>(const Frame<const unsigned char> &,
+                                      const Frame<unsigned char> &, int,
+                                      const RowSpan<int> &);
+
+} /* namespace imageproc */
@@ -1,87 +1,160 @@
 #include <cmath>
 #include "imageproc.h"
-
-#define FR_BITS 8
-#define ONE_FIXP (1U << FR_BITS)
+#include "parallel.h"
+#include "resample_kernels.h"
 
 namespace imageproc {
 
-// Forward declaration
+// Forward declaration, rotates destination rows [row_begin, row_end)
+template <size_t Depth>
+static void rotate_fxp(const Frame<const unsigned char> &in,
+                       const Frame<unsigned char> &out, float angle,
+                       size_t tile_size, Interpolation interp,
+                       const Border &border, int row_begin, int row_end);
+
 template <size_t Depth>
-static void rotate_fxp(const unsigned char *input, unsigned char *output,
-                       size_t width, size_t height, float angle);
+static void rotate_fxp_parallel(const Frame<const unsigned char> &in,
+                                const Frame<unsigned char> &out, float angle,
+                                size_t tile_size, Interpolation interp,
+                                const Border &border, size_t num_threads);
 
 void rotate_fxp(const unsigned char *input, unsigned char *output, size_t width,
-                size_t height, size_t depth, float angle) {
-  if (depth == 1) {
-    rotate_fxp<1U>(input, output, width, height, angle);
-  } else if (depth == 3) {
-    rotate_fxp<3U>(input, output, width, height, angle);
+                size_t height, size_t depth, float angle, size_t tile_size,
+                Interpolation interp, size_t num_threads) {
+  rotate_fxp(input, width, height, 0U, output, width, height, 0U, depth, angle,
+             tile_size, interp, num_threads);
+}
+
+void rotate_fxp(const unsigned char *input, size_t in_width, size_t in_height,
+                size_t in_stride, unsigned char *output, size_t out_width,
+                size_t out_height, size_t out_stride, size_t depth,
+                float angle, size_t tile_size, Interpolation interp,
+                size_t num_threads) {
+  rotate_fxp(ConstImageView(input, in_width, in_height, depth, in_stride),
+             ImageView(output, out_width, out_height, depth, out_stride), angle,
+             tile_size, interp, num_threads);
+}
+
+void rotate_fxp(ConstImageView input, ImageView output, float angle,
+                size_t tile_size, Interpolation interp, size_t num_threads,
+                const Border &border) {
+  Frame<const unsigned char> in = make_frame(input);
+  Frame<unsigned char> out = make_frame(output);
+  Border frame_border = border;
+
+  // As in rotation.cc
+  if (border.mode == BorderMode::padded) {
+    in = padded_frame(in, input.channels, border.padding);
+    frame_border.mode = BorderMode::clip;
+  }
+
+  if (input.channels != output.channels) {
+    std::cerr << "Input and output should have the same number of channels.\n";
+  } else if (input.channels == 1) {
+    rotate_fxp_parallel<1U>(in, out, angle, tile_size, interp, frame_border,
+                            num_threads);
+  } else if (input.channels == 2) {
+    rotate_fxp_parallel<2U>(in, out, angle, tile_size, interp, frame_border,
+                            num_threads);
+  } else if (input.channels == 3) {
+    rotate_fxp_parallel<3U>(in, out, angle, tile_size, interp, frame_border,
+                            num_threads);
+  } else if (input.channels == 4) {
+    rotate_fxp_parallel<4U>(in, out, angle, tile_size, interp, frame_border,
+                            num_threads);
   } else {
-    std::cerr << "Depth should be either 1 (grayscale) or 3 (rgb).\n";
+    std::cerr << "Depth should be 1 (grayscale), 2 (grayscale + alpha), 3 "
+                 "(rgb) or 4 (rgba).\n";
   }
 }
 
-template <size_t Depth>
-static void rotate_fxp(const unsigned char *input, unsigned char *output,
-                       size_t width, size_t height, float angle) {
-  size_t ld = width;
-
-  // Indices (row, col) in the input image from where we get pixels
-  int idx_fract[2];
-  int idx_int[2];
+void rotate_fxp_row_range(const Frame<const unsigned char> &in,
+                          const Frame<unsigned char> &out, size_t depth,
+                          float angle, Interpolation interp, int row_begin,
+                          int row_end) {
+  if (depth == 1)
+    rotate_fxp<1U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+  else if (depth == 2)
+    rotate_fxp<2U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+  else if (depth == 3)
+    rotate_fxp<3U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+  else if (depth == 4)
+    rotate_fxp<4U>(in, out, angle, 0U, interp, Border(), row_begin, row_end);
+}
 
-  unsigned char pix00[Depth], pix01[Depth], pix10[Depth], pix11[Depth];
-  // Parameters for bilinear interpolation
-  int bilin[2];
-  int weight[4];
+template <size_t Depth>
+static void rotate_fxp(const Frame<const unsigned char> &in,
+                       const Frame<unsigned char> &out, float angle,
+                       size_t tile_size, Interpolation interp,
+                       const Border &border, int row_begin, int row_end) {
+  int turns;
+
+  // Multiples of pi/2 (e.g. EXIF orientations) are exact pixel copies
+  if (quarter_turns(angle, turns)) {
+    rotate_quarter_turns<Depth>(in, out, turns, border, row_begin, row_end);
+    return;
+  }
 
   // Conversion from float to fix-point
   int sin_th = static_cast<int>(sinf(angle) * ONE_FIXP);
   int cos_th = static_cast<int>(cosf(angle) * ONE_FIXP);
 
-  int half_width = width >> 1;
-  int half_height = height >> 1;
-
-  for (int row = 0; row < height; row++) {
-    for (int col = 0; col < width; col++) {
-
-      idx_fract[0] = cos_th * (row - half_height) - sin_th * (col - half_width);
-      idx_fract[1] = sin_th * (row - half_height) + cos_th * (col - half_width);
-
-      idx_int[0] = (idx_fract[0] >> FR_BITS) + half_height;
-      idx_int[1] = (idx_fract[1] >> FR_BITS) + half_width;
-
-      if ((idx_int[0] >= 0) && (idx_int[0] < (height - 1)) &&
-          (idx_int[1] >= 0) && (idx_int[1] < (width - 1))) {
-
-        bilin[0] = idx_fract[0] & (ONE_FIXP - 1);
-        bilin[1] = idx_fract[1] & (ONE_FIXP - 1);
-
-        weight[0] = (ONE_FIXP - bilin[0]) * (ONE_FIXP - bilin[1]);
-        weight[1] = (ONE_FIXP - bilin[0]) * (bilin[1]);
-        weight[2] = (bilin[0]) * (ONE_FIXP - bilin[1]);
-        weight[3] = (bilin[0]) * (bilin[1]);
-
-        // Will be unrolled by the compiler:
-        for (int d = 0; d < Depth; d++)
-          pix00[d] = input[LOC(idx_int[0], idx_int[1], ld, Depth, d)];
-        for (int d = 0; d < Depth; d++)
-          pix01[d] = input[LOC(idx_int[0], idx_int[1] + 1, ld, Depth, d)];
-        for (int d = 0; d < Depth; d++)
-          pix10[d] = input[LOC(idx_int[0] + 1, idx_int[1], ld, Depth, d)];
-        for (int d = 0; d < Depth; d++)
-          pix11[d] = input[LOC(idx_int[0] + 1, idx_int[1] + 1, ld, Depth, d)];
-
-        for (int d = 0; d < Depth; d++) {
-          output[LOC(row, col, ld, Depth, d)] = static_cast<unsigned char>(
-              (pix00[d] * weight[0] + pix01[d] * weight[1] +
-               pix10[d] * weight[2] + pix11[d] * weight[3]) >>
-              (2 * FR_BITS));
-        }
-      }
-    }
+  if (interp == Interpolation::bicubic) {
+    rotate_fxp_resample<Depth, 4U>(in, out, sin_th, cos_th, tile_size,
+                                   resample_table(interp), border, row_begin,
+                                   row_end);
+    return;
+  }
+  if (interp == Interpolation::lanczos3) {
+    rotate_fxp_resample<Depth, 6U>(in, out, sin_th, cos_th, tile_size,
+                                   resample_table(interp), border, row_begin,
+                                   row_end);
+    return;
   }
+
+#ifdef IMAGEPROC_X86_SIMD
+  Simd simd = get_simd();
+#endif
+
+  rotate_rows<int>(
+      out, tile_size, row_begin, row_end,
+      [&](int row) {
+        return rotate_fxp_row_span(in, out, row, sin_th, cos_th);
+      },
+      [&](int row, const RowSpan<int> &span) {
+        int col = span.col_begin;
+#ifdef IMAGEPROC_X86_SIMD
+        if (simd == Simd::avx2)
+          col = rotate_fxp_span_avx2<Depth>(in, out, row, span);
+        else if (simd == Simd::sse41)
+          col = rotate_fxp_span_sse41<Depth>(in, out, row, span);
+#endif
+        rotate_fxp_span<Depth>(in, out, row, span, col, span.col_end);
+      },
+      [&](int row, const RowSpan<int> &span) {
+        rotate_outside<int, Depth>(
+            out, row, span, border,
+            [&](int r) {
+              return rotate_fxp_row_span(in, out, r, sin_th, cos_th, -1);
+            },
+            [&](int first, int last) {
+              rotate_fxp_border_span<Depth>(in, out, row, span, border, first,
+                                            last);
+            });
+      });
+}
+
+// Chunks of rows in turn, as in rotation.cc
+template <size_t Depth>
+static void rotate_fxp_parallel(const Frame<const unsigned char> &in,
+                                const Frame<unsigned char> &out, float angle,
+                                size_t tile_size, Interpolation interp,
+                                const Border &border, size_t num_threads) {
+  size_t grain = tile_size ? tile_size : rotation_grain;
+  parallel_rows(out.height, num_threads, grain, [&](size_t begin, size_t end) {
+    rotate_fxp<Depth>(in, out, angle, tile_size, interp, border,
+                      static_cast<int>(begin), static_cast<int>(end));
+  });
 }
 
 } /* namespace imageproc */
@@ -0,0 +1,560 @@
+#ifndef __ROTATION_KERNELS_H
+#define __ROTATION_KERNELS_H
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "imageproc.h"
+#include "frame.h"
+#include "stats.h"
+
+#define FR_BITS 8
+#define ONE_FIXP (1U << FR_BITS)
+
+namespace imageproc {
+
+// Source coordinates along one destination row. Relative to the center of the
+// input image, destination column col is interpolated at
+//   (start[0] + col * step[0], start[1] + col * step[1])
+// (row, column), in pixels for T == float and in FR_BITS fixed point for
+// T == int. Columns [col_begin, col_end) are the ones whose 2x2 source
+// neighbourhood lies inside of the input image, the rest of the row is left to
+// rotate_outside().
+template <typename T> struct RowSpan {
+  T start[2];
+  T step[2];
+  int col_begin;
+  int col_end;
+};
+
+// Real interval of col for which lo <= start + col * step < hi, clipped to
+// [begin, end)
+inline void linear_span(double start, double step, double lo, double hi,
+                        double &begin, double &end) {
+  if (step > 0.) {
+    begin = std::max(begin, (lo - start) / step);
+    end = std::min(end, (hi - start) / step);
+  } else if (step < 0.) {
+    begin = std::max(begin, (hi - start) / step);
+    end = std::min(end, (lo - start) / step);
+  } else if (start < lo || start >= hi) {
+    end = begin;
+  }
+}
+
+// Exact span of columns for which inside(col) holds. The coordinates are
+// monotonic in col so that span is contiguous; the estimate [est_begin,
+// est_end) computed in double precision is widened by 2 columns at each end to
+// cover rounding and then shrunk with the exact predicate.
+template <typename Inside>
+inline void exact_span(Inside inside, int width, double est_begin,
+                       double est_end, int &begin, int &end) {
+  if (!(est_begin < est_end)) {
+    begin = end = 0;
+    return;
+  }
+  begin = static_cast<int>(std::max(0., std::floor(est_begin) - 2.));
+  end = static_cast<int>(
+      std::min(static_cast<double>(width), std::ceil(est_end) + 2.));
+  while (begin < end && !inside(begin))
+    begin++;
+  while (end > begin && !inside(end - 1))
+    end--;
+}
+
+// The destination center is mapped to the source center; `in` and `out` only
+// provide the dimensions. With margin > 0 the span only keeps the columns
+// whose source neighbourhood extended by `margin` pixels on every side (the
+// support of the bicubic and Lanczos filters) lies inside of the input. A
+// negative margin gives the columns whose support of -margin pixels before
+// and after the source position touches the input.
+template <typename Pixel>
+inline RowSpan<float> rotate_row_span(const Frame<const Pixel> &in,
+                                      const Frame<Pixel> &out, int row,
+                                      float sin_th, float cos_th,
+                                      int margin = 0) {
+  int width = in.width, height = in.height;
+  int half_width = width >> 1;
+  int half_height = height >> 1;
+  int out_half_width = out.width >> 1;
+  int out_half_height = out.height >> 1;
+  RowSpan<float> span;
+
+  span.start[0] = cos_th * static_cast<float>(row - out_half_height) +
+                  sin_th * static_cast<float>(out_half_width);
+  span.start[1] = sin_th * static_cast<float>(row - out_half_height) -
+                  cos_th * static_cast<float>(out_half_width);
+  span.step[0] = -sin_th;
+  span.step[1] = cos_th;
+
+  auto inside = [&](int col) {
+    int idx_row = static_cast<int>(floorf(
+                      span.start[0] + static_cast<float>(col) * span.step[0])) +
+                  half_height;
+    int idx_col = static_cast<int>(floorf(
+                      span.start[1] + static_cast<float>(col) * span.step[1])) +
+                  half_width;
+    return (idx_row >= margin) && (idx_row < (height - 1 - margin)) &&
+           (idx_col >= margin) && (idx_col < (width - 1 - margin));
+  };
+
+  double begin = 0., end = out.width;
+  linear_span(span.start[0], span.step[0], margin - half_height,
+              height - 1 - margin - half_height, begin, end);
+  linear_span(span.start[1], span.step[1], margin - half_width,
+              width - 1 - margin - half_width, begin, end);
+  exact_span(inside, out.width, begin, end, span.col_begin, span.col_end);
+  return span;
+}
+
+// sin_th and cos_th are in FR_BITS fixed-point format
+inline RowSpan<int> rotate_fxp_row_span(const Frame<const unsigned char> &in,
+                                        const Frame<unsigned char> &out,
+                                        int row, int sin_th, int cos_th,
+                                        int margin = 0) {
+  int width = in.width, height = in.height;
+  int half_width = width >> 1;
+  int half_height = height >> 1;
+  int out_half_width = out.width >> 1;
+  int out_half_height = out.height >> 1;
+  RowSpan<int> span;
+
+  span.start[0] = cos_th * (row - out_half_height) + sin_th * out_half_width;
+  span.start[1] = sin_th * (row - out_half_height) - cos_th * out_half_width;
+  span.step[0] = -sin_th;
+  span.step[1] = cos_th;
+
+  auto inside = [&](int col) {
+    int idx_row =
+        ((span.start[0] + col * span.step[0]) >> FR_BITS) + half_height;
+    int idx_col =
+        ((span.start[1] + col * span.step[1]) >> FR_BITS) + half_width;
+    return (idx_row >= margin) && (idx_row < (height - 1 - margin)) &&
+           (idx_col >= margin) && (idx_col < (width - 1 - margin));
+  };
+
+  double begin = 0., end = out.width;
+  linear_span(span.start[0], span.step[0],
+              static_cast<double>(margin - half_height) * ONE_FIXP,
+              static_cast<double>(height - 1 - margin - half_height) *
+                  ONE_FIXP,
+              begin, end);
+  linear_span(span.start[1], span.step[1],
+              static_cast<double>(margin - half_width) * ONE_FIXP,
+              static_cast<double>(width - 1 - margin - half_width) * ONE_FIXP,
+              begin, end);
+  exact_span(inside, out.width, begin, end, span.col_begin, span.col_end);
+  return span;
+}
+
+// Scalar bilinear rotation of destination columns [col_begin, col_end) of
+// `row`, which must lie within span.col_begin and span.col_end. This is the
+// reference the vectorized kernels below are checked against, and it also
+// handles the columns they leave over. Interpolated values are truncated for
+// integer pixels (8 or 16 bits) and stored as they are for floats.
+template <size_t Depth, typename Pixel>
+inline void rotate_span(const Frame<const Pixel> &in, const Frame<Pixel> &out,
+                        int row, const RowSpan<float> &span, int col_begin,
+                        int col_end) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+  Pixel *out_row = byte_offset(out.data, row * out.stride);
+
+  // Indices (row, col) in the input image from where we get pixels
+  float idx_fract[2];
+  float idx_fract_round[2];
+  int idx_int[2];
+
+  float pix00[Depth], pix01[Depth], pix10[Depth], pix11[Depth];
+  // Parameters for bilinear interpolation
+  float bilin[2];
+  float weight[4];
+
+  for (int col = col_begin; col < col_end; col++) {
+    // Computed from the row start rather than accumulated column by column,
+    // float rounding errors would build up along the row otherwise
+    idx_fract[0] = span.start[0] + static_cast<float>(col) * span.step[0];
+    idx_fract[1] = span.start[1] + static_cast<float>(col) * span.step[1];
+
+    idx_fract_round[0] = floorf(idx_fract[0]); // or use modff
+    idx_fract_round[1] = floorf(idx_fract[1]);
+
+    idx_int[0] = static_cast<int>(idx_fract_round[0]) + half_height;
+    idx_int[1] = static_cast<int>(idx_fract_round[1]) + half_width;
+
+    bilin[0] = idx_fract[0] - idx_fract_round[0];
+    bilin[1] = idx_fract[1] - idx_fract_round[1];
+
+    weight[0] = (1. - bilin[0]) * (1. - bilin[1]);
+    weight[1] = (1. - bilin[0]) * (bilin[1]);
+    weight[2] = (bilin[0]) * (1. - bilin[1]);
+    weight[3] = (bilin[0]) * (bilin[1]);
+
+    const Pixel *src =
+        byte_offset(in.data, idx_int[0] * in.stride) + idx_int[1] * Depth;
+    const Pixel *below = byte_offset(src, in.stride);
+
+    // Will be unrolled by the compiler:
+    for (int d = 0; d < Depth; d++)
+      pix00[d] = src[d];
+    for (int d = 0; d < Depth; d++)
+      pix01[d] = src[Depth + d];
+    for (int d = 0; d < Depth; d++)
+      pix10[d] = below[d];
+    for (int d = 0; d < Depth; d++)
+      pix11[d] = below[Depth + d];
+
+    for (int d = 0; d < Depth; d++) {
+      out_row[col * Depth + d] = static_cast<Pixel>(
+          static_cast<float>(pix00[d]) * weight[0] +
+          static_cast<float>(pix01[d]) * weight[1] +
+          static_cast<float>(pix10[d]) * weight[2] +
+          static_cast<float>(pix11[d]) * weight[3]);
+    }
+  }
+}
+
+// Fixed-point counterpart of rotate_span(), the source coordinates are exact
+// so they are simply stepped column by column (DDA)
+template <size_t Depth>
+inline void rotate_fxp_span(const Frame<const unsigned char> &in,
+                            const Frame<unsigned char> &out, int row,
+                            const RowSpan<int> &span, int col_begin,
+                            int col_end) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+  unsigned char *out_row = out.data + row * out.stride;
+
+  // Indices (row, col) in the input image from where we get pixels
+  int idx_fract[2];
+  int idx_int[2];
+
+  unsigned char pix00[Depth], pix01[Depth], pix10[Depth], pix11[Depth];
+  // Parameters for bilinear interpolation
+  int bilin[2];
+  int weight[4];
+
+  idx_fract[0] = span.start[0] + col_begin * span.step[0];
+  idx_fract[1] = span.start[1] + col_begin * span.step[1];
+
+  for (int col = col_begin; col < col_end; col++) {
+    idx_int[0] = (idx_fract[0] >> FR_BITS) + half_height;
+    idx_int[1] = (idx_fract[1] >> FR_BITS) + half_width;
+
+    bilin[0] = idx_fract[0] & (ONE_FIXP - 1);
+    bilin[1] = idx_fract[1] & (ONE_FIXP - 1);
+
+    weight[0] = (ONE_FIXP - bilin[0]) * (ONE_FIXP - bilin[1]);
+    weight[1] = (ONE_FIXP - bilin[0]) * (bilin[1]);
+    weight[2] = (bilin[0]) * (ONE_FIXP - bilin[1]);
+    weight[3] = (bilin[0]) * (bilin[1]);
+
+    const unsigned char *src =
+        in.data + idx_int[0] * in.stride + idx_int[1] * Depth;
+
+    // Will be unrolled by the compiler:
+    for (int d = 0; d < Depth; d++)
+      pix00[d] = src[d];
+    for (int d = 0; d < Depth; d++)
+      pix01[d] = src[Depth + d];
+    for (int d = 0; d < Depth; d++)
+      pix10[d] = src[in.stride + d];
+    for (int d = 0; d < Depth; d++)
+      pix11[d] = src[in.stride + Depth + d];
+
+    for (int d = 0; d < Depth; d++) {
+      out_row[col * Depth + d] = static_cast<unsigned char>(
+          (pix00[d] * weight[0] + pix01[d] * weight[1] + pix10[d] * weight[2] +
+           pix11[d] * weight[3]) >>
+          (2 * FR_BITS));
+    }
+
+    idx_fract[0] += span.step[0];
+    idx_fract[1] += span.step[1];
+  }
+}
+
+// Source pixel (row, col), or the one standing for it under `mode` when it is
+// outside of the input (see border_index()), nullptr for BorderMode::constant
+template <size_t Depth, typename Pixel>
+inline const Pixel *border_pixel(const Frame<const Pixel> &in, int row,
+                                 int col, BorderMode mode) {
+  row = border_index(mode, row, in.height);
+  col = border_index(mode, col, in.width);
+  if (row < 0 || col < 0)
+    return nullptr;
+  return byte_offset(in.data, row * in.stride) + col * Depth;
+}
+
+// rotate_span() of columns [col_begin, col_end) whose 2x2 neighbourhood
+// crosses the input border, with its pixels given by border_pixel() (the
+// same interpolation, only the loads differ)
+template <size_t Depth, typename Pixel>
+inline void rotate_border_span(const Frame<const Pixel> &in,
+                               const Frame<Pixel> &out, int row,
+                               const RowSpan<float> &span,
+                               const Border &border, int col_begin,
+                               int col_end) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+  Pixel *out_row = byte_offset(out.data, row * out.stride);
+  float value = static_cast<float>(border.value);
+
+  for (int col = col_begin; col < col_end; col++) {
+    float idx_fract[2], idx_fract_round[2], bilin[2], weight[4];
+    int idx_int[2];
+
+    for (int k = 0; k < 2; k++) {
+      idx_fract[k] = span.start[k] + static_cast<float>(col) * span.step[k];
+      idx_fract_round[k] = floorf(idx_fract[k]);
+      bilin[k] = idx_fract[k] - idx_fract_round[k];
+    }
+    idx_int[0] = static_cast<int>(idx_fract_round[0]) + half_height;
+    idx_int[1] = static_cast<int>(idx_fract_round[1]) + half_width;
+
+    weight[0] = (1. - bilin[0]) * (1. - bilin[1]);
+    weight[1] = (1. - bilin[0]) * (bilin[1]);
+    weight[2] = (bilin[0]) * (1. - bilin[1]);
+    weight[3] = (bilin[0]) * (bilin[1]);
+
+    // 00, 01, 10 and 11 as in rotate_span()
+    const Pixel *pix[4];
+    for (int k = 0; k < 4; k++)
+      pix[k] = border_pixel<Depth>(in, idx_int[0] + (k >> 1),
+                                   idx_int[1] + (k & 1), border.mode);
+
+    for (int d = 0; d < Depth; d++) {
+      float v[4];
+      for (int k = 0; k < 4; k++)
+        v[k] = pix[k] ? static_cast<float>(pix[k][d]) : value;
+      out_row[col * Depth + d] = static_cast<Pixel>(
+          v[0] * weight[0] + v[1] * weight[1] + v[2] * weight[2] +
+          v[3] * weight[3]);
+    }
+  }
+}
+
+// Fixed-point counterpart of rotate_border_span()
+template <size_t Depth>
+inline void rotate_fxp_border_span(const Frame<const unsigned char> &in,
+                                   const Frame<unsigned char> &out, int row,
+                                   const RowSpan<int> &span,
+                                   const Border &border, int col_begin,
+                                   int col_end) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+  unsigned char *out_row = out.data + row * out.stride;
+  int idx_fract[2];
+
+  idx_fract[0] = span.start[0] + col_begin * span.step[0];
+  idx_fract[1] = span.start[1] + col_begin * span.step[1];
+
+  for (int col = col_begin; col < col_end; col++) {
+    int idx_int[2], bilin[2], weight[4];
+
+    idx_int[0] = (idx_fract[0] >> FR_BITS) + half_height;
+    idx_int[1] = (idx_fract[1] >> FR_BITS) + half_width;
+
+    bilin[0] = idx_fract[0] & (ONE_FIXP - 1);
+    bilin[1] = idx_fract[1] & (ONE_FIXP - 1);
+
+    weight[0] = (ONE_FIXP - bilin[0]) * (ONE_FIXP - bilin[1]);
+    weight[1] = (ONE_FIXP - bilin[0]) * (bilin[1]);
+    weight[2] = (bilin[0]) * (ONE_FIXP - bilin[1]);
+    weight[3] = (bilin[0]) * (bilin[1]);
+
+    const unsigned char *pix[4];
+    for (int k = 0; k < 4; k++)
+      pix[k] = border_pixel<Depth>(in, idx_int[0] + (k >> 1),
+                                   idx_int[1] + (k & 1), border.mode);
+
+    for (int d = 0; d < Depth; d++) {
+      int v[4];
+      for (int k = 0; k < 4; k++)
+        v[k] = pix[k] ? pix[k][d] : border.value;
+      out_row[col * Depth + d] = static_cast<unsigned char>(
+          (v[0] * weight[0] + v[1] * weight[1] + v[2] * weight[2] +
+           v[3] * weight[3]) >>
+          (2 * FR_BITS));
+    }
+
+    idx_fract[0] += span.step[0];
+    idx_fract[1] += span.step[1];
+  }
+}
+
+// Destination pixels of `row` outside of `span` under `border` (clip,
+// constant, replicate, reflect or wrap; padded is a clipped rotation of the
+// padded input). Those whose support misses the input are set to
+// border.value, the others are interpolated through border_span(first, last):
+// all of them for replicate, reflect and wrap, the ones of touch() (the span
+// for the support radius, a negative margin) for constant and none for clip.
+template <typename T, size_t Depth, typename Pixel, typename Touch,
+          typename BorderSpan>
+inline void rotate_outside(const Frame<Pixel> &out, int row,
+                           const RowSpan<T> &span, const Border &border,
+                           Touch touch, BorderSpan border_span) {
+  Pixel *out_row = byte_offset(out.data, row * out.stride);
+  Pixel value = static_cast<Pixel>(border.value);
+  int begin = span.col_begin, end = span.col_end; // interpolated columns
+
+  if (border.mode == BorderMode::constant) {
+    RowSpan<T> t = touch(row);
+    begin = t.col_begin;
+    end = t.col_end;
+  } else if (border.mode != BorderMode::clip) {
+    begin = 0;
+    end = out.width;
+  }
+  if (span.col_begin < span.col_end) {
+    begin = std::min(begin, span.col_begin);
+    end = std::max(end, span.col_end);
+    border_span(begin, span.col_begin);
+    border_span(span.col_end, end);
+  } else if (begin < end) {
+    border_span(begin, end);
+  } else {
+    begin = end = 0;
+  }
+  // All-zero bytes are 0 for floats too
+  std::fill_n(out_row, begin * Depth, value);
+  std::fill_n(out_row + end * Depth, (out.width - end) * Depth, value);
+}
+
+// Rows per task of the multithreaded untiled rotations (see
+// parallel_rows()), tiled ones take a row of tiles at a time
+static const size_t rotation_grain = 16U;
+
+// Walks destination rows [row_begin, row_end), calling outside(row, span)
+// for the pixels outside of each row's span (given by setup(row)) and
+// kernel(row, span) for the pixels inside. With tile_size == 0 the
+// destination is traversed row by row.
+// Otherwise it is traversed in tile_size x tile_size tiles: for large
+// rotations the source footprint of a destination row runs diagonally across
+// many source rows, while the footprint of a tile is a compact patch that
+// stays in cache while the tile is processed.
+template <typename T, typename Pixel, typename Setup, typename Kernel,
+          typename Outside>
+inline void rotate_rows(const Frame<Pixel> &out, size_t tile_size,
+                        int row_begin, int row_end, Setup setup, Kernel kernel,
+                        Outside outside) {
+  int width = out.width;
+  int tile = static_cast<int>(tile_size);
+  int band_height = (tile > 0) ? tile : 1;
+  std::vector<RowSpan<T> > spans(band_height);
+
+  IMAGEPROC_TIMER(rotate);
+  IMAGEPROC_COUNT(rotate_pixels, width * (row_end - row_begin));
+  for (int band = row_begin; band < row_end; band += band_height) {
+    int band_end = std::min(row_end, band + band_height);
+
+    for (int row = band; row < band_end; row++) {
+      RowSpan<T> &span = spans[row - band];
+
+      span = setup(row);
+      IMAGEPROC_COUNT(rotate_in_bounds, span.col_end - span.col_begin);
+      outside(row, span);
+    }
+
+    if (tile <= 0) {
+      kernel(band, spans[0]);
+      continue;
+    }
+
+    for (int tile_col = 0; tile_col < width; tile_col += tile) {
+      for (int row = band; row < band_end; row++) {
+        RowSpan<T> span = spans[row - band];
+
+        span.col_begin = std::max(span.col_begin, tile_col);
+        span.col_end = std::min(span.col_end, tile_col + tile);
+        if (span.col_begin < span.col_end)
+          kernel(row, span);
+      }
+    }
+  }
+}
+
+// Exact integer remap (see orientation.cc): destination pixel (row, col) is a
+// copy of source pixel
+//   (src[0] + row * row_step[0] + col * col_step[0],
+//    src[1] + row * row_step[1] + col * col_step[1])
+// where every step is -1, 0 or 1
+struct ExactRemap {
+  int src[2];
+  int row_step[2];
+  int col_step[2];
+};
+
+// True if angle is a multiple of pi/2 (up to float rounding), turns is then
+// the number of quarter turns in [0, 4)
+bool quarter_turns(float angle, int &turns);
+
+// Lossless rotate() by turns * pi/2 of destination rows [row_begin, row_end):
+// same geometry and output size, but the destination pixels are plain copies
+// (including those that come from the last source row and column) and no
+// trigonometry is involved. Depth is the pixel size in bytes: 1 to 4, or up
+// to 16 for 16-bit and float pixels seen through byte_frame(). Destination
+// pixels outside of the input are border.value, or copies of the pixels
+// standing for their source under replicate, reflect and wrap.
+template <size_t Depth>
+void rotate_quarter_turns(const Frame<const unsigned char> &in,
+                          const Frame<unsigned char> &out, int turns,
+                          const Border &border, int row_begin, int row_end);
+
+// Destination rows [row_begin, row_end) of rotate() and rotate_fxp() of 8-bit
+// pixels of `depth` channels, the other rows of out are left alone. Row r is
+// written at out.data + r * out.stride, so a frame with stride 0 takes one
+// row at a time into a row buffer (see fused.cc).
+void rotate_row_range(const Frame<const unsigned char> &in,
+                      const Frame<unsigned char> &out, size_t depth,
+                      float angle, Interpolation interp, int row_begin,
+                      int row_end);
+void rotate_fxp_row_range(const Frame<const unsigned char> &in,
+                          const Frame<unsigned char> &out, size_t depth,
+                          float angle, Interpolation interp, int row_begin,
+                          int row_end);
+
+#ifdef IMAGEPROC_X86_SIMD
+// Vectorized span kernels. Each one rotates destination pixels of `row` from
+// span.col_begin on, 8 (AVX2) or 4 (SSE4.1) at a time, and returns the first
+// column it did not process; the caller finishes the span with the scalar
+// functions above. Every lane loads 4 bytes per source pixel: for RGBA that
+// is the whole pixel, for 1 and 2 channels its right neighbour too.
+//
+// The fixed-point kernels are bit-exact with rotate_fxp_span(). The
+// floating-point kernels evaluate the same float expressions as rotate_span()
+// in the same order; they can differ from it by 1 only when a fractional
+// source coordinate is so close to an integer (below 2^-24) that 1 - fraction
+// is not representable in single precision.
+template <size_t Depth>
+int rotate_span_avx2(const Frame<const unsigned char> &in,
+                     const Frame<unsigned char> &out, int row,
+                     const RowSpan<float> &span);
+template <size_t Depth>
+int rotate_fxp_span_avx2(const Frame<const unsigned char> &in,
+                         const Frame<unsigned char> &out, int row,
+                         const RowSpan<int> &span);
+template <size_t Depth>
+int rotate_span_sse41(const Frame<const unsigned char> &in,
+                      const Frame<unsigned char> &out, int row,
+                      const RowSpan<float> &span);
+template <size_t Depth>
+int rotate_fxp_span_sse41(const Frame<const unsigned char> &in,
+                          const Frame<unsigned char> &out, int row,
+                          const RowSpan<int> &span);
+
+// Same as rotate_span_avx2() for 16-bit and float pixels, one gather per
+// channel and neighbour. There are no SSE4.1 versions: without gathers they
+// are no faster than the scalar kernel.
+template <size_t Depth>
+int rotate_span_avx2(const Frame<const std::uint16_t> &in,
+                     const Frame<std::uint16_t> &out, int row,
+                     const RowSpan<float> &span);
+template <size_t Depth>
+int rotate_span_avx2(const Frame<const float> &in, const Frame<float> &out,
+                     int row, const RowSpan<float> &span);
+#endif
+
+} /* namespace imageproc */
+
+#endif /* __ROTATION_KERNELS_H */
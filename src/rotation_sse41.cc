@@ -0,0 +1,240 @@
+// SSE4.1 rotation kernels, this file is compiled with -msse4.1
+#include <smmintrin.h>
+#include <cstring>
+#include "rotation_kernels.h"
+
+namespace imageproc {
+
+// SSE has no gather instruction: the 4 bytes starting at every lane's byte
+// offset are loaded one lane at a time
+static inline __m128i gather_bytes(const unsigned char *base, __m128i offset) {
+  alignas(16) int off[4];
+  int val[4];
+
+  _mm_store_si128(reinterpret_cast<__m128i *>(off), offset);
+  for (int l = 0; l < 4; l++)
+    memcpy(&val[l], base + off[l], 4);
+  return _mm_setr_epi32(val[0], val[1], val[2], val[3]);
+}
+
+// Byte `d` of every 32-bit lane
+static inline __m128i channel(__m128i v, int d) {
+  return _mm_and_si128(_mm_srli_epi32(v, 8 * d), _mm_set1_epi32(0xff));
+}
+
+// Byte offsets of the top-left source pixels, false if a 4-byte load from any
+// of them (or their neighbours) would run past the end of the input buffer;
+// such blocks (at most a few pixels near the last source row) go to the
+// scalar path
+template <size_t Depth>
+static inline bool source_offset(__m128i idx_row, __m128i idx_col,
+                                 const Frame<const unsigned char> &in,
+                                 __m128i &offset) {
+  offset = _mm_add_epi32(_mm_mullo_epi32(idx_row, _mm_set1_epi32(in.stride)),
+                         _mm_mullo_epi32(idx_col, _mm_set1_epi32(Depth)));
+  // Last byte read for the lane is offset + stride + Depth + 3
+  int limit = (in.height - 2) * in.stride + (in.width - 1) * Depth - 3;
+  __m128i safe = _mm_cmpgt_epi32(_mm_set1_epi32(limit), offset);
+  return _mm_movemask_ps(_mm_castsi128_ps(safe)) == 0xf;
+}
+
+// Gathers the 2x2 neighbourhoods, g01 and g11 are the right neighbours
+template <size_t Depth>
+static inline void gather_neighbourhood(const unsigned char *input, int stride,
+                                        __m128i offset, __m128i &g00,
+                                        __m128i &g01, __m128i &g10,
+                                        __m128i &g11) {
+  g00 = gather_bytes(input, offset);
+  g10 = gather_bytes(input + stride, offset);
+  if (Depth <= 2) { // right neighbours are the next bytes of the same load
+    g01 = _mm_srli_epi32(g00, 8 * Depth);
+    g11 = _mm_srli_epi32(g10, 8 * Depth);
+  } else {
+    g01 = gather_bytes(input + Depth, offset);
+    g11 = gather_bytes(input + stride + Depth, offset);
+  }
+}
+
+// Packs the low Depth bytes of the 4 lanes into out
+template <size_t Depth>
+static inline void store_pixels(unsigned char *out, __m128i pix) {
+  if (Depth == 1) {
+    int packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(
+        pix, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                           -1, -1)));
+    memcpy(out, &packed, 4);
+  } else if (Depth == 2) {
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out),
+                     _mm_shuffle_epi8(pix, _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12,
+                                                         13, -1, -1, -1, -1,
+                                                         -1, -1, -1, -1)));
+  } else if (Depth == 3) {
+    alignas(16) unsigned char packed[16];
+    _mm_store_si128(reinterpret_cast<__m128i *>(packed),
+                    _mm_shuffle_epi8(pix, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+                                                        10, 12, 13, 14, -1, -1,
+                                                        -1, -1)));
+    memcpy(out, packed, 12);
+  } else if (Depth == 4) { // the lanes are the pixels
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), pix);
+  }
+}
+
+template <size_t Depth>
+int rotate_fxp_span_sse41(const Frame<const unsigned char> &in,
+                          const Frame<unsigned char> &out, int row,
+                          const RowSpan<int> &span) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+
+  const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i fract_mask = _mm_set1_epi32(ONE_FIXP - 1);
+  const __m128i one = _mm_set1_epi32(ONE_FIXP);
+  const __m128i step0 = _mm_set1_epi32(4 * span.step[0]);
+  const __m128i step1 = _mm_set1_epi32(4 * span.step[1]);
+
+  unsigned char *out_row = out.data + row * out.stride;
+  int col = span.col_begin;
+
+  // Source coordinates of the 4 lanes, stepped by 4 columns at a time
+  __m128i idx_fract0 =
+      _mm_add_epi32(_mm_set1_epi32(span.start[0] + col * span.step[0]),
+                    _mm_mullo_epi32(lane, _mm_set1_epi32(span.step[0])));
+  __m128i idx_fract1 =
+      _mm_add_epi32(_mm_set1_epi32(span.start[1] + col * span.step[1]),
+                    _mm_mullo_epi32(lane, _mm_set1_epi32(span.step[1])));
+
+  for (; col + 4 <= span.col_end; col += 4) {
+    __m128i idx_int0 = _mm_add_epi32(_mm_srai_epi32(idx_fract0, FR_BITS),
+                                     _mm_set1_epi32(half_height));
+    __m128i idx_int1 = _mm_add_epi32(_mm_srai_epi32(idx_fract1, FR_BITS),
+                                     _mm_set1_epi32(half_width));
+    __m128i offset;
+
+    if (!source_offset<Depth>(idx_int0, idx_int1, in, offset)) {
+      rotate_fxp_span<Depth>(in, out, row, span, col, col + 4);
+    } else {
+      __m128i bilin0 = _mm_and_si128(idx_fract0, fract_mask);
+      __m128i bilin1 = _mm_and_si128(idx_fract1, fract_mask);
+      // (ONE - bilin1, bilin1) pairs for the horizontal 16-bit multiply-add
+      __m128i weight_h = _mm_or_si128(_mm_sub_epi32(one, bilin1),
+                                      _mm_slli_epi32(bilin1, 16));
+      __m128i weight_top = _mm_sub_epi32(one, bilin0);
+      __m128i g00, g01, g10, g11;
+      gather_neighbourhood<Depth>(in.data, in.stride, offset, g00, g01, g10,
+                                  g11);
+
+      __m128i result = _mm_setzero_si128();
+      for (int d = 0; d < Depth; d++) {
+        // (p00 * (ONE - b1) + p01 * b1) * (ONE - b0) +
+        // (p10 * (ONE - b1) + p11 * b1) * b0 is exactly the sum of the four
+        // products of the scalar kernel
+        __m128i top = _mm_madd_epi16(
+            _mm_or_si128(channel(g00, d), _mm_slli_epi32(channel(g01, d), 16)),
+            weight_h);
+        __m128i bottom = _mm_madd_epi16(
+            _mm_or_si128(channel(g10, d), _mm_slli_epi32(channel(g11, d), 16)),
+            weight_h);
+        __m128i pix =
+            _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi32(top, weight_top),
+                                         _mm_mullo_epi32(bottom, bilin0)),
+                           2 * FR_BITS);
+        result = _mm_or_si128(result, _mm_slli_epi32(pix, 8 * d));
+      }
+      store_pixels<Depth>(out_row + col * Depth, result);
+    }
+
+    idx_fract0 = _mm_add_epi32(idx_fract0, step0);
+    idx_fract1 = _mm_add_epi32(idx_fract1, step1);
+  }
+  return col;
+}
+
+template <size_t Depth>
+int rotate_span_sse41(const Frame<const unsigned char> &in,
+                      const Frame<unsigned char> &out, int row,
+                      const RowSpan<float> &span) {
+  int half_width = in.width >> 1;
+  int half_height = in.height >> 1;
+
+  const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 start0 = _mm_set1_ps(span.start[0]);
+  const __m128 start1 = _mm_set1_ps(span.start[1]);
+  const __m128 step0 = _mm_set1_ps(span.step[0]);
+  const __m128 step1 = _mm_set1_ps(span.step[1]);
+
+  unsigned char *out_row = out.data + row * out.stride;
+  int col = span.col_begin;
+
+  for (; col + 4 <= span.col_end; col += 4) {
+    __m128 c = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(col), lane));
+    __m128 idx_fract0 = _mm_add_ps(start0, _mm_mul_ps(c, step0));
+    __m128 idx_fract1 = _mm_add_ps(start1, _mm_mul_ps(c, step1));
+    __m128 idx_round0 = _mm_floor_ps(idx_fract0);
+    __m128 idx_round1 = _mm_floor_ps(idx_fract1);
+    __m128i idx_int0 = _mm_add_epi32(_mm_cvttps_epi32(idx_round0),
+                                     _mm_set1_epi32(half_height));
+    __m128i idx_int1 = _mm_add_epi32(_mm_cvttps_epi32(idx_round1),
+                                     _mm_set1_epi32(half_width));
+    __m128i offset;
+
+    if (!source_offset<Depth>(idx_int0, idx_int1, in, offset)) {
+      rotate_span<Depth>(in, out, row, span, col, col + 4);
+      continue;
+    }
+
+    __m128 bilin0 = _mm_sub_ps(idx_fract0, idx_round0);
+    __m128 bilin1 = _mm_sub_ps(idx_fract1, idx_round1);
+    __m128 weight0 =
+        _mm_mul_ps(_mm_sub_ps(one, bilin0), _mm_sub_ps(one, bilin1));
+    __m128 weight1 = _mm_mul_ps(_mm_sub_ps(one, bilin0), bilin1);
+    __m128 weight2 = _mm_mul_ps(bilin0, _mm_sub_ps(one, bilin1));
+    __m128 weight3 = _mm_mul_ps(bilin0, bilin1);
+    __m128i g00, g01, g10, g11;
+    gather_neighbourhood<Depth>(in.data, in.stride, offset, g00, g01, g10,
+                                  g11);
+
+    __m128i result = _mm_setzero_si128();
+    for (int d = 0; d < Depth; d++) {
+      // Same evaluation order as the scalar kernel
+      __m128 pix = _mm_add_ps(
+          _mm_add_ps(
+              _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(channel(g00, d)), weight0),
+                         _mm_mul_ps(_mm_cvtepi32_ps(channel(g01, d)), weight1)),
+              _mm_mul_ps(_mm_cvtepi32_ps(channel(g10, d)), weight2)),
+          _mm_mul_ps(_mm_cvtepi32_ps(channel(g11, d)), weight3));
+      result =
+          _mm_or_si128(result, _mm_slli_epi32(_mm_cvttps_epi32(pix), 8 * d));
+    }
+    store_pixels<Depth>(out_row + col * Depth, result);
+  }
+  return col;
+}
+
+template int rotate_span_sse41<1U>(const Frame<const unsigned char> &,
+                                   const Frame<unsigned char> &, int,
+                                   const RowSpan<float> &);
+template int rotate_span_sse41<2U>(const Frame<const unsigned char> &,
+                                   const Frame<unsigned char> &, int,
+                                   const RowSpan<float> &);
+template int rotate_span_sse41<3U>(const Frame<const unsigned char> &,
+                                   const Frame<unsigned char> &, int,
+                                   const RowSpan<float> &);
+template int rotate_span_sse41<4U>(const Frame<const unsigned char> &,
+                                   const Frame<unsigned char> &, int,
+                                   const RowSpan<float> &);
+template int rotate_fxp_span_sse41<1U>(const Frame<const unsigned char> &,
+                                       const Frame<unsigned char> &, int,
+                                       const RowSpan<int> &);
+template int rotate_fxp_span_sse41<2U>(const Frame<const unsigned char> &,
+                                       const Frame<unsigned char> &, int,
+                                       const RowSpan<int> &);
+template int rotate_fxp_span_sse41<3U>(const Frame<const unsigned char> &,
+                                       const Frame<unsigned char> &, int,
+                                       const RowSpan<int> &);
+template int rotate_fxp_span_sse41<4U>(const Frame<const unsigned char> &,
+                                       const Frame<unsigned char> &, int,
+                                       const RowSpan<int> &);
+
+} /* namespace imageproc */
@@ -0,0 +1,167 @@
+// AVX2 direct-window sigma filter kernels, this file is compiled with -mavx2
+#include <immintrin.h>
+#include "sigma_kernels.h"
+
+namespace imageproc {
+
+size_t sigma_window_avx2(const float *const window[], size_t win_rows,
+                         const float *center, float *output, size_t begin,
+                         size_t end, size_t depth, size_t kernel_size,
+                         float sigma) {
+  const __m256 sign = _mm256_set1_ps(-0.f);
+  const __m256 sigma_v = _mm256_set1_ps(sigma);
+  const __m256i one = _mm256_set1_epi32(1);
+  size_t win_cols = 2 * kernel_size + 1;
+  size_t e = begin;
+
+  for (; e + 8 <= end; e += 8) {
+    __m256 pix_val = _mm256_loadu_ps(center + e);
+    __m256 sum = _mm256_setzero_ps();
+    __m256i n = _mm256_setzero_si256();
+
+    for (size_t r = 0U; r < win_rows; r++) {
+      // Same element of the leftmost pixel of the window
+      const float *src = window[r] + e - kernel_size * depth;
+      for (size_t c = 0U; c < win_cols; c++, src += depth) {
+        __m256 value = _mm256_loadu_ps(src);
+        // |value - pix_val| <= sigma, as std::fabs() in the scalar code
+        __m256 in_range = _mm256_cmp_ps(
+            _mm256_andnot_ps(sign, _mm256_sub_ps(value, pix_val)), sigma_v,
+            _CMP_LE_OQ);
+        sum = _mm256_add_ps(sum, _mm256_and_ps(in_range, value));
+        n = _mm256_add_epi32(
+            n, _mm256_and_si256(_mm256_castps_si256(in_range), one));
+      }
+    }
+    _mm256_storeu_ps(output + e, _mm256_div_ps(sum, _mm256_cvtepi32_ps(n)));
+  }
+  return e;
+}
+
+size_t sigma_window_avx2(const std::uint16_t *const window[], size_t win_rows,
+                         const std::uint16_t *center, std::uint16_t *output,
+                         size_t begin, size_t end, size_t depth,
+                         size_t kernel_size, std::uint16_t sigma) {
+  // Sums are kept in 32-bit lanes, enough for windows of up to 65537 pixels
+  const __m256i sigma_plus = _mm256_set1_epi32(sigma + 1);
+  size_t win_cols = 2 * kernel_size + 1;
+  alignas(32) std::uint32_t sums[8], counts[8];
+  size_t e = begin;
+
+  if (win_rows * win_cols > 65537U)
+    return begin;
+
+  for (; e + 8 <= end; e += 8) {
+    __m256i pix_val = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(center + e)));
+    __m256i sum = _mm256_setzero_si256();
+    __m256i n = _mm256_setzero_si256();
+
+    for (size_t r = 0U; r < win_rows; r++) {
+      const std::uint16_t *src = window[r] + e - kernel_size * depth;
+      for (size_t c = 0U; c < win_cols; c++, src += depth) {
+        __m256i value = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+        // All ones where |value - pix_val| <= sigma
+        __m256i in_range = _mm256_cmpgt_epi32(
+            sigma_plus, _mm256_abs_epi32(_mm256_sub_epi32(value, pix_val)));
+        sum = _mm256_add_epi32(sum, _mm256_and_si256(in_range, value));
+        n = _mm256_sub_epi32(n, in_range);
+      }
+    }
+    // No integer division in AVX2, the 8 means are rounded as in the scalar
+    // code
+    _mm256_store_si256(reinterpret_cast<__m256i *>(sums), sum);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(counts), n);
+    for (int l = 0; l < 8; l++)
+      output[e + l] = static_cast<std::uint16_t>(
+          (static_cast<std::uint64_t>(sums[l]) + (counts[l] >> 1)) /
+          counts[l]);
+  }
+  return e;
+}
+
+// 32 elements at a time: in-range masks from saturated byte differences,
+// masked sums in 16-bit lanes (at most 225 * 255) and counts in 8-bit lanes
+// (at most 225), then (sum + n / 2) / n in single precision, which is exact:
+// the quotient of integers below 2^17 and 226 never rounds across an
+// integer. Kern is kernel_size when known at compile time (0 otherwise).
+template <size_t Kern>
+static size_t sigma_window_u8(const unsigned char *const window[],
+                              size_t win_rows, const unsigned char *center,
+                              unsigned char *output, size_t begin, size_t end,
+                              size_t depth, size_t kernel_size,
+                              unsigned char sigma) {
+  const size_t kern = Kern ? Kern : kernel_size;
+  const size_t win_cols = 2 * kern + 1;
+  const __m256i sigma_v = _mm256_set1_epi8(static_cast<char>(sigma));
+  const __m256i zero = _mm256_setzero_si256();
+  size_t e = begin;
+
+  for (; e + 32 <= end; e += 32) {
+    __m256i pix_val =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(center + e));
+    __m256i sum_lo = zero, sum_hi = zero, n = zero;
+
+    for (size_t r = 0U; r < win_rows; r++) {
+      const unsigned char *src = window[r] + e - kern * depth;
+      for (size_t c = 0U; c < win_cols; c++, src += depth) {
+        __m256i value =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+        __m256i diff = _mm256_or_si256(_mm256_subs_epu8(value, pix_val),
+                                       _mm256_subs_epu8(pix_val, value));
+        // All ones where |value - pix_val| <= sigma
+        __m256i in_range =
+            _mm256_cmpeq_epi8(_mm256_min_epu8(diff, sigma_v), diff);
+        __m256i masked = _mm256_and_si256(in_range, value);
+        sum_lo = _mm256_add_epi16(sum_lo, _mm256_unpacklo_epi8(masked, zero));
+        sum_hi = _mm256_add_epi16(sum_hi, _mm256_unpackhi_epi8(masked, zero));
+        n = _mm256_sub_epi8(n, in_range);
+      }
+    }
+
+    // Unpacking works within 128-bit lanes, the quarters of the results come
+    // back in the same order as the sums
+    __m256i n_lo = _mm256_unpacklo_epi8(n, zero);
+    __m256i n_hi = _mm256_unpackhi_epi8(n, zero);
+    __m256i mean16[2];
+    for (int half = 0; half < 2; half++) {
+      __m256i sum16 = half ? sum_hi : sum_lo;
+      __m256i n16 = half ? n_hi : n_lo;
+      __m256i num16 = _mm256_add_epi16(sum16, _mm256_srli_epi16(n16, 1));
+      __m256i q[2];
+      for (int quarter = 0; quarter < 2; quarter++) {
+        __m256i num = quarter ? _mm256_unpackhi_epi16(num16, zero)
+                              : _mm256_unpacklo_epi16(num16, zero);
+        __m256i den = quarter ? _mm256_unpackhi_epi16(n16, zero)
+                              : _mm256_unpacklo_epi16(n16, zero);
+        q[quarter] = _mm256_cvttps_epi32(_mm256_div_ps(
+            _mm256_cvtepi32_ps(num), _mm256_cvtepi32_ps(den)));
+      }
+      mean16[half] = _mm256_packus_epi32(q[0], q[1]);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + e),
+                        _mm256_packus_epi16(mean16[0], mean16[1]));
+  }
+  return e;
+}
+
+size_t sigma_window_avx2(const unsigned char *const window[], size_t win_rows,
+                         const unsigned char *center, unsigned char *output,
+                         size_t begin, size_t end, size_t depth,
+                         size_t kernel_size, unsigned char sigma) {
+  switch (kernel_size) {
+  case 1U:
+    return sigma_window_u8<1U>(window, win_rows, center, output, begin, end,
+                               depth, kernel_size, sigma);
+  case 2U:
+    return sigma_window_u8<2U>(window, win_rows, center, output, begin, end,
+                               depth, kernel_size, sigma);
+  }
+  if (win_rows * (2 * kernel_size + 1) > u8_window_max)
+    return begin;
+  return sigma_window_u8<0U>(window, win_rows, center, output, begin, end,
+                             depth, kernel_size, sigma);
+}
+
+} /* namespace imageproc */
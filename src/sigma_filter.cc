@@ -1,27 +1,259 @@
 #include <algorithm>
+#include <cstring> // memcpy, memset
+#include <vector>
 #include "imageproc.h"
+#include "frame.h"
+#include "histogram.h"
+#include "parallel.h"
+#include "sigma_stream.h"
+#include "stats.h"
 
 namespace imageproc {
 
-// Forward declaration
-template <size_t Depth>
+// Sigma ranges (2*sigma + 1 bins) up to this width are scanned bin by bin,
+// wider ones are answered from the coarse level of the histogram.
+static const unsigned coarse_min_range = 48U;
+
+template <typename Pixel> static Rows<Pixel> make_rows(const Frame<Pixel> &f) {
+  return Rows<Pixel>{ f.data, f.stride, 0 };
+}
+
+// Largest number of pixels that can fall into one window; 16-bit bins are
+// enough for the kernel sizes used in practice and halve the footprint of the
+// per-column histograms.
+static bool use_narrow_bins(size_t width, size_t height, size_t kernel_size) {
+  size_t win_rows = std::min(height, 2 * kernel_size + 1);
+  size_t win_cols = std::min(width, 2 * kernel_size + 1);
+  return win_rows * win_cols <= UINT16_MAX;
+}
+
+static bool use_coarse(unsigned char sigma) {
+  return 2U * sigma + 1U > coarse_min_range;
+}
+
+// SigmaEngine::automatic picks the vectorized direct window up to this kernel
+// size, the largest whose window (225 pixels) the SSE4.1 and AVX2 kernels sum
+// in 16-bit lanes; up to there they beat the histograms at any sigma (see the
+// sigma_window_simd benchmark)
+static const size_t direct_window_max_kernel = 7U;
+
+static SigmaEngine resolve_engine(SigmaEngine engine, size_t kernel_size) {
+  if (engine != SigmaEngine::automatic)
+    return engine;
+  if (kernel_size <= direct_window_max_kernel && get_simd() != Simd::none)
+    return SigmaEngine::direct_window;
+  return SigmaEngine::row_histogram;
+}
+
+// Forward declarations. Depth is the number of channels of the pixels, the
+// first Channels of them are filtered and the rest (alpha) are copied.
+// Padded: windows are never clipped, the kernel_size rows and columns around
+// the image are read from its buffer (BorderMode::padded).
+template <size_t Depth, size_t Channels, bool Coarse, bool Padded>
 static void
-sigma_filter(const unsigned char *input, unsigned char *output, size_t width,
-             size_t height, unsigned char sigma,
-             size_t kernel_size // kernel width == height == 2*kern_size + 1
-             );
+sigma_filter_rows(const Rows<const unsigned char> &in,
+                  const Rows<unsigned char> &out, size_t width, size_t height,
+                  unsigned char sigma,
+                  size_t kernel_size, // kernel width == height ==
+                                      // 2*kern_size + 1
+                  size_t row_begin, size_t row_end);
+
+template <size_t Depth, size_t Channels, typename Count, bool Coarse,
+          bool Padded>
+static void sigma_filter_column_hist(const Rows<const unsigned char> &in,
+                                     const Rows<unsigned char> &out,
+                                     size_t width, size_t height,
+                                     unsigned char sigma, size_t kernel_size,
+                                     size_t row_begin, size_t row_end);
+
+template <size_t Depth, size_t Channels, bool Coarse, bool Padded>
+static void sigma_filter_band(const Frame<const unsigned char> &in,
+                              const Frame<unsigned char> &out,
+                              unsigned char sigma, size_t kernel_size,
+                              size_t row_begin, size_t row_end,
+                              SigmaEngine engine, bool narrow_bins) {
+  Rows<const unsigned char> in_rows = make_rows(in);
+  Rows<unsigned char> out_rows = make_rows(out);
+
+  switch (engine) {
+  case SigmaEngine::automatic: // resolved by the callers
+  case SigmaEngine::row_histogram:
+    sigma_filter_rows<Depth, Channels, Coarse, Padded>(
+        in_rows, out_rows, in.width, in.height, sigma, kernel_size,
+        row_begin, row_end);
+    break;
+  case SigmaEngine::column_histogram:
+    if (narrow_bins)
+      sigma_filter_column_hist<Depth, Channels, std::uint16_t, Coarse,
+                               Padded>(in_rows, out_rows, in.width, in.height,
+                                       sigma, kernel_size, row_begin,
+                                       row_end);
+    else
+      sigma_filter_column_hist<Depth, Channels, std::uint32_t, Coarse,
+                               Padded>(in_rows, out_rows, in.width, in.height,
+                                       sigma, kernel_size, row_begin,
+                                       row_end);
+    break;
+  case SigmaEngine::direct_window:
+    sigma_window_rows(in_rows, out_rows, in.width, in.height, Depth, sigma,
+                      kernel_size,
+                      Channels < Depth ? AlphaMode::pass_through
+                                       : AlphaMode::filter,
+                      row_begin, row_end, Padded);
+    break;
+  }
+}
+
+template <size_t Depth, size_t Channels, bool Padded>
+static void sigma_filter_bands(const Frame<const unsigned char> &in,
+                               const Frame<unsigned char> &out,
+                               unsigned char sigma, size_t kernel_size,
+                               size_t num_threads, SigmaEngine engine) {
+  // Padded windows are never clipped
+  size_t pad = Padded ? 2 * kernel_size : 0U;
+  bool narrow_bins =
+      use_narrow_bins(in.width + pad, in.height + pad, kernel_size);
+  bool coarse = use_coarse(sigma);
+
+  parallel_bands(in.height, num_threads, [&](size_t begin, size_t end) {
+    if (coarse)
+      sigma_filter_band<Depth, Channels, true, Padded>(
+          in, out, sigma, kernel_size, begin, end, engine, narrow_bins);
+    else
+      sigma_filter_band<Depth, Channels, false, Padded>(
+          in, out, sigma, kernel_size, begin, end, engine, narrow_bins);
+  });
+}
+
+// sigma_filter_bands() of the Depth and Channels of the image
+template <bool Padded>
+static void sigma_filter_channels(const Frame<const unsigned char> &in,
+                                  const Frame<unsigned char> &out,
+                                  size_t depth, AlphaMode alpha,
+                                  unsigned char sigma, size_t kernel_size,
+                                  size_t num_threads, SigmaEngine engine) {
+  bool filter_alpha = alpha == AlphaMode::filter;
+
+  if (depth == 1)
+    sigma_filter_bands<1U, 1U, Padded>(in, out, sigma, kernel_size,
+                                       num_threads, engine);
+  else if (depth == 2 && filter_alpha)
+    sigma_filter_bands<2U, 2U, Padded>(in, out, sigma, kernel_size,
+                                       num_threads, engine);
+  else if (depth == 2)
+    sigma_filter_bands<2U, 1U, Padded>(in, out, sigma, kernel_size,
+                                       num_threads, engine);
+  else if (depth == 3)
+    sigma_filter_bands<3U, 3U, Padded>(in, out, sigma, kernel_size,
+                                       num_threads, engine);
+  else if (depth == 4 && filter_alpha)
+    sigma_filter_bands<4U, 4U, Padded>(in, out, sigma, kernel_size,
+                                       num_threads, engine);
+  else if (depth == 4)
+    sigma_filter_bands<4U, 3U, Padded>(in, out, sigma, kernel_size,
+                                       num_threads, engine);
+}
 
 void
 sigma_filter(const unsigned char *input, unsigned char *output, size_t width,
              size_t height, size_t depth, unsigned char sigma,
-             size_t kernel_size // kernel width == height == 2*kern_size + 1
-             ) {
-  if (depth == 1) {
-    sigma_filter<1U>(input, output, width, height, sigma, kernel_size);
-  } else if (depth == 3) {
-    sigma_filter<3U>(input, output, width, height, sigma, kernel_size);
-  } else
-    std::cerr << "Depth should be either 1 (grayscale) or 3 (rgb).\n";
+             size_t kernel_size, // kernel width == height == 2*kern_size + 1
+             size_t num_threads, SigmaEngine engine, AlphaMode alpha) {
+  sigma_filter(ConstImageView(input, width, height, depth),
+               ImageView(output, width, height, depth), sigma, kernel_size,
+               num_threads, engine, alpha);
+}
+
+// Input row `row` (any index, see border_index()) extended by kernel_size
+// pixels on each side under `border`
+static void extend_row(ConstImageView input, const Border &border, int row,
+                       size_t kernel_size, unsigned char *dst) {
+  int width = static_cast<int>(input.width);
+  int kern = static_cast<int>(kernel_size);
+  size_t depth = input.channels;
+  int src_row = border_index(border.mode, row, static_cast<int>(input.height));
+
+  if (src_row < 0) {
+    memset(dst, border.value, (input.width + 2 * kernel_size) * depth);
+    return;
+  }
+  const unsigned char *src = input.data + src_row * input.stride;
+  auto extend = [&](int col) {
+    int src_col = border_index(border.mode, col, width);
+    unsigned char *pix = dst + (col + kern) * depth;
+    if (src_col < 0)
+      memset(pix, border.value, depth);
+    else
+      memcpy(pix, src + src_col * depth, depth);
+  };
+
+  for (int col = -kern; col < 0; col++)
+    extend(col);
+  memcpy(dst + kernel_size * depth, src, input.width * depth);
+  for (int col = width; col < width + kern; col++)
+    extend(col);
+}
+
+// sigma_filter() with the constant, replicate, reflect and wrap border modes.
+// The engine filters the input extended by kernel_size pixels on every side,
+// streamed a row at a time (see sigma_stream.h): every window of the output
+// is then complete, and the border cases of the engine only concern the
+// extension, which is dropped.
+static void sigma_filter_border(ConstImageView input, ImageView output,
+                                unsigned char sigma, size_t kernel_size,
+                                size_t num_threads, SigmaEngine engine,
+                                AlphaMode alpha, const Border &border) {
+  size_t depth = input.channels;
+  size_t width = input.width + 2 * kernel_size;
+  size_t height = input.height + 2 * kernel_size;
+  size_t margin = kernel_size * depth, row_bytes = input.width * depth;
+
+  parallel_bands(input.height, num_threads, [&](size_t begin, size_t end) {
+    // Output rows [begin, end), rows [begin + kernel_size, end + kernel_size)
+    // of the extended image
+    std::unique_ptr<SigmaFilterStream::Impl> stream(make_sigma_stream(
+        width, height, depth, sigma,
+        [&](size_t row, const unsigned char *data) {
+          memcpy(output.data + (row - kernel_size) * output.stride,
+                 data + margin, row_bytes);
+        },
+        kernel_size, engine, alpha, begin + kernel_size, end + kernel_size));
+
+    for (size_t r = stream->in_begin; r < stream->in_end; r++) {
+      extend_row(input, border, static_cast<int>(r - kernel_size),
+                 kernel_size, stream->next_row());
+      stream->commit_row();
+    }
+  });
+}
+
+void sigma_filter(ConstImageView input, ImageView output, unsigned char sigma,
+                  size_t kernel_size, size_t num_threads, SigmaEngine engine,
+                  AlphaMode alpha, const Border &border) {
+  Frame<const unsigned char> in = make_frame(input);
+  Frame<unsigned char> out = make_frame(output);
+
+  engine = resolve_engine(engine, kernel_size);
+  if (input.width != output.width || input.height != output.height ||
+      input.channels != output.channels) {
+    std::cerr << "Input and output should have the same size and channels.\n";
+  } else if (input.channels < 1 || input.channels > 4) {
+    std::cerr << "Depth should be 1 (grayscale), 2 (grayscale + alpha), 3 "
+                 "(rgb) or 4 (rgba).\n";
+  } else if (border.mode == BorderMode::padded) {
+    // The engines run straight on the buffer around the view
+    if (border.padding < kernel_size)
+      std::cerr << "Padding should be at least kernel_size.\n";
+    else
+      sigma_filter_channels<true>(in, out, input.channels, alpha, sigma,
+                                  kernel_size, num_threads, engine);
+  } else if (border.mode != BorderMode::clip) {
+    sigma_filter_border(input, output, sigma, kernel_size, num_threads, engine,
+                        alpha, border);
+  } else {
+    sigma_filter_channels<false>(in, out, input.channels, alpha, sigma,
+                                 kernel_size, num_threads, engine);
+  }
 }
 
 // Helper predicate for assertions
@@ -32,80 +264,489 @@ template <typename T> static bool all_non_negative(T a[], size_t s) {
   return true;
 }
 
-template <size_t Depth>
-static void
-sigma_filter(const unsigned char *input, unsigned char *output, size_t width,
-             size_t height, unsigned char sigma,
-             size_t kernel_size // kernel width == height == 2*kern_size + 1
-             ) {
-  int ymin, ymax;
-  std::uint32_t hist[Depth][256]; // Local histogram
-  int ld = width;                 // Row-major memory layout
-
-  int row_min, row_max, col_minus, col_plus;
-  unsigned char pix_min, pix_max, pix_val;
-  std::uint32_t sum = 0, n = 0;
-  int kern_size = static_cast<int>(kernel_size);
+// Mean of the histogram entries within [pix_val - sigma, pix_val + sigma],
+// rounded to nearest; pix_val itself if there are none.
+template <typename Count, bool Coarse>
+static unsigned char sigma_mean(const Histogram<Count, Coarse> &hist,
+                                unsigned char pix_val, unsigned char sigma) {
+  std::uint32_t sum, n;
+  unsigned char pix_min = std::max(0, pix_val - sigma);
+  unsigned char pix_max = std::min(255, pix_val + sigma);
 
-  for (int row = 0; row < height; row++) {
+  hist.range(pix_min, pix_max, n, sum);
 
-    row_min = std::max(0, row - kern_size);
-    row_max = std::min(static_cast<int>(height) - 1, row + kern_size);
+  return static_cast<unsigned char>((n > 0) ? ((sum + (n >> 1)) / n)
+                                            : pix_val);
+}
 
-    for (int col = 0; col < width; col++) {
-      col_minus = col - kern_size - 1;
-      col_plus = col + kern_size;
 
-      if (col == 0) { // Hist init
-        for (int d = 0; d < Depth; d++) {
-          for (int i = 0; i < 256; i++)
-            hist[d][i] = 0;
-        }
+// One row of the row histogram engine, from the rows of its window
+// window[0 .. win_rows - 1]. WinRows and Kern are win_rows and kern_size when
+// known at compile time (0 otherwise), so that the loops over the window rows
+// and the column offsets are constants for the common kernel sizes. Padded:
+// the row has kern_size readable pixels on each side (BorderMode::padded),
+// every window is whole and the sweep has no border tests.
+template <size_t Depth, size_t Channels, bool Coarse, int WinRows, int Kern,
+          bool Padded>
+static void sigma_filter_row(Histogram<std::uint32_t, Coarse> hist[],
+                             const unsigned char *const window[],
+                             int win_rows, const unsigned char *input,
+                             unsigned char *output, int width,
+                             unsigned char sigma, int kern_size) {
+  const int rows = WinRows ? WinRows : win_rows;
+  const int kern = Kern ? Kern : kern_size;
+  int col_minus, col_plus;
+  // Kernels wider than the image must not read past the row (into the
+  // next row, or outside of a cropped view)
+  int col_first = Padded ? -kern : 0;
+  int col_last = Padded ? kern : std::min(kern, width - 1);
 
-        for (int r = row_min; r <= row_max; r++) {
-          for (int c = 0; c <= col_plus; c++) {
-            for (int d = 0; d < Depth; d++) {
-              hist[d][input[LOC(r, c, ld, Depth, d)]]++;
-            }
-          }
+  // each slide removes one column and adds one
+  IMAGEPROC_COUNT(sigma_pixels, width);
+  IMAGEPROC_COUNT(sigma_hist_updates,
+                  rows * Channels *
+                      (col_last - col_first + 1 +
+                       2 * std::max(0, Padded ? width - 1
+                                              : width - kern - 1)));
+  IMAGEPROC_COUNT(sigma_range_queries, width * Channels);
+  { // Hist init, window of column 0
+    IMAGEPROC_TIMER(sigma_hist_init);
+    for (int d = 0; d < Channels; d++)
+      hist[d].clear();
+
+    for (int r = 0; r < rows; r++) {
+      for (int c = col_first; c <= col_last; c++) {
+        for (int d = 0; d < Channels; d++) {
+          hist[d].add(window[r][c * Depth + d]);
         }
-      } else {
+      }
+    }
+  }
+
+  IMAGEPROC_TIMER(sigma_sweep);
+  for (int col = 0; col < width; col++) {
+    col_minus = col - kern - 1;
+    col_plus = col + kern;
+
+    if (col > 0) {
 
-        if (col_minus >= 0) {
-          for (int r = row_min; r <= row_max; r++) {
-            for (int d = 0; d < Depth; d++) {
-              hist[d][input[LOC(r, col_minus, ld, Depth, d)]]--;
-            }
+      if (Padded || col_minus >= 0) {
+        for (int r = 0; r < rows; r++) {
+          for (int d = 0; d < Channels; d++) {
+            hist[d].remove(window[r][col_minus * Depth + d]);
           }
         }
+      }
 
-        if (col_plus < width) {
-          for (int r = row_min; r <= row_max; r++) {
-            for (int d = 0; d < Depth; d++) {
-              hist[d][input[LOC(r, col_plus, ld, Depth, d)]]++;
-            }
+      if (Padded || col_plus < width) {
+        for (int r = 0; r < rows; r++) {
+          for (int d = 0; d < Channels; d++) {
+            hist[d].add(window[r][col_plus * Depth + d]);
           }
         }
       }
+    }
+
+    for (int d = 0; d < Channels; d++) {
+      assert(all_non_negative(&hist[d].fine[0], 256)); // Invariant
+      output[col * Depth + d] =
+          sigma_mean(hist[d], input[col * Depth + d], sigma);
+    }
+    for (int d = Channels; d < Depth; d++) // Alpha, passed through
+      output[col * Depth + d] = input[col * Depth + d];
+  }
+}
+
+// Kern: kernel_size if known at compile time, 0 otherwise. Padded: the rows
+// and columns around the image are read as part of it.
+template <size_t Depth, size_t Channels, bool Coarse, int Kern, bool Padded>
+static void
+sigma_filter(const Rows<const unsigned char> &in,
+             const Rows<unsigned char> &out,
+             size_t width, size_t height, unsigned char sigma,
+             size_t kernel_size, // kernel width == height == 2*kern_size + 1
+             size_t row_begin, size_t row_end) {
+  // The histogram is rebuilt at the start of every row, so any band of rows
+  // [row_begin, row_end) can be filtered independently of the others.
+  Histogram<std::uint32_t, Coarse> hist[Channels]; // Local histogram
+
+  int row_min, row_max;
+  int kern_size = static_cast<int>(kernel_size);
+  // Starts of the rows of the window, window[0] is row_min
+  std::vector<const unsigned char *> window(
+      Padded ? 2 * kernel_size + 1 : std::min(height, 2 * kernel_size + 1));
+
+  for (int row = row_begin; row < row_end; row++) {
+
+    row_min = Padded ? row - kern_size : std::max(0, row - kern_size);
+    row_max = Padded ? row + kern_size
+                     : std::min(static_cast<int>(height) - 1,
+                                row + kern_size);
+    int win_rows = row_max - row_min + 1;
+    for (int r = 0; r < win_rows; r++)
+      window[r] = in.row(row_min + r);
+
+    // Rows clipped by the top or bottom border take the generic loops
+    if (Kern && win_rows == 2 * Kern + 1)
+      sigma_filter_row<Depth, Channels, Coarse, Kern ? 2 * Kern + 1 : 0, Kern,
+                       Padded>(hist, window.data(), win_rows, in.row(row),
+                               out.row(row), static_cast<int>(width), sigma,
+                               kern_size);
+    else
+      sigma_filter_row<Depth, Channels, Coarse, 0, Kern, Padded>(
+          hist, window.data(), win_rows, in.row(row), out.row(row),
+          static_cast<int>(width), sigma, kern_size);
+  }
+}
+
+// Row histogram engine, specialized for kernel sizes 1 to 3
+template <size_t Depth, size_t Channels, bool Coarse, bool Padded>
+static void
+sigma_filter_rows(const Rows<const unsigned char> &in,
+                  const Rows<unsigned char> &out, size_t width, size_t height,
+                  unsigned char sigma, size_t kernel_size, size_t row_begin,
+                  size_t row_end) {
+  switch (kernel_size) {
+  case 1U:
+    sigma_filter<Depth, Channels, Coarse, 1, Padded>(
+        in, out, width, height, sigma, kernel_size, row_begin, row_end);
+    break;
+  case 2U:
+    sigma_filter<Depth, Channels, Coarse, 2, Padded>(
+        in, out, width, height, sigma, kernel_size, row_begin, row_end);
+    break;
+  case 3U:
+    sigma_filter<Depth, Channels, Coarse, 3, Padded>(
+        in, out, width, height, sigma, kernel_size, row_begin, row_end);
+    break;
+  default:
+    sigma_filter<Depth, Channels, Coarse, 0, Padded>(
+        in, out, width, height, sigma, kernel_size, row_begin, row_end);
+  }
+}
+
+// Perreault-Hebert style engine: every column keeps its own histogram of the
+// 2*kern_size + 1 rows around the current row. Moving down one row updates
+// each column histogram with one removal and one addition, and moving right
+// one column updates the window histogram by subtracting/adding a whole column
+// histogram, so the cost per pixel does not depend on the kernel size.
+// The column histograms persist between calls, so rows can be filtered one at
+// a time as they become available (see SigmaFilterStream). Padded: the
+// kern_size rows and columns around the image are read as part of it, there
+// are column histograms for the columns on the sides too.
+template <size_t Depth, size_t Channels, typename Count, bool Coarse,
+          bool Padded = false>
+class ColumnHistogramFilter {
+public:
+  ColumnHistogramFilter(size_t width, size_t height, unsigned char sigma,
+                        size_t kernel_size)
+      : width(static_cast<int>(width)), height(static_cast<int>(height)),
+        kern_size(static_cast<int>(kernel_size)),
+        pad(Padded ? static_cast<int>(kernel_size) : 0), sigma(sigma),
+        col_hist((width + 2 * pad) * Channels) {}
+
+  // Builds the column histograms of the window rows around `row`
+  void start(const Rows<const unsigned char> &in, int row) {
+    IMAGEPROC_TIMER(sigma_hist_init);
+    for (auto &h : col_hist)
+      h.clear();
+
+    int row_min = Padded ? row - kern_size : std::max(0, row - kern_size);
+    int row_max =
+        Padded ? row + kern_size : std::min(height - 1, row + kern_size);
+    IMAGEPROC_COUNT(sigma_hist_updates,
+                    (row_max - row_min + 1) * (width + 2 * pad) * Channels);
+    for (int r = row_min; r <= row_max; r++) {
+      const unsigned char *input = in.row(r);
+      for (int c = -pad; c < width + pad; c++) {
+        for (int d = 0; d < Channels; d++)
+          column(c, d).add(input[c * Depth + d]);
+      }
+    }
+  }
+
+  // Slides the column histograms one row down, from row - 1 to `row`
+  void slide(const Rows<const unsigned char> &in, int row) {
+    int row_minus = row - kern_size - 1;
+    int row_plus = row + kern_size;
+
+    IMAGEPROC_TIMER(sigma_column_slide);
+    IMAGEPROC_COUNT(sigma_hist_updates,
+                    ((Padded || row_minus >= 0) +
+                     (Padded || row_plus < height)) *
+                        (width + 2 * pad) * Channels);
+    if (Padded || row_minus >= 0) {
+      const unsigned char *input = in.row(row_minus);
+      for (int c = -pad; c < width + pad; c++) {
+        for (int d = 0; d < Channels; d++)
+          column(c, d).remove(input[c * Depth + d]);
+      }
+    }
+
+    if (Padded || row_plus < height) {
+      const unsigned char *input = in.row(row_plus);
+      for (int c = -pad; c < width + pad; c++) {
+        for (int d = 0; d < Channels; d++)
+          column(c, d).add(input[c * Depth + d]);
+      }
+    }
+  }
+
+  // Filters `row`, which the column histograms must be at
+  void filter(const Rows<const unsigned char> &in, unsigned char *output,
+              int row) {
+    Histogram<Count, Coarse> hist[Channels]; // Window histogram
+    const unsigned char *input = in.row(row);
+    int col_minus, col_plus;
+
+    int col_first = -pad;
+    int col_last = Padded ? kern_size : std::min(kern_size, width - 1);
+
+    IMAGEPROC_COUNT(sigma_pixels, width);
+    IMAGEPROC_COUNT(sigma_hist_merges,
+                    Channels * (col_last - col_first + 1 +
+                                2 * std::max(0, Padded ? width - 1
+                                                       : width - kern_size -
+                                                             1)));
+    IMAGEPROC_COUNT(sigma_range_queries, width * Channels);
+    { // Hist init, window of column 0
+      IMAGEPROC_TIMER(sigma_hist_init);
+      for (int d = 0; d < Channels; d++)
+        hist[d].clear();
+
+      for (int c = col_first; c <= col_last; c++) {
+        for (int d = 0; d < Channels; d++)
+          hist[d].add(column(c, d));
+      }
+    }
 
-      for (int d = 0; d < Depth; d++) {
-        assert(all_non_negative(&hist[d][0], 256)); // Invariant
-        sum = 0;
-        n = 0;
-        pix_val = input[LOC(row, col, ld, Depth, d)];
-        pix_min = std::max(0, pix_val - sigma);
-        pix_max = std::min(255, pix_val + sigma);
-
-        for (std::uint32_t p_val = pix_min; p_val <= pix_max; p_val++) {
-          sum += p_val * hist[d][p_val];
-          n += hist[d][p_val];
+    IMAGEPROC_TIMER(sigma_sweep);
+    for (int col = 0; col < width; col++) {
+      col_minus = col - kern_size - 1;
+      col_plus = col + kern_size;
+
+      if (col > 0) {
+
+        if (Padded || col_minus >= 0) {
+          for (int d = 0; d < Channels; d++)
+            hist[d].subtract(column(col_minus, d));
         }
 
-        output[LOC(row, col, ld, Depth, d)] = static_cast<unsigned char>(
-            (n > 0) ? ((sum + (n >> 1)) / n) : pix_val);
+        if (Padded || col_plus < width) {
+          for (int d = 0; d < Channels; d++)
+            hist[d].add(column(col_plus, d));
+        }
       }
+
+      for (int d = 0; d < Channels; d++)
+        output[col * Depth + d] =
+            sigma_mean(hist[d], input[col * Depth + d], sigma);
+      for (int d = Channels; d < Depth; d++) // Alpha, passed through
+        output[col * Depth + d] = input[col * Depth + d];
     }
   }
+
+private:
+  Histogram<Count, Coarse> &column(int col, int d) {
+    return col_hist[(col + pad) * Channels + d];
+  }
+
+  int width, height, kern_size;
+  int pad; // Columns on each side with a histogram
+  unsigned char sigma;
+  // Column histograms, one per column and filtered channel
+  std::vector<Histogram<Count, Coarse> > col_hist;
+};
+
+template <size_t Depth, size_t Channels, typename Count, bool Coarse,
+          bool Padded>
+static void sigma_filter_column_hist(const Rows<const unsigned char> &in,
+                                     const Rows<unsigned char> &out,
+                                     size_t width, size_t height,
+                                     unsigned char sigma, size_t kernel_size,
+                                     size_t row_begin, size_t row_end) {
+  ColumnHistogramFilter<Depth, Channels, Count, Coarse, Padded> filter(
+      width, height, sigma, kernel_size);
+
+  filter.start(in, row_begin);
+  for (int row = row_begin; row < row_end; row++) {
+    if (row > row_begin)
+      filter.slide(in, row);
+    filter.filter(in, out.row(row), row);
+  }
+}
+
+template <size_t Depth, size_t Channels, bool Coarse>
+class RowHistogramStream : public SigmaFilterStream::Impl {
+public:
+  RowHistogramStream(size_t width, size_t height, unsigned char sigma,
+                     size_t kernel_size, SigmaFilterStream::RowSink sink,
+                     size_t row_begin, size_t row_end)
+      : Impl(width, height, Depth, kernel_size, sink, row_begin, row_end),
+        sigma(sigma) {}
+
+protected:
+  void filter_row(const Rows<const unsigned char> &in, int row,
+                  unsigned char *output) override {
+    Rows<unsigned char> out{ output, 0, 1 }; // Every row goes to output
+    sigma_filter_rows<Depth, Channels, Coarse, false>(
+        in, out, width, height, sigma, kernel_size, row, row + 1);
+  }
+
+private:
+  unsigned char sigma;
+};
+
+template <size_t Depth, size_t Channels>
+class DirectWindowStream : public SigmaFilterStream::Impl {
+public:
+  DirectWindowStream(size_t width, size_t height, unsigned char sigma,
+                     size_t kernel_size, SigmaFilterStream::RowSink sink,
+                     size_t row_begin, size_t row_end)
+      : Impl(width, height, Depth, kernel_size, sink, row_begin, row_end),
+        sigma(sigma) {}
+
+protected:
+  void filter_row(const Rows<const unsigned char> &in, int row,
+                  unsigned char *output) override {
+    Rows<unsigned char> out{ output, 0, 1 };
+    sigma_window_rows(in, out, width, height, Depth, sigma, kernel_size,
+                      Channels < Depth ? AlphaMode::pass_through
+                                       : AlphaMode::filter,
+                      row, row + 1);
+  }
+
+private:
+  unsigned char sigma;
+};
+
+template <size_t Depth, size_t Channels, typename Count, bool Coarse>
+class ColumnHistogramStream : public SigmaFilterStream::Impl {
+public:
+  ColumnHistogramStream(size_t width, size_t height, unsigned char sigma,
+                        size_t kernel_size, SigmaFilterStream::RowSink sink,
+                        size_t row_begin, size_t row_end)
+      : Impl(width, height, Depth, kernel_size, sink, row_begin, row_end),
+        filter(width, height, sigma, kernel_size) {}
+
+protected:
+  void filter_row(const Rows<const unsigned char> &in, int row,
+                  unsigned char *output) override {
+    if (row == static_cast<int>(row_begin))
+      filter.start(in, row);
+    else
+      filter.slide(in, row);
+    filter.filter(in, output, row);
+  }
+
+private:
+  ColumnHistogramFilter<Depth, Channels, Count, Coarse> filter;
+};
+
+template <size_t Depth, size_t Channels, bool Coarse>
+static SigmaFilterStream::Impl *
+make_stream(size_t width, size_t height, unsigned char sigma,
+            size_t kernel_size, SigmaEngine engine, bool narrow_bins,
+            SigmaFilterStream::RowSink sink, size_t row_begin,
+            size_t row_end) {
+  switch (engine) {
+  case SigmaEngine::automatic: // resolved by make_sigma_stream()
+  case SigmaEngine::row_histogram:
+    return new RowHistogramStream<Depth, Channels, Coarse>(
+        width, height, sigma, kernel_size, sink, row_begin, row_end);
+  case SigmaEngine::column_histogram:
+    if (narrow_bins)
+      return new ColumnHistogramStream<Depth, Channels, std::uint16_t, Coarse>(
+          width, height, sigma, kernel_size, sink, row_begin, row_end);
+    return new ColumnHistogramStream<Depth, Channels, std::uint32_t, Coarse>(
+        width, height, sigma, kernel_size, sink, row_begin, row_end);
+  case SigmaEngine::direct_window:
+    return new DirectWindowStream<Depth, Channels>(
+        width, height, sigma, kernel_size, sink, row_begin, row_end);
+  }
+  return nullptr;
+}
+
+template <size_t Depth, size_t Channels>
+static SigmaFilterStream::Impl *
+make_stream(size_t width, size_t height, unsigned char sigma,
+            size_t kernel_size, SigmaEngine engine,
+            SigmaFilterStream::RowSink sink, size_t row_begin,
+            size_t row_end) {
+  bool narrow_bins = use_narrow_bins(width, height, kernel_size);
+  if (use_coarse(sigma))
+    return make_stream<Depth, Channels, true>(width, height, sigma,
+                                              kernel_size, engine,
+                                              narrow_bins, sink, row_begin,
+                                              row_end);
+  return make_stream<Depth, Channels, false>(width, height, sigma,
+                                             kernel_size, engine, narrow_bins,
+                                             sink, row_begin, row_end);
+}
+
+SigmaFilterStream::Impl *
+make_sigma_stream(size_t width, size_t height, size_t depth,
+                  unsigned char sigma, SigmaFilterStream::RowSink sink,
+                  size_t kernel_size, SigmaEngine engine, AlphaMode alpha,
+                  size_t row_begin, size_t row_end) {
+  bool filter_alpha = alpha == AlphaMode::filter;
+
+  engine = resolve_engine(engine, kernel_size);
+  if (depth == 1)
+    return make_stream<1U, 1U>(width, height, sigma, kernel_size, engine,
+                               sink, row_begin, row_end);
+  if (depth == 2 && filter_alpha)
+    return make_stream<2U, 2U>(width, height, sigma, kernel_size, engine,
+                               sink, row_begin, row_end);
+  if (depth == 2)
+    return make_stream<2U, 1U>(width, height, sigma, kernel_size, engine,
+                               sink, row_begin, row_end);
+  if (depth == 3)
+    return make_stream<3U, 3U>(width, height, sigma, kernel_size, engine,
+                               sink, row_begin, row_end);
+  if (depth == 4 && filter_alpha)
+    return make_stream<4U, 4U>(width, height, sigma, kernel_size, engine,
+                               sink, row_begin, row_end);
+  if (depth == 4)
+    return make_stream<4U, 3U>(width, height, sigma, kernel_size, engine,
+                               sink, row_begin, row_end);
+  std::cerr << "Depth should be 1 (grayscale), 2 (grayscale + alpha), 3 "
+               "(rgb) or 4 (rgba).\n";
+  return nullptr;
+}
+
+SigmaFilterStream::SigmaFilterStream(size_t width, size_t height, size_t depth,
+                                     unsigned char sigma, RowSink sink,
+                                     size_t kernel_size, SigmaEngine engine,
+                                     AlphaMode alpha)
+    : depth(depth),
+      impl(make_sigma_stream(width, height, depth, sigma, sink, kernel_size,
+                             engine, alpha, 0U, height)) {}
+
+SigmaFilterStream::~SigmaFilterStream() {}
+
+void SigmaFilterStream::push(const unsigned char *rows, size_t num_rows,
+                             size_t stride) {
+  if (impl)
+    impl->push(rows, num_rows, stride ? stride : impl->row_bytes);
+}
+
+void SigmaFilterStream::push(ConstImageView strip) {
+  if (!impl)
+    return;
+  if (strip.width != impl->width || strip.channels != depth) {
+    std::cerr << "Strip should have the width and channels of the stream.\n";
+    return;
+  }
+  impl->push(strip.data, strip.height, strip.stride);
+}
+
+size_t SigmaFilterStream::rows_in() const {
+  return impl ? impl->rows_in : 0U;
+}
+
+size_t SigmaFilterStream::rows_out() const {
+  return impl ? impl->rows_out : 0U;
 }
 
 } /* namespace imageproc */
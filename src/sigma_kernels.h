@@ -0,0 +1,41 @@
+#ifndef __SIGMA_KERNELS_H
+#define __SIGMA_KERNELS_H
+
+#include <cstddef> // size_t
+#include <cstdint>
+
+namespace imageproc {
+
+#ifdef IMAGEPROC_X86_SIMD
+// Vectorized direct-window sigma filter of elements [begin, end) of one row
+// of depth channels (element e is channel e % depth of pixel e / depth), 8 at
+// a time. window[0 .. win_rows - 1] are the window rows around the row
+// `center`, and every pixel of [begin, end) must have its kernel_size columns
+// on both sides inside of the row. Returns the first element not processed,
+// which the caller finishes with the scalar code; the results are the same.
+size_t sigma_window_avx2(const float *const window[], size_t win_rows,
+                         const float *center, float *output, size_t begin,
+                         size_t end, size_t depth, size_t kernel_size,
+                         float sigma);
+size_t sigma_window_avx2(const std::uint16_t *const window[], size_t win_rows,
+                         const std::uint16_t *center, std::uint16_t *output,
+                         size_t begin, size_t end, size_t depth,
+                         size_t kernel_size, std::uint16_t sigma);
+// 8-bit images, 32 (AVX2) or 16 (SSE4.1) elements at a time, for windows of
+// up to u8_window_max pixels (kernel_size 7), the sums are kept in 16-bit
+// lanes
+const size_t u8_window_max = 225U;
+size_t sigma_window_avx2(const unsigned char *const window[], size_t win_rows,
+                         const unsigned char *center, unsigned char *output,
+                         size_t begin, size_t end, size_t depth,
+                         size_t kernel_size, unsigned char sigma);
+size_t sigma_window_sse41(const unsigned char *const window[],
+                          size_t win_rows, const unsigned char *center,
+                          unsigned char *output, size_t begin, size_t end,
+                          size_t depth, size_t kernel_size,
+                          unsigned char sigma);
+#endif
+
+} /* namespace imageproc */
+
+#endif /* __SIGMA_KERNELS_H */
@@ -0,0 +1,84 @@
+// SSE4.1 direct-window sigma filter of 8-bit images, this file is compiled
+// with -msse4.1
+#include <smmintrin.h>
+#include "sigma_kernels.h"
+
+namespace imageproc {
+
+// 16 elements at a time, as sigma_window_u8() in sigma_avx2.cc
+template <size_t Kern>
+static size_t sigma_window_u8(const unsigned char *const window[],
+                              size_t win_rows, const unsigned char *center,
+                              unsigned char *output, size_t begin, size_t end,
+                              size_t depth, size_t kernel_size,
+                              unsigned char sigma) {
+  const size_t kern = Kern ? Kern : kernel_size;
+  const size_t win_cols = 2 * kern + 1;
+  const __m128i sigma_v = _mm_set1_epi8(static_cast<char>(sigma));
+  const __m128i zero = _mm_setzero_si128();
+  size_t e = begin;
+
+  for (; e + 16 <= end; e += 16) {
+    __m128i pix_val =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(center + e));
+    __m128i sum_lo = zero, sum_hi = zero, n = zero;
+
+    for (size_t r = 0U; r < win_rows; r++) {
+      const unsigned char *src = window[r] + e - kern * depth;
+      for (size_t c = 0U; c < win_cols; c++, src += depth) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(value, pix_val),
+                                    _mm_subs_epu8(pix_val, value));
+        // All ones where |value - pix_val| <= sigma
+        __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(diff, sigma_v), diff);
+        __m128i masked = _mm_and_si128(in_range, value);
+        sum_lo = _mm_add_epi16(sum_lo, _mm_unpacklo_epi8(masked, zero));
+        sum_hi = _mm_add_epi16(sum_hi, _mm_unpackhi_epi8(masked, zero));
+        n = _mm_sub_epi8(n, in_range);
+      }
+    }
+
+    __m128i n_lo = _mm_unpacklo_epi8(n, zero);
+    __m128i n_hi = _mm_unpackhi_epi8(n, zero);
+    __m128i mean16[2];
+    for (int half = 0; half < 2; half++) {
+      __m128i sum16 = half ? sum_hi : sum_lo;
+      __m128i n16 = half ? n_hi : n_lo;
+      __m128i num16 = _mm_add_epi16(sum16, _mm_srli_epi16(n16, 1));
+      __m128i q[2];
+      for (int quarter = 0; quarter < 2; quarter++) {
+        __m128i num = quarter ? _mm_unpackhi_epi16(num16, zero)
+                              : _mm_unpacklo_epi16(num16, zero);
+        __m128i den = quarter ? _mm_unpackhi_epi16(n16, zero)
+                              : _mm_unpacklo_epi16(n16, zero);
+        q[quarter] = _mm_cvttps_epi32(
+            _mm_div_ps(_mm_cvtepi32_ps(num), _mm_cvtepi32_ps(den)));
+      }
+      mean16[half] = _mm_packus_epi32(q[0], q[1]);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + e),
+                     _mm_packus_epi16(mean16[0], mean16[1]));
+  }
+  return e;
+}
+
+size_t sigma_window_sse41(const unsigned char *const window[],
+                          size_t win_rows, const unsigned char *center,
+                          unsigned char *output, size_t begin, size_t end,
+                          size_t depth, size_t kernel_size,
+                          unsigned char sigma) {
+  switch (kernel_size) {
+  case 1U:
+    return sigma_window_u8<1U>(window, win_rows, center, output, begin, end,
+                               depth, kernel_size, sigma);
+  case 2U:
+    return sigma_window_u8<2U>(window, win_rows, center, output, begin, end,
+                               depth, kernel_size, sigma);
+  }
+  if (win_rows * (2 * kernel_size + 1) > u8_window_max)
+    return begin;
+  return sigma_window_u8<0U>(window, win_rows, center, output, begin, end,
+                             depth, kernel_size, sigma);
+}
+
+} /* namespace imageproc */
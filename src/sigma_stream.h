@@ -0,0 +1,118 @@
+#ifndef __SIGMA_STREAM_H
+#define __SIGMA_STREAM_H
+
+#include <algorithm>
+#include <cstddef> // size_t
+#include <functional>
+#include <vector>
+#include "imageproc.h"
+
+namespace imageproc {
+
+// Input rows as seen by the engines: row r starts at data + r * stride, or at
+// data + (r % ring) * stride when the rows are kept in a ring buffer of `ring`
+// rows (ring == 0 for whole images)
+template <typename Pixel> struct Rows {
+  Pixel *data;
+  int stride; // bytes between the starts of consecutive slots
+  int ring;
+
+  Pixel *row(int r) const { return data + (ring ? r % ring : r) * stride; }
+};
+
+// Streaming state: the last ring_rows input rows and the engine state.
+// Output row r is filtered as soon as input row r + kernel_size is in (or the
+// last input row); with ring_rows == 2*kernel_size + 2 the rows it needs,
+// including row r - kernel_size - 1 that the column histograms drop, are all
+// still in the ring at that point.
+//
+// A stream may cover a band of output rows [row_begin, row_end) only. It then
+// takes input rows [in_begin, in_end), the band plus the kernel_size rows
+// around it that exist, and its output rows are the same as those of the
+// whole image.
+class SigmaFilterStream::Impl {
+public:
+  // Where output row `row` is filtered to, instead of an internal row
+  using RowTarget = std::function<unsigned char *(size_t row)>;
+
+  Impl(size_t width, size_t height, size_t depth, size_t kernel_size,
+       RowSink sink, size_t row_begin, size_t row_end)
+      : width(width), height(height), row_bytes(width * depth),
+        kernel_size(kernel_size), lookahead(std::min(kernel_size, height)),
+        ring_rows(std::min(height, 2 * lookahead + 2)),
+        row_begin(row_begin), row_end(row_end),
+        in_begin(row_begin - std::min(row_begin, kernel_size)),
+        in_end(std::min(height, row_end + kernel_size)),
+        ring(ring_rows * row_bytes), out_row(row_bytes), sink(sink),
+        rows_in(in_begin), rows_out(row_begin) {}
+  virtual ~Impl() {}
+
+  void push(const unsigned char *rows, size_t num_rows, size_t stride) {
+    num_rows = std::min(num_rows, in_end - rows_in);
+    for (size_t r = 0U; r < num_rows; r++) {
+      std::copy(rows + r * stride, rows + r * stride + row_bytes,
+                next_row());
+      commit_row();
+    }
+  }
+
+  // Ring slot of input row rows_in, which can be written in place and then
+  // committed instead of pushed
+  unsigned char *next_row() {
+    return ring.data() + (rows_in % ring_rows) * row_bytes;
+  }
+
+  void commit_row() {
+    rows_in++;
+    while (rows_out < row_end &&
+           (rows_out + lookahead < rows_in || rows_in == in_end)) {
+      unsigned char *output = target ? target(rows_out) : out_row.data();
+      filter_row(input(), static_cast<int>(rows_out), output);
+      sink(rows_out, output);
+      rows_out++;
+    }
+  }
+
+  size_t width, height, row_bytes;
+  size_t kernel_size;
+  size_t lookahead; // Input rows needed below an output row
+  size_t ring_rows;
+  size_t row_begin, row_end; // Output rows of the stream
+  size_t in_begin, in_end;   // Input rows they depend on
+  std::vector<unsigned char> ring;    // Input row r is at slot r % ring_rows
+  std::vector<unsigned char> out_row; // Output row handed to the sink
+  RowSink sink;
+  RowTarget target; // Empty == out_row
+  size_t rows_in, rows_out;
+
+protected:
+  Rows<const unsigned char> input() const {
+    return Rows<const unsigned char>{ ring.data(),
+                                      static_cast<int>(row_bytes),
+                                      static_cast<int>(ring_rows) };
+  }
+
+  virtual void filter_row(const Rows<const unsigned char> &in, int row,
+                          unsigned char *output) = 0;
+};
+
+// Rows [row_begin, row_end) of the direct-window filter of an 8-bit width x
+// height image (SigmaEngine::direct_window, see sigma_window.cc); padded:
+// the kernel_size rows and columns around the image are read as part of it
+void sigma_window_rows(const Rows<const unsigned char> &in,
+                       const Rows<unsigned char> &out, size_t width,
+                       size_t height, size_t depth, unsigned char sigma,
+                       size_t kernel_size, AlphaMode alpha, size_t row_begin,
+                       size_t row_end, bool padded = false);
+
+// Stream of output rows [row_begin, row_end) of the sigma_filter() of a width
+// x height image, nullptr (with a message) for unsupported depths
+SigmaFilterStream::Impl *
+make_sigma_stream(size_t width, size_t height, size_t depth,
+                  unsigned char sigma, SigmaFilterStream::RowSink sink,
+                  size_t kernel_size, SigmaEngine engine, AlphaMode alpha,
+                  size_t row_begin, size_t row_end);
+
+} /* namespace imageproc */
+
+#endif /* __SIGMA_STREAM_H */
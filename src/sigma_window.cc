@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib> // std::abs
+#include <vector>
+#include "imageproc.h"
+#include "parallel.h"
+#include "sigma_kernels.h"
+#include "sigma_stream.h"
+#include "stats.h"
+
+namespace imageproc {
+
+// Sigma filter of 16-bit and float images. A histogram of the value range
+// (65536 bins, or none at all for floats) is out of the question, so every
+// pixel of the window is compared with the center pixel instead: the cost per
+// pixel is (2*kernel_size + 1)^2 comparisons, which is what the small kernel
+// sizes used in practice afford. 8-bit images take the same route with
+// SigmaEngine::direct_window, where for the smallest kernel sizes it beats
+// maintaining a histogram, especially with the SSE4.1 and AVX2 kernels.
+
+// Accumulation of the window values within sigma of the center value
+template <typename Pixel> struct WindowSum;
+
+template <> struct WindowSum<float> {
+  using Sum = float;
+  static bool in_range(float value, float center, float sigma) {
+    return std::fabs(value - center) <= sigma;
+  }
+  static float mean(float sum, std::uint32_t n) {
+    return sum / static_cast<float>(n);
+  }
+};
+
+template <> struct WindowSum<unsigned char> {
+  using Sum = std::uint32_t;
+  static bool in_range(int value, int center, int sigma) {
+    return std::abs(value - center) <= sigma;
+  }
+  // Rounded to nearest, as with the histograms
+  static unsigned char mean(std::uint32_t sum, std::uint32_t n) {
+    return static_cast<unsigned char>((sum + (n >> 1)) / n);
+  }
+};
+
+template <> struct WindowSum<std::uint16_t> {
+  using Sum = std::uint64_t;
+  static bool in_range(int value, int center, int sigma) {
+    return std::abs(value - center) <= sigma;
+  }
+  // Rounded to nearest, like the 8-bit version
+  static std::uint16_t mean(std::uint64_t sum, std::uint32_t n) {
+    return static_cast<std::uint16_t>((sum + (n >> 1)) / n);
+  }
+};
+
+// Elements [begin, end) of one row, see sigma_window_avx2(). Window rows are
+// summed top to bottom and left to right, in the order of the vectorized
+// kernels (which matters for floats).
+template <typename Pixel>
+static void sigma_window(const Pixel *const window[], size_t win_rows,
+                         const Pixel *center, Pixel *output, size_t begin,
+                         size_t end, size_t width, size_t depth,
+                         size_t kernel_size, Pixel sigma) {
+  using Sum = typename WindowSum<Pixel>::Sum;
+
+  for (size_t e = begin; e < end; e++) {
+    size_t col = e / depth, d = e % depth;
+    size_t col_min = col > kernel_size ? col - kernel_size : 0U;
+    size_t col_max = std::min(width - 1, col + kernel_size);
+    Pixel pix_val = center[e];
+    Sum sum = 0;
+    std::uint32_t n = 0U;
+
+    for (size_t r = 0U; r < win_rows; r++) {
+      for (size_t c = col_min; c <= col_max; c++) {
+        Pixel value = window[r][c * depth + d];
+        if (WindowSum<Pixel>::in_range(value, pix_val, sigma)) {
+          sum += value;
+          n++;
+        }
+      }
+    }
+    // n > 0, the center is within range of itself
+    output[e] = WindowSum<Pixel>::mean(sum, n);
+  }
+}
+
+// sigma_window() of elements whose window lies entirely inside of the image,
+// 2*kern + 1 rows and columns: with the window size known at compile time
+// (Kern, 0 for kernel_size) the loops over it are unrolled. Same summation
+// order.
+template <size_t Kern, typename Pixel>
+static void sigma_window_fixed(const Pixel *const window[],
+                               const Pixel *center, Pixel *output,
+                               size_t begin, size_t end, size_t depth,
+                               size_t kernel_size, Pixel sigma) {
+  using Sum = typename WindowSum<Pixel>::Sum;
+  const size_t kern = Kern ? Kern : kernel_size;
+  const size_t win = 2 * kern + 1;
+
+  for (size_t e = begin; e < end; e++) {
+    Pixel pix_val = center[e];
+    Sum sum = 0;
+    std::uint32_t n = 0U;
+
+    for (size_t r = 0U; r < win; r++) {
+      const Pixel *src = window[r] + e - kern * depth;
+      for (size_t c = 0U; c < win; c++) {
+        Pixel value = src[c * depth];
+        if (WindowSum<Pixel>::in_range(value, pix_val, sigma)) {
+          sum += value;
+          n++;
+        }
+      }
+    }
+    output[e] = WindowSum<Pixel>::mean(sum, n);
+  }
+}
+
+// Vectorized part of elements [begin, end) (see sigma_kernels.h), returns the
+// first element left
+template <typename Pixel>
+static size_t sigma_window_simd(const Pixel *const window[], size_t win_rows,
+                                const Pixel *center, Pixel *output,
+                                size_t begin, size_t end, size_t depth,
+                                size_t kernel_size, Pixel sigma, Simd simd) {
+#ifdef IMAGEPROC_X86_SIMD
+  if (simd == Simd::avx2)
+    return sigma_window_avx2(window, win_rows, center, output, begin, end,
+                             depth, kernel_size, sigma);
+#endif
+  return begin;
+}
+
+static size_t sigma_window_simd(const unsigned char *const window[],
+                                size_t win_rows, const unsigned char *center,
+                                unsigned char *output, size_t begin,
+                                size_t end, size_t depth, size_t kernel_size,
+                                unsigned char sigma, Simd simd) {
+#ifdef IMAGEPROC_X86_SIMD
+  if (simd == Simd::avx2)
+    return sigma_window_avx2(window, win_rows, center, output, begin, end,
+                             depth, kernel_size, sigma);
+  if (simd == Simd::sse41)
+    return sigma_window_sse41(window, win_rows, center, output, begin, end,
+                              depth, kernel_size, sigma);
+#endif
+  return begin;
+}
+
+// One output row from the window rows around it, window[0 .. win_rows - 1].
+// padded: the row has kernel_size readable pixels on each side
+// (BorderMode::padded), no window is clipped.
+template <typename Pixel>
+static void sigma_window_row(const Pixel *const window[], size_t win_rows,
+                             const Pixel *center, Pixel *output, size_t width,
+                             size_t depth, size_t kernel_size, Pixel sigma,
+                             bool pass_alpha, Simd simd, bool padded = false) {
+  size_t row_size = width * depth;
+  // Pixels [inner_begin, inner_end) have their whole window within the row
+  // horizontally, only the rows at the top and bottom borders are clipped
+  size_t inner_begin = padded ? 0U : std::min(kernel_size, width);
+  size_t inner_end =
+      padded ? width : std::max(inner_begin, width - inner_begin);
+  size_t done = inner_begin * depth, inner = inner_end * depth;
+
+  sigma_window(window, win_rows, center, output, 0U, done, width, depth,
+               kernel_size, sigma);
+  done = sigma_window_simd(window, win_rows, center, output, done, inner,
+                           depth, kernel_size, sigma, simd);
+  // Full windows, unrolled for the common kernel sizes
+  if (win_rows == 2 * kernel_size + 1 && done < inner) {
+    switch (kernel_size) {
+    case 1U:
+      sigma_window_fixed<1U>(window, center, output, done, inner, depth,
+                             kernel_size, sigma);
+      break;
+    case 2U:
+      sigma_window_fixed<2U>(window, center, output, done, inner, depth,
+                             kernel_size, sigma);
+      break;
+    case 3U:
+      sigma_window_fixed<3U>(window, center, output, done, inner, depth,
+                             kernel_size, sigma);
+      break;
+    default:
+      sigma_window_fixed<0U>(window, center, output, done, inner, depth,
+                             kernel_size, sigma);
+    }
+    done = inner;
+  }
+  sigma_window(window, win_rows, center, output, done, row_size, width, depth,
+               kernel_size, sigma);
+  // The kernels filter whole rows, the alpha channel of 2- and 4-channel
+  // images is put back from the input row while it is in cache
+  if (pass_alpha) {
+    for (size_t e = depth - 1; e < row_size; e += depth)
+      output[e] = center[e];
+  }
+}
+
+static bool passes_alpha(size_t depth, AlphaMode alpha) {
+  return (depth == 2 || depth == 4) && alpha == AlphaMode::pass_through;
+}
+
+template <typename Pixel>
+static void sigma_filter_window(const Pixel *input, Pixel *output,
+                                size_t width, size_t height, size_t depth,
+                                Pixel sigma, size_t kernel_size,
+                                size_t num_threads, AlphaMode alpha) {
+  size_t row_size = width * depth;
+  bool pass_alpha = passes_alpha(depth, alpha);
+  Simd simd = get_simd();
+
+  if (depth == 0) {
+    std::cerr << "Depth should be at least 1.\n";
+    return;
+  }
+
+  parallel_bands(height, num_threads, [&](size_t row_begin, size_t row_end) {
+    IMAGEPROC_TIMER(sigma_window);
+    IMAGEPROC_COUNT(sigma_pixels, (row_end - row_begin) * width);
+    std::vector<const Pixel *> window(std::min(height, 2 * kernel_size + 1));
+
+    for (size_t row = row_begin; row < row_end; row++) {
+      size_t row_min = row > kernel_size ? row - kernel_size : 0U;
+      size_t row_max = std::min(height - 1, row + kernel_size);
+      size_t win_rows = row_max - row_min + 1;
+
+      for (size_t r = 0U; r < win_rows; r++)
+        window[r] = input + (row_min + r) * row_size;
+      sigma_window_row(window.data(), win_rows, input + row * row_size,
+                       output + row * row_size, width, depth, kernel_size,
+                       sigma, pass_alpha, simd);
+    }
+  });
+}
+
+void sigma_window_rows(const Rows<const unsigned char> &in,
+                       const Rows<unsigned char> &out, size_t width,
+                       size_t height, size_t depth, unsigned char sigma,
+                       size_t kernel_size, AlphaMode alpha, size_t row_begin,
+                       size_t row_end, bool padded) {
+  bool pass_alpha = passes_alpha(depth, alpha);
+  Simd simd = get_simd();
+  int kern = static_cast<int>(kernel_size);
+  std::vector<const unsigned char *> window(
+      padded ? 2 * kernel_size + 1 : std::min(height, 2 * kernel_size + 1));
+
+  IMAGEPROC_TIMER(sigma_window);
+  IMAGEPROC_COUNT(sigma_pixels, (row_end - row_begin) * width);
+  for (int row = static_cast<int>(row_begin); row < static_cast<int>(row_end);
+       row++) {
+    int row_min = padded ? row - kern : std::max(0, row - kern);
+    int row_max = padded ? row + kern
+                         : std::min(static_cast<int>(height) - 1, row + kern);
+    size_t win_rows = static_cast<size_t>(row_max - row_min + 1);
+
+    for (size_t r = 0U; r < win_rows; r++)
+      window[r] = in.row(row_min + static_cast<int>(r));
+    sigma_window_row(window.data(), win_rows, in.row(row), out.row(row),
+                     width, depth, kernel_size, sigma, pass_alpha, simd,
+                     padded);
+  }
+}
+
+void sigma_filter(const std::uint16_t *input, std::uint16_t *output,
+                  size_t width, size_t height, size_t depth,
+                  std::uint16_t sigma, size_t kernel_size,
+                  size_t num_threads, AlphaMode alpha) {
+  sigma_filter_window(input, output, width, height, depth, sigma, kernel_size,
+                      num_threads, alpha);
+}
+
+void sigma_filter(const float *input, float *output, size_t width,
+                  size_t height, size_t depth, float sigma,
+                  size_t kernel_size, size_t num_threads, AlphaMode alpha) {
+  sigma_filter_window(input, output, width, height, depth, sigma, kernel_size,
+                      num_threads, alpha);
+}
+
+} /* namespace imageproc */
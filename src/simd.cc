@@ -0,0 +1,36 @@
+#include <atomic>
+#include "imageproc.h"
+
+namespace imageproc {
+
+// Extension selected with set_simd(), -1 until then
+static std::atomic<int> selected_simd{ -1 };
+
+Simd simd_supported() {
+#ifdef IMAGEPROC_X86_SIMD
+  static const Simd supported = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return Simd::avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+      return Simd::sse41;
+    return Simd::none;
+  }();
+  return supported;
+#else
+  return Simd::none;
+#endif
+}
+
+void set_simd(Simd simd) {
+  if (static_cast<int>(simd) > static_cast<int>(simd_supported()))
+    simd = simd_supported();
+  selected_simd = static_cast<int>(simd);
+}
+
+Simd get_simd() {
+  int simd = selected_simd;
+  return (simd < 0) ? simd_supported() : static_cast<Simd>(simd);
+}
+
+} /* namespace imageproc */
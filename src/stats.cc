@@ -0,0 +1,113 @@
+#include <atomic>
+#include <string>
+#include "imageproc.h"
+#include "stats.h"
+
+namespace imageproc {
+
+static const size_t num_counters = static_cast<size_t>(Counter::count);
+static const size_t num_timers = static_cast<size_t>(Timer::count);
+
+// Totals of all threads. Kernels add to them once per row or band, so the
+// relaxed additions are rare enough not to contend.
+static std::atomic<std::uint64_t> counters[num_counters];
+static std::atomic<std::uint64_t> timer_ns[num_timers];
+static std::atomic<std::uint64_t> timer_scopes[num_timers];
+
+#ifdef IMAGEPROC_STATS
+namespace stats {
+
+void add(Counter counter, std::uint64_t n) {
+  counters[static_cast<size_t>(counter)].fetch_add(n,
+                                                   std::memory_order_relaxed);
+}
+
+void add(Timer timer, std::uint64_t ns) {
+  size_t t = static_cast<size_t>(timer);
+  timer_ns[t].fetch_add(ns, std::memory_order_relaxed);
+  timer_scopes[t].fetch_add(1U, std::memory_order_relaxed);
+}
+
+} /* namespace stats */
+#endif
+
+bool stats_enabled() {
+#ifdef IMAGEPROC_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+Stats get_stats() {
+  Stats stats;
+  for (size_t c = 0U; c < num_counters; c++)
+    stats.counters[c] = counters[c].load(std::memory_order_relaxed);
+  for (size_t t = 0U; t < num_timers; t++) {
+    stats.timer_ns[t] = timer_ns[t].load(std::memory_order_relaxed);
+    stats.timer_scopes[t] = timer_scopes[t].load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+void reset_stats() {
+  for (auto &c : counters)
+    c.store(0U, std::memory_order_relaxed);
+  for (size_t t = 0U; t < num_timers; t++) {
+    timer_ns[t].store(0U, std::memory_order_relaxed);
+    timer_scopes[t].store(0U, std::memory_order_relaxed);
+  }
+}
+
+const char *stat_name(Counter counter) {
+  switch (counter) {
+  case Counter::sigma_pixels:
+    return "sigma_pixels";
+  case Counter::sigma_hist_updates:
+    return "sigma_hist_updates";
+  case Counter::sigma_hist_merges:
+    return "sigma_hist_merges";
+  case Counter::sigma_range_queries:
+    return "sigma_range_queries";
+  case Counter::rotate_pixels:
+    return "rotate_pixels";
+  case Counter::rotate_in_bounds:
+    return "rotate_in_bounds";
+  case Counter::count:
+    break;
+  }
+  return "";
+}
+
+const char *stat_name(Timer timer) {
+  switch (timer) {
+  case Timer::sigma_hist_init:
+    return "sigma_hist_init";
+  case Timer::sigma_sweep:
+    return "sigma_sweep";
+  case Timer::sigma_column_slide:
+    return "sigma_column_slide";
+  case Timer::sigma_window:
+    return "sigma_window";
+  case Timer::rotate:
+    return "rotate";
+  case Timer::count:
+    break;
+  }
+  return "";
+}
+
+void export_stats(
+    const std::function<void(const char *name, std::uint64_t value)> &sink) {
+  Stats stats = get_stats();
+
+  for (size_t c = 0U; c < num_counters; c++)
+    sink(stat_name(static_cast<Counter>(c)), stats.counters[c]);
+  for (size_t t = 0U; t < num_timers; t++) {
+    std::string name = stat_name(static_cast<Timer>(t));
+    sink((name + "_ns").c_str(), stats.timer_ns[t]);
+    sink((name + "_scopes").c_str(), stats.timer_scopes[t]);
+  }
+}
+
+} /* namespace imageproc */
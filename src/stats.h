@@ -0,0 +1,58 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+// Instrumentation hooks of the kernels (see Counter and Timer in imageproc.h).
+// With IMAGEPROC_STATS undefined they expand to nothing and their arguments
+// are not evaluated, so they are placed at row or band granularity with the
+// counts computed in the arguments.
+//
+//   IMAGEPROC_COUNT(sigma_pixels, width);  // adds to Counter::sigma_pixels
+//   IMAGEPROC_TIMER(rotate);  // times the rest of the scope to Timer::rotate
+
+#ifdef IMAGEPROC_STATS
+
+#include <chrono>
+#include <cstdint>
+#include "imageproc.h"
+
+namespace imageproc {
+namespace stats {
+
+void add(Counter counter, std::uint64_t n);
+void add(Timer timer, std::uint64_t ns);
+
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Timer timer)
+      : timer(timer), start(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    add(timer, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count());
+  }
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  Timer timer;
+  std::chrono::steady_clock::time_point start;
+};
+
+} /* namespace stats */
+} /* namespace imageproc */
+
+#define IMAGEPROC_COUNT(counter, n)                                            \
+  ::imageproc::stats::add(::imageproc::Counter::counter,                       \
+                          static_cast<std::uint64_t>(n))
+#define IMAGEPROC_TIMER(timer)                                                 \
+  ::imageproc::stats::ScopedTimer imageproc_timer_##timer(                     \
+      ::imageproc::Timer::timer)
+
+#else
+
+#define IMAGEPROC_COUNT(counter, n) ((void)0)
+#define IMAGEPROC_TIMER(timer) ((void)0)
+
+#endif /* IMAGEPROC_STATS */
+
+#endif /* __STATS_H */
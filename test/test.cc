@@ -1,12 +1,20 @@
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <ios>     // std::fixed
 #include <iomanip> // std::setprecision
 #include <string>
 #include <array>
+#include <vector>
+#include <utility> // std::move
+#include <cstring> // memcmp
+#include <cstdlib> // std::abs
+#include <algorithm> // std::min
+#include <iterator>  // std::istreambuf_iterator
 
 #include <rawimage.h>
 #include <imageproc.h>
+#include <pipeline.h>
 
 using namespace imageproc;
 
@@ -24,6 +32,10 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  int status = 0;
+  // Buffers of all the output images are recycled through one pool
+  rawimage::BufferPool pool;
+
   for (int i = 1; i < argc; i++) {
     std::cout << argv[i] << '\n';
     std::string input(argv[i]);
@@ -31,9 +43,14 @@ int main(int argc, char **argv) {
     RawIm img{ byteOrder, pixFormat };
     img.read(input.c_str());
 
-    RawIm img_out{ byteOrder, pixFormat };
+    RawIm img_out{ byteOrder, pixFormat, &pool };
 
     img_out.create(img.getW(), img.getH());
+    // create() with the same size must keep the buffer
+    const unsigned char *out_buffer = img_out.raw.chr;
+
+    RawIm img_check{ byteOrder, pixFormat, &pool };
+    size_t imgBytes = img.getW() * img.getH() * img.getDepth();
 
     std::array<unsigned char, 3> sigmas{ 50U, 100U, 150U };
     for (auto sig : sigmas) {
@@ -45,9 +62,104 @@ int main(int argc, char **argv) {
                 << ".png";
       std::cout << '>' << sigma_out.str() << '\n';
       img_out.save(sigma_out.str().c_str());
+
+      // The engines must all give exactly the same result
+      for (SigmaEngine engine :
+           { SigmaEngine::row_histogram, SigmaEngine::column_histogram,
+             SigmaEngine::direct_window }) {
+        img_check.create(img.getW(), img.getH());
+        sigma_filter(img.raw.chr, img_check.raw.chr, img.getW(), img.getH(),
+                     img.getDepth(), sig, 1U, 1U, engine);
+        if (memcmp(img_out.raw.chr, img_check.raw.chr, imgBytes)) {
+          std::cerr << "sigma_filter engines differ for sigma="
+                    << static_cast<int>(sig) << '\n';
+          status = 1;
+        }
+      }
       img_out.create(img.getW(), img.getH());
     }
 
+    // A region of interest filtered through views must match the same region
+    // copied out and filtered on its own
+    {
+      size_t roi_w = img.getW() / 2, roi_h = img.getH() / 2;
+      size_t roi_bytes = roi_w * img.getDepth();
+      ConstImageView view(img.raw.chr, img.getW(), img.getH(), img.getDepth());
+      ConstImageView roi = view.crop(img.getH() / 4, img.getW() / 4, roi_w,
+                                     roi_h);
+      RawIm roi_copy{ byteOrder, pixFormat };
+
+      roi_copy.create(roi_w, roi_h);
+      for (size_t r = 0U; r < roi_h; r++)
+        memcpy(roi_copy.raw.chr + r * roi_bytes, roi.data + r * roi.stride,
+               roi_bytes);
+      sigma_filter(roi_copy.raw.chr, img_out.raw.chr, roi_w, roi_h,
+                   img.getDepth(), sigmas[0]);
+
+      img_check.create(img.getW(), img.getH());
+      ImageView out_roi =
+          ImageView(img_check.raw.chr, img.getW(), img.getH(), img.getDepth())
+              .crop(img.getH() / 4, img.getW() / 4, roi_w, roi_h);
+      sigma_filter(roi, out_roi, sigmas[0]);
+      for (size_t r = 0U; r < roi_h; r++) {
+        if (memcmp(img_out.raw.chr + r * roi_bytes,
+                   out_roi.data + r * out_roi.stride, roi_bytes)) {
+          std::cerr << "sigma_filter on a cropped view differs\n";
+          status = 1;
+          break;
+        }
+      }
+      img_out.create(img.getW(), img.getH());
+    }
+
+    // Filtering a stream of row strips must give the whole-image result
+    {
+      size_t row_bytes = img.getW() * img.getDepth();
+      size_t strip_rows = 16U;
+      bool same = true;
+
+      sigma_filter(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                   img.getDepth(), sigmas[0], 2U);
+      SigmaFilterStream stream(
+          img.getW(), img.getH(), img.getDepth(), sigmas[0],
+          [&](size_t row, const unsigned char *data) {
+            same = same && !memcmp(img_out.raw.chr + row * row_bytes, data,
+                                   row_bytes);
+          },
+          2U);
+      for (size_t r = 0U; r < img.getH(); r += strip_rows)
+        stream.push(img.raw.chr + r * row_bytes,
+                    std::min(strip_rows, img.getH() - r));
+      if (!same || stream.rows_out() != img.getH()) {
+        std::cerr << "SigmaFilterStream differs from sigma_filter\n";
+        status = 1;
+      }
+      img_out.create(img.getW(), img.getH());
+    }
+
+    // Planar images filtered plane by plane must give the interleaved result
+    {
+      RawIm planar{ byteOrder, pixFormat };
+      planar = img;
+      planar.setLayout(RawIm::Layout::planar);
+      sigma_filter(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                   img.getDepth(), sigmas[1]);
+      img_check = planar;
+      sigma_filter_planar(planar.raw.chr, img_check.raw.chr, img.getW(),
+                          img.getH(), img.getDepth(), sigmas[1]);
+      img_check.setLayout(RawIm::Layout::interleaved);
+      if (memcmp(img_out.raw.chr, img_check.raw.chr, imgBytes)) {
+        std::cerr << "sigma_filter_planar differs from sigma_filter\n";
+        status = 1;
+      }
+      img_out.create(img.getW(), img.getH());
+    }
+
+    if (img_out.raw.chr != out_buffer) {
+      std::cerr << "RawImage::create reallocated a large enough buffer\n";
+      status = 1;
+    }
+
     std::array<float, 3> angles{ 0.5, 1., 1.5 };
     for (auto angle : angles) {
       std::stringstream rotated_out("");
@@ -58,6 +170,22 @@ int main(int argc, char **argv) {
                   << std::setprecision(2) << angle << ".png";
       std::cout << '>' << rotated_out.str() << '\n';
       img_out.save(rotated_out.str().c_str());
+
+      // Vectorized kernels must match the scalar ones (up to the documented
+      // rounding of the floating-point version)
+      img_check.create(img.getW(), img.getH());
+      set_simd(Simd::none);
+      rotate(img.raw.chr, img_check.raw.chr, img.getW(), img.getH(),
+             img.getDepth(), angle);
+      set_simd(simd_supported());
+      for (size_t u = 0U; u < imgBytes; u++) {
+        if (std::abs(img_out.raw.chr[u] - img_check.raw.chr[u]) > 1) {
+          std::cerr << "rotate differs from scalar for angle=" << angle
+                    << '\n';
+          status = 1;
+          break;
+        }
+      }
       img_out.create(img.getW(), img.getH());
 
       rotate_fxp(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
@@ -66,9 +194,500 @@ int main(int argc, char **argv) {
                       << std::setprecision(2) << angle << ".png";
       std::cout << '>' << rotated_fxp_out.str() << '\n';
       img_out.save(rotated_fxp_out.str().c_str());
+
+      img_check.create(img.getW(), img.getH());
+      set_simd(Simd::none);
+      rotate_fxp(img.raw.chr, img_check.raw.chr, img.getW(), img.getH(),
+                 img.getDepth(), angle);
+      set_simd(simd_supported());
+      if (memcmp(img_out.raw.chr, img_check.raw.chr, imgBytes)) {
+        std::cerr << "rotate_fxp differs from scalar for angle=" << angle
+                  << '\n';
+        status = 1;
+      }
       img_out.create(img.getW(), img.getH());
+
+      // Whole rotated image in an expanded canvas, the corners are not
+      // clipped
+      size_t canvas_w, canvas_h;
+      std::stringstream expanded_out("");
+      rotated_size(img.getW(), img.getH(), angle, canvas_w, canvas_h);
+      img_check.create(canvas_w, canvas_h);
+      rotate(img.raw.chr, img.getW(), img.getH(), 0U, img_check.raw.chr,
+             canvas_w, canvas_h, 0U, img.getDepth(), angle);
+      expanded_out << input << "._rotated_expanded_ang=" << std::fixed
+                   << std::setprecision(2) << angle << ".png";
+      std::cout << '>' << expanded_out.str() << '\n';
+      img_check.save(expanded_out.str().c_str());
+    }
+
+    // Bicubic and Lanczos-3 rotations stay close to the bilinear one on the
+    // whole and keep flat areas exactly flat
+    for (Interpolation interp :
+         { Interpolation::bicubic, Interpolation::lanczos3 }) {
+      const char *name =
+          interp == Interpolation::bicubic ? "bicubic" : "lanczos3";
+      std::string interp_out = input + "._rotated_" + name + ".png";
+      std::vector<unsigned char> flat(imgBytes, 100U), flat_out(imgBytes);
+
+      img_check.create(img.getW(), img.getH());
+      rotate(img.raw.chr, img_check.raw.chr, img.getW(), img.getH(),
+             img.getDepth(), 0.5f);
+      for (int fxp = 0; fxp < 2; fxp++) {
+        double total_diff = 0.;
+        if (fxp) {
+          rotate_fxp(img.raw.chr, img_check.raw.chr, img.getW(), img.getH(),
+                     img.getDepth(), 0.5f);
+          rotate_fxp(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                     img.getDepth(), 0.5f, 0U, interp);
+          rotate_fxp(flat.data(), flat_out.data(), img.getW(), img.getH(),
+                     img.getDepth(), 0.5f, 0U, interp);
+        } else {
+          rotate(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                 img.getDepth(), 0.5f, 0U, interp);
+          rotate(flat.data(), flat_out.data(), img.getW(), img.getH(),
+                 img.getDepth(), 0.5f, 0U, interp);
+          std::cout << '>' << interp_out << '\n';
+          img_out.save(interp_out.c_str());
+        }
+        for (size_t u = 0U; u < imgBytes; u++) {
+          total_diff += std::abs(img_out.raw.chr[u] - img_check.raw.chr[u]);
+          if (flat_out[u] != 0U && flat_out[u] != 100U)
+            total_diff = 1e30;
+        }
+        if (total_diff / imgBytes > 3.) {
+          std::cerr << (fxp ? "rotate_fxp " : "rotate ") << name
+                    << " differs from bilinear\n";
+          status = 1;
+        }
+      }
+    }
+    img_out.create(img.getW(), img.getH());
+
+    for (int o = 1; o <= 8; o++) {
+      Orientation orientation = static_cast<Orientation>(o);
+      // rotate_90 and rotate_270 undo each other, the rest undo themselves
+      Orientation inverse = orientation;
+      if (orientation == Orientation::rotate_90)
+        inverse = Orientation::rotate_270;
+      else if (orientation == Orientation::rotate_270)
+        inverse = Orientation::rotate_90;
+      bool swapped = o >= 5;
+      size_t out_w = swapped ? img.getH() : img.getW();
+      size_t out_h = swapped ? img.getW() : img.getH();
+      std::stringstream reoriented_out("");
+
+      img_out.create(out_w, out_h);
+      reorient(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+               img.getDepth(), orientation);
+      reoriented_out << input << "._reoriented_" << o << ".png";
+      std::cout << '>' << reoriented_out.str() << '\n';
+      img_out.save(reoriented_out.str().c_str());
+
+      img_check.create(img.getW(), img.getH());
+      reorient(img_out.raw.chr, img_check.raw.chr, out_w, out_h,
+               img.getDepth(), inverse);
+      if (memcmp(img.raw.chr, img_check.raw.chr, imgBytes)) {
+        std::cerr << "reorient is not lossless for orientation=" << o << '\n';
+        status = 1;
+      }
+    }
+
+    // Gray conversion against the reference weights: 8-bit pixels are
+    // weighted exactly (so at most 1 above the double-precision formula),
+    // floats with the double-precision formula itself
+    {
+      const RawIm::PixFormat flo = RawIm::PixFormat::flo;
+      RawIm gray{ byteOrder, pixFormat }, rgb_flo{ byteOrder, flo },
+          gray_flo{ byteOrder, flo }, saved{ byteOrder, pixFormat };
+      std::string gray_out = input + "._gray.png";
+      size_t pixels = img.getW() * img.getH();
+      bool same = true;
+
+      gray = img;
+      gray.toGray();
+      rgb_flo.read(input.c_str());
+      gray_flo = rgb_flo;
+      gray_flo.toGray();
+      for (size_t u = 0U; u < pixels; u++) {
+        const unsigned char *pix = img.raw.chr + u * img.getDepth();
+        const float *pix_flo = rgb_flo.raw.flo + u * rgb_flo.getDepth();
+        int exact = (11 * pix[0] + 59 * pix[1] + 30 * pix[2]) / 100;
+        int approx = static_cast<unsigned char>(
+            (pix[2] * 0.3) + (pix[1] * 0.59) + (pix[0] * 0.11));
+        float ref_flo =
+            (pix_flo[2] * 0.3) + (pix_flo[1] * 0.59) + (pix_flo[0] * 0.11);
+        same = same && gray.raw.chr[u] == exact && exact - approx <= 1 &&
+               gray_flo.raw.flo[u] == ref_flo;
+      }
+      if (!same) {
+        std::cerr << "toGray differs from the reference weights\n";
+        status = 1;
+      }
+
+      // Gray images are saved with 3 equal channels
+      std::cout << '>' << gray_out << '\n';
+      gray.save(gray_out.c_str());
+      saved.read(gray_out.c_str());
+      for (size_t u = 0U; u < pixels * 3U; u++) {
+        if (saved.raw.chr[u] != gray.raw.chr[u / 3U]) {
+          std::cerr << "saved gray image differs\n";
+          status = 1;
+          break;
+        }
+      }
+    }
+
+    // 16-bit and float kernels on the 8-bit values: the sigma filter must
+    // give the 8-bit means (rounded for floats), rotations the 8-bit pixels up
+    // to the rounding of the vectorized kernels
+    {
+      const RawIm::PixFormat flo = RawIm::PixFormat::flo;
+      std::vector<std::uint16_t> in16(img.raw.chr, img.raw.chr + imgBytes),
+          out16(imgBytes);
+      std::vector<float> in_flo(img.raw.chr, img.raw.chr + imgBytes),
+          out_flo(imgBytes);
+      RawIm img_flo{ byteOrder, flo }, sigma_flo{ byteOrder, flo };
+      std::string flo_out = input + "._sigma_flo.png";
+      bool same = true;
+
+      sigma_filter(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                   img.getDepth(), 50U, 2U);
+      sigma_filter(in16.data(), out16.data(), img.getW(), img.getH(),
+                   img.getDepth(), 50U, 2U);
+      sigma_filter(in_flo.data(), out_flo.data(), img.getW(), img.getH(),
+                   img.getDepth(), 50.f, 2U);
+      for (size_t u = 0U; u < imgBytes; u++)
+        same = same && out16[u] == img_out.raw.chr[u] &&
+               static_cast<int>(out_flo[u] + .5f) == img_out.raw.chr[u];
+      if (!same) {
+        std::cerr << "16-bit or float sigma_filter differs from 8-bit\n";
+        status = 1;
+      }
+
+      same = true;
+      rotate(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+             img.getDepth(), 0.5f);
+      rotate(in16.data(), out16.data(), img.getW(), img.getH(),
+             img.getDepth(), 0.5f);
+      rotate(in_flo.data(), out_flo.data(), img.getW(), img.getH(),
+             img.getDepth(), 0.5f);
+      for (size_t u = 0U; u < imgBytes; u++)
+        same = same && std::abs(out16[u] - img_out.raw.chr[u]) <= 1 &&
+               std::abs(static_cast<int>(out_flo[u]) - out16[u]) <= 1;
+      if (!same) {
+        std::cerr << "16-bit or float rotate differs from 8-bit\n";
+        status = 1;
+      }
+
+      // Float RawImages go through the float kernels as they are
+      img_flo.read(input.c_str());
+      sigma_flo.create(img.getW(), img.getH(), false);
+      sigma_filter(img_flo.raw.flo, sigma_flo.raw.flo, img.getW(), img.getH(),
+                   img.getDepth(), 50.f / 255.f);
+      std::cout << '>' << flo_out << '\n';
+      sigma_flo.save(flo_out.c_str());
+      img_out.create(img.getW(), img.getH());
+    }
+
+    // RGBA: the color channels must come out as for the RGB image, the alpha
+    // channel as it was with AlphaMode::pass_through
+    {
+      size_t pixels = img.getW() * img.getH();
+      std::vector<unsigned char> rgba(pixels * 4U), rgba_out(pixels * 4U);
+      bool same = true;
+
+      for (size_t u = 0U; u < pixels; u++) {
+        memcpy(&rgba[u * 4U], img.raw.chr + u * 3U, 3U);
+        rgba[u * 4U + 3U] = static_cast<unsigned char>(u * 7U);
+      }
+      sigma_filter(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                   img.getDepth(), 50U, 2U);
+      sigma_filter(rgba.data(), rgba_out.data(), img.getW(), img.getH(), 4U,
+                   50U, 2U, 1U, SigmaEngine::row_histogram,
+                   AlphaMode::pass_through);
+      for (size_t u = 0U; u < pixels; u++)
+        same = same && !memcmp(&rgba_out[u * 4U], img_out.raw.chr + u * 3U,
+                               3U) &&
+               rgba_out[u * 4U + 3U] == rgba[u * 4U + 3U];
+      if (!same) {
+        std::cerr << "RGBA sigma_filter differs from RGB\n";
+        status = 1;
+      }
+
+      same = true;
+      rotate_fxp(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                 img.getDepth(), 0.5f);
+      rotate_fxp(rgba.data(), rgba_out.data(), img.getW(), img.getH(), 4U,
+                 0.5f);
+      for (size_t u = 0U; u < pixels; u++)
+        same = same &&
+               !memcmp(&rgba_out[u * 4U], img_out.raw.chr + u * 3U, 3U);
+      if (!same) {
+        std::cerr << "RGBA rotate_fxp differs from RGB\n";
+        status = 1;
+      }
+    }
+
+    // The fused deskew + denoise + gray pass must match the three operations
+    // run one after the other, with and without threads
+    {
+      size_t pixels = img.getW() * img.getH();
+      std::vector<unsigned char> rotated(imgBytes), gray(pixels),
+          fused(pixels);
+
+      rotate_fxp(img.raw.chr, rotated.data(), img.getW(), img.getH(),
+                 img.getDepth(), 0.05f);
+      sigma_filter(rotated.data(), img_out.raw.chr, img.getW(), img.getH(),
+                   img.getDepth(), 50U, 2U);
+      to_gray(img_out.raw.chr, gray.data(), img.getW(), img.getH(),
+              img.getDepth());
+      for (size_t threads : { 1U, 3U }) {
+        FusedChain()
+            .rotate_fxp(0.05f)
+            .sigma_filter(50U, 2U)
+            .to_gray()
+            .run(ConstImageView(img.raw.chr, img.getW(), img.getH(),
+                                img.getDepth()),
+                 ImageView(fused.data(), img.getW(), img.getH(), 1U),
+                 threads);
+        if (fused != gray) {
+          std::cerr << "FusedChain differs from the separate operations ("
+                    << threads << " threads)\n";
+          status = 1;
+        }
+      }
+    }
+
+    // Rotations and conversions split over executor tasks must match the
+    // serial ones, also on an executor of the caller
+    {
+      struct Inline : Executor {
+        size_t tasks = 0U;
+        void run(size_t count,
+                 const std::function<void(size_t)> &task) override {
+          tasks += count;
+          for (size_t i = count; i-- > 0U;) // in reverse
+            task(i);
+        }
+        size_t concurrency() const override { return 4U; }
+      } executor;
+      size_t pixels = img.getW() * img.getH();
+      std::vector<unsigned char> serial(imgBytes), threaded(imgBytes);
+      std::vector<unsigned char> gray(pixels), gray_threaded(pixels);
+
+      rotate(img.raw.chr, serial.data(), img.getW(), img.getH(),
+             img.getDepth(), 0.6f, 32U);
+      to_gray(img.raw.chr, gray.data(), img.getW(), img.getH(),
+              img.getDepth());
+      for (int custom = 0; custom < 2; custom++) {
+        set_executor(custom ? &executor : nullptr);
+        rotate(img.raw.chr, threaded.data(), img.getW(), img.getH(),
+               img.getDepth(), 0.6f, 32U, Interpolation::bilinear, 0U);
+        to_gray(img.raw.chr, gray_threaded.data(), img.getW(), img.getH(),
+                img.getDepth(), 3U);
+        set_executor(nullptr);
+        if (threaded != serial || gray_threaded != gray) {
+          std::cerr << "Threaded rotate or to_gray differs from the serial "
+                       "one\n";
+          status = 1;
+        }
+      }
+      if (executor.tasks != 4U + 3U) {
+        std::cerr << "Kernels did not run on the executor set\n";
+        status = 1;
+      }
+    }
+
+    // Border modes: the padded crop of the image filters as the image does
+    // away from its edges, and replicated rotations write every pixel
+    {
+      const size_t k = 2U, margin = 8U;
+      size_t w = img.getW() - 2U * margin, h = img.getH() - 2U * margin;
+      size_t depth = img.getDepth(), stride = img.getW() * depth;
+      ConstImageView whole(img.raw.chr, img.getW(), img.getH(), depth);
+      std::vector<unsigned char> crop(w * h * depth), first(imgBytes, 0U),
+          second(imgBytes, 255U);
+      bool same = true;
+
+      sigma_filter(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                   depth, 50U, k);
+      sigma_filter(whole.crop(margin, margin, w, h),
+                   ImageView(crop.data(), w, h, depth), 50U, k, 2U,
+                   SigmaEngine::automatic, AlphaMode::filter,
+                   Border(BorderMode::padded, 0U, k));
+      for (size_t y = 0U; y < h; y++)
+        same = same && !memcmp(&crop[y * w * depth],
+                               img_out.raw.chr + (y + margin) * stride +
+                                   margin * depth,
+                               w * depth);
+      if (!same) {
+        std::cerr << "padded sigma_filter differs from the whole image\n";
+        status = 1;
+      }
+
+      rotate_fxp(whole, ImageView(first.data(), img.getW(), img.getH(), depth),
+                 0.5f, 0U, Interpolation::bilinear, 1U,
+                 Border(BorderMode::replicate));
+      rotate_fxp(whole,
+                 ImageView(second.data(), img.getW(), img.getH(), depth),
+                 0.5f, 32U, Interpolation::bilinear, 3U,
+                 Border(BorderMode::replicate));
+      if (first != second) {
+        std::cerr << "replicated rotate_fxp left pixels unwritten\n";
+        status = 1;
+      }
+    }
+
+    // Instrumentation counts every pixel once, or nothing when compiled out
+    {
+      size_t pixels = img.getW() * img.getH();
+      std::uint64_t expected = stats_enabled() ? pixels : 0U;
+
+      reset_stats();
+      sigma_filter(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                   img.getDepth(), 50U, 2U, 2U, SigmaEngine::row_histogram);
+      rotate(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+             img.getDepth(), 0.5f);
+      Stats stats = get_stats();
+      if (stats[Counter::sigma_pixels] != expected ||
+          stats[Counter::sigma_range_queries] != expected * img.getDepth() ||
+          stats[Counter::rotate_pixels] != expected ||
+          stats[Counter::rotate_in_bounds] > expected ||
+          (stats.ns(Timer::sigma_sweep) > 0U) != stats_enabled()) {
+        std::cerr << "instrumentation counters are off\n";
+        status = 1;
+      }
+    }
+
+    // A raw frame file maps back to the same pixels, without a copy
+    {
+      std::string raw_out = input + "._frame.raw";
+      RawIm mapped;
+
+      std::cout << '>' << raw_out << '\n';
+      img.saveRaw(raw_out.c_str());
+      mapped.mapRaw(raw_out.c_str(), RawIm::MapMode::readOnly);
+      if (!mapped.isMapped() || mapped.getW() != img.getW() ||
+          mapped.getH() != img.getH() ||
+          mapped.getByteOrder() != img.getByteOrder() ||
+          memcmp(mapped.raw.chr, img.raw.chr, imgBytes)) {
+        std::cerr << "raw frame file does not map back to the image\n";
+        status = 1;
+      }
+
+      // Read-only mappings are converted to gray into a new buffer, for both
+      // layouts, instead of being written
+      for (RawIm::Layout layout :
+           { RawIm::Layout::interleaved, RawIm::Layout::planar }) {
+        RawIm gray{ byteOrder, pixFormat }, gray_mapped;
+        gray = img;
+        gray.setLayout(layout);
+        gray.saveRaw(raw_out.c_str());
+        gray_mapped.mapRaw(raw_out.c_str(), RawIm::MapMode::readOnly);
+        gray.toGray();
+        gray_mapped.toGray();
+        if (gray_mapped.isMapped() ||
+            gray_mapped.getByteOrder() != RawIm::ByteOrder::gray ||
+            gray_mapped.getLayout() != layout ||
+            memcmp(gray_mapped.raw.chr, gray.raw.chr,
+                   img.getW() * img.getH())) {
+          std::cerr << "toGray() of a read-only mapping differs\n";
+          status = 1;
+        }
+      }
+
+      // Damaged files (truncated, bad magic, sizes wrapping around, pixels
+      // off the buffer alignment) are rejected and leave the image as it was
+      std::ifstream saved(raw_out, std::ios::binary);
+      std::string bytes((std::istreambuf_iterator<char>(saved)),
+                        std::istreambuf_iterator<char>());
+      std::string overflow(68U, '\0');
+      overflow.replace(0U, 8U, "RAWFRAME");
+      overflow[8] = 64;        // header size
+      overflow[12] = 2;        // rgba
+      overflow[24] = 1;        // width 0x4000000000000001
+      overflow[31] = 0x40;
+      overflow[32] = 1;        // height 1
+      overflow[40] = 4;        // stride 4
+      std::string misaligned = bytes;
+      misaligned[8] = 65;
+      std::vector<std::string> damaged{ bytes.substr(0U, bytes.size() / 2U),
+                                        "RAWFRAMX" + bytes.substr(8U),
+                                        overflow, misaligned };
+      for (const std::string &contents : damaged) {
+        RawIm rejected{ RawIm::ByteOrder::gray, RawIm::PixFormat::flo };
+        std::ofstream(raw_out, std::ios::binary) << contents;
+        rejected.mapRaw(raw_out.c_str());
+        if (rejected.raw.chr || rejected.getW() || rejected.getH() ||
+            rejected.getByteOrder() != RawIm::ByteOrder::gray ||
+            rejected.getPixFormat() != RawIm::PixFormat::flo) {
+          std::cerr << "damaged raw frame file was mapped\n";
+          status = 1;
+        }
+      }
+    }
+
+    // Images are movable, the buffer goes with them
+    std::vector<RawIm> frames;
+    out_buffer = img_out.raw.chr;
+    frames.push_back(std::move(img_out));
+    if (frames.back().raw.chr != out_buffer || img_out.raw.chr) {
+      std::cerr << "RawImage move did not transfer the buffer\n";
+      status = 1;
+    }
+  }
+
+  // The batch pipeline must write the same images as processing them one by
+  // one
+  {
+    std::vector<std::pair<std::string, std::string> > files;
+    pipeline::Config config;
+    const unsigned char sigma = 50U;
+
+    for (int i = 1; i < argc; i++)
+      files.emplace_back(argv[i], std::string(argv[i]) + "._batch_sigma.png");
+    config.processWorkers = 2U;
+    config.encodeWorkers = 2U;
+    pipeline::BatchPipeline batch(config, [&](pipeline::Job &job) {
+      const RawIm &in = job.image;
+      job.result.create(in.getW(), in.getH(), false);
+      sigma_filter(in.raw.chr, job.result.raw.chr, in.getW(), in.getH(),
+                   in.getDepth(), sigma);
+    });
+    pipeline::Stats stats = batch.run(files);
+    if (stats.images != files.size() || stats.failed) {
+      std::cerr << "batch pipeline failed on some images\n";
+      status = 1;
+    }
+
+    for (const auto &file : files) {
+      RawIm img{ byteOrder, pixFormat }, img_out{ byteOrder, pixFormat },
+          img_batch{ byteOrder, pixFormat };
+      std::cout << '>' << file.second << '\n';
+      img.read(file.first.c_str());
+      img_batch.read(file.second.c_str());
+      img_out.create(img.getW(), img.getH());
+      sigma_filter(img.raw.chr, img_out.raw.chr, img.getW(), img.getH(),
+                   img.getDepth(), sigma);
+      if (img_batch.getW() != img.getW() || img_batch.getH() != img.getH() ||
+          memcmp(img_out.raw.chr, img_batch.raw.chr,
+                 img.getW() * img.getH() * img.getDepth())) {
+        std::cerr << "batch pipeline output differs for " << file.first
+                  << '\n';
+        status = 1;
+      }
+    }
+
+    // Raw frame files that cannot be written are failures, not images
+    for (auto &file : files)
+      file.second = file.first + "._missing_dir/frame.raw";
+    stats = batch.run(files);
+    if (stats.images || stats.failed != files.size()) {
+      std::cerr << "batch pipeline counted unwritten raw frames\n";
+      status = 1;
     }
   }
 
-  return 0;
+  return status;
 }
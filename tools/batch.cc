@@ -0,0 +1,246 @@
+#include <iostream>
+#include <ios>     // std::fixed
+#include <iomanip> // std::setprecision
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <rawimage.h>
+#include <imageproc.h>
+#include <pipeline.h>
+
+// Regular files of a directory, sorted by name
+static std::vector<std::string> listFiles(const std::string &dir) {
+  std::vector<std::string> names;
+  DIR *dp = opendir(dir.c_str());
+
+  if (!dp) {
+    std::cerr << "Cannot open directory " << dir << ".\n";
+    return names;
+  }
+  while (struct dirent *entry = readdir(dp)) {
+    struct stat st;
+    std::string name(entry->d_name);
+    if (!stat((dir + '/' + name).c_str(), &st) && S_ISREG(st.st_mode))
+      names.push_back(name);
+  }
+  closedir(dp);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+static void usage(const char *argv0) {
+  std::cerr
+      << "Usage: " << argv0 << " [options] input_dir output_dir\n"
+      << "Processes every image of input_dir into output_dir/<name>.<ext>\n"
+      << "  -op sigma|rotate|rotate_fxp|gray|copy  operation (sigma), or\n"
+      << "                several of sigma, rotate, rotate_fxp and gray\n"
+      << "                joined by '+' (e.g. rotate_fxp+sigma+gray), run in\n"
+      << "                a single fused pass over 8-bit images\n"
+      << "  -sigma N      sigma filter sigma (50)\n"
+      << "  -kernel N     sigma filter kernel size (1)\n"
+      << "  -angle A      rotation angle in radians (0.5)\n"
+      << "  -interp I     rotation interpolation, bilinear, bicubic or\n"
+      << "                lanczos3 (bilinear)\n"
+      << "  -format F     pixel format of decoded images, chr (8-bit) or flo\n"
+      << "                (floats in [0, 1], -sigma is scaled by 1/255) (chr)\n"
+      << "  -threads N    threads of each operation, 0 == all (1)\n"
+      << "  -decoders N   decode workers (1)\n"
+      << "  -workers N    operation workers (hardware threads)\n"
+      << "  -encoders N   encode workers (hardware threads)\n"
+      << "  -queue N      images queued between two stages (4)\n"
+      << "  -ext EXT      output format, raw == raw frame files (png)\n"
+      << "  -stats        print the kernel counters and timers (library built\n"
+      << "                with IMAGEPROC_STATS)\n";
+}
+
+int main(int argc, char **argv) {
+  using namespace imageproc;
+  pipeline::Config config;
+  using RawImage = pipeline::RawImage;
+  std::string op("sigma"), ext("png"), format("chr"), interp("bilinear");
+  unsigned sigma = 50U;
+  size_t kernel = 1U, threads = 1U;
+  float angle = 0.5f;
+  bool print_stats = false;
+  std::vector<std::string> dirs;
+
+  config.processWorkers = std::max(1U, std::thread::hardware_concurrency());
+  config.encodeWorkers = config.processWorkers;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg[0] != '-') {
+      dirs.push_back(arg);
+      continue;
+    }
+    if (arg == "-stats") {
+      print_stats = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "-op")
+      op = value;
+    else if (arg == "-sigma")
+      sigma = strtoul(value, nullptr, 10);
+    else if (arg == "-kernel")
+      kernel = strtoul(value, nullptr, 10);
+    else if (arg == "-angle")
+      angle = strtof(value, nullptr);
+    else if (arg == "-interp")
+      interp = value;
+    else if (arg == "-format")
+      format = value;
+    else if (arg == "-threads")
+      threads = strtoul(value, nullptr, 10);
+    else if (arg == "-decoders")
+      config.decodeWorkers = strtoul(value, nullptr, 10);
+    else if (arg == "-workers")
+      config.processWorkers = strtoul(value, nullptr, 10);
+    else if (arg == "-encoders")
+      config.encodeWorkers = strtoul(value, nullptr, 10);
+    else if (arg == "-queue")
+      config.queueCapacity = strtoul(value, nullptr, 10);
+    else if (arg == "-ext")
+      ext = value;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (dirs.size() != 2U || sigma > 255U ||
+      (format != "chr" && format != "flo") ||
+      (interp != "bilinear" && interp != "bicubic" && interp != "lanczos3")) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (format == "flo")
+    config.pixFormat = RawImage::PixFormat::flo;
+
+  // Operations follow the pixel format of each image, raw frame files keep
+  // the one they were saved with
+  Interpolation mode = Interpolation::bilinear;
+  if (interp == "bicubic")
+    mode = Interpolation::bicubic;
+  else if (interp == "lanczos3")
+    mode = Interpolation::lanczos3;
+
+  pipeline::Operation operation;
+  if (op.find('+') != std::string::npos) {
+    FusedChain chain;
+    bool gray = false;
+    for (size_t begin = 0U; begin <= op.size();) {
+      size_t end = std::min(op.find('+', begin), op.size());
+      std::string name = op.substr(begin, end - begin);
+      if (name == "sigma")
+        chain.sigma_filter(static_cast<unsigned char>(sigma), kernel);
+      else if (name == "rotate")
+        chain.rotate(angle, mode);
+      else if (name == "rotate_fxp")
+        chain.rotate_fxp(angle, mode);
+      else if (name == "gray") {
+        chain.to_gray();
+        gray = true;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+      begin = end + 1U;
+    }
+    operation = [=](pipeline::Job &job) {
+      const RawImage &in = job.image;
+      size_t depth = chain.output_channels(in.getDepth());
+      if (in.getPixFormat() == RawImage::PixFormat::flo)
+        throw std::invalid_argument("chained operations need 8-bit pixels");
+      if (gray && in.getDepth() < 3U)
+        throw std::invalid_argument("gray needs 3 or more channels");
+      if (depth != in.getDepth())
+        job.result = RawImage(RawImage::ByteOrder::gray,
+                              RawImage::PixFormat::chr);
+      job.result.create(in.getW(), in.getH(), false); // fully written
+      chain.run(ConstImageView(in.raw.chr, in.getW(), in.getH(),
+                               in.getDepth()),
+                ImageView(job.result.raw.chr, in.getW(), in.getH(), depth),
+                threads);
+    };
+  } else if (op == "sigma") {
+    operation = [=](pipeline::Job &job) {
+      const RawImage &in = job.image;
+      job.result.create(in.getW(), in.getH(), false);
+      if (in.getPixFormat() == RawImage::PixFormat::flo)
+        sigma_filter(in.raw.flo, job.result.raw.flo, in.getW(), in.getH(),
+                     in.getDepth(), sigma / 255.f, kernel, threads);
+      else
+        sigma_filter(in.raw.chr, job.result.raw.chr, in.getW(), in.getH(),
+                     in.getDepth(), static_cast<unsigned char>(sigma), kernel,
+                     threads);
+    };
+  } else if (op == "rotate" || op == "rotate_fxp") {
+    bool fxp = op == "rotate_fxp";
+    operation = [=](pipeline::Job &job) {
+      const RawImage &in = job.image;
+      bool flo = in.getPixFormat() == RawImage::PixFormat::flo;
+      if (fxp && flo)
+        throw std::invalid_argument("rotate_fxp needs 8-bit pixels");
+      job.result.create(in.getW(), in.getH(), false); // fully written
+      if (fxp)
+        rotate_fxp(in.raw.chr, job.result.raw.chr, in.getW(), in.getH(),
+                   in.getDepth(), angle, 0U, mode, threads);
+      else if (flo)
+        rotate(in.raw.flo, job.result.raw.flo, in.getW(), in.getH(),
+               in.getDepth(), angle, 0U, mode, threads);
+      else
+        rotate(in.raw.chr, job.result.raw.chr, in.getW(), in.getH(),
+               in.getDepth(), angle, 0U, mode, threads);
+    };
+  } else if (op == "gray") {
+    operation = [=](pipeline::Job &job) {
+      job.image.setThreads(threads);
+      job.image.toGray();
+    };
+  } else if (op == "copy") {
+    operation = [](pipeline::Job &) {};
+  } else {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<std::pair<std::string, std::string> > files;
+  for (const auto &name : listFiles(dirs[0])) {
+    std::string stem = name.substr(0U, name.rfind('.'));
+    files.emplace_back(dirs[0] + '/' + name, dirs[1] + '/' + stem + '.' + ext);
+  }
+  if (files.empty()) {
+    std::cerr << "No input files.\n";
+    return 1;
+  }
+
+  rawimage::init(argc, argv);
+  pipeline::BatchPipeline batch(config, operation);
+  pipeline::Stats stats = batch.run(files);
+
+  std::cout << stats.images << " images (" << stats.failed << " failed), "
+            << std::fixed << std::setprecision(1) << stats.megapixels
+            << " MP in " << std::setprecision(3) << stats.seconds << " s: "
+            << std::setprecision(2) << stats.imagesPerSecond()
+            << " images/s, " << stats.megapixelsPerSecond() << " MP/s\n";
+  if (print_stats) {
+    if (!stats_enabled())
+      std::cout << "Kernel statistics are not compiled in.\n";
+    else
+      export_stats([](const char *name, std::uint64_t value) {
+        std::cout << name << ' ' << value << '\n';
+      });
+  }
+  return stats.failed ? 1 : 0;
+}